@@ -44,33 +44,21 @@ int noisePeriodLookup[] = {
 
 const double cpuFrequency = 1789773;
 
+// output rate, 48000 works just as well
+const int sampleRate = 44100;
+
+// samples of one audio frame, with room to spare
+const int maxFrameSamples = 2048;
+
+// cpu cycles between the samples shown in the APU debugger
+const tCPU::dword debugSampleInterval = 34;
+
 /*
  * The triangle wave channel has the ability to generate an output triangle
 wave with a resolution of 4-bits (16 steps), in the range of 27.3 Hz to 55.9
 KHz.
  */
 
-void
-Audio::populate(Uint8 *stream, int len) {
-    for (int i = 0; i < len; i++) {
-        Uint8 total = 128;
-
-        int step = square1.phase / 2048;
-        int value = dutyCycleSequence[square1.dutyCycle][step] ? 1 * square1.volume : 0;
-        square1.phase += cpuFrequency / (16 * (square1.timerPeriodReloader - 1));
-        square1.phase %= 65536;
-        total += value;
-
-//        step = square2.phase / 8192;
-//        value = dutyCycleSequence[square2.dutyCycle][step] ? 2 * square2.volume : 0;
-//        square2.phase += cpuFrequency / (16 * (square2.timerPeriodReloader));
-//        square2.phase %= 65536;
-//        total += value;
-
-        stream[i] = total;
-    }
-}
-
 void ChannelDebug::initialize(int numSamples) {
     fftSize = numSamples;
     samples = (double *) fftw_malloc(sizeof(double) * numSamples);
@@ -205,28 +193,28 @@ void ChannelDebug::compute(tCPU::byte *fftRaster, tCPU::byte *waveformRaster) {
 Audio::Audio(Raster *raster) {
     this->raster = raster;
 
-    square1.buffer = new tCPU::byte[2048];
-    memset(square1.buffer, 128, 2048);
+    synthesis = new BandLimitedBuffer(cpuFrequency, sampleRate, maxFrameSamples);
+    samples = new int16_t[maxFrameSamples];
 
-    buffer = new tCPU::byte[bufferSize];
-    memset(buffer, 128, bufferSize);
+    // nonlinear mixer, indexed by the summed square levels and by 3 * triangle + 2 * noise
+    for (int i = 0; i < 31; i++) {
+        pulseMix[i] = i == 0 ? 0 : 95.52f / (8128.0f / i + 100);
+    }
+    for (int i = 0; i < 203; i++) {
+        tndMix[i] = i == 0 ? 0 : 163.67f / (24329.0f / i + 100);
+    }
 
-    square1Debug.initialize(4096);
-    square2Debug.initialize(4096);
-    triangleDebug.initialize(4096);
-    noiseDebug.initialize(4096);
+    for (auto &debug : channelDebug) {
+        debug.initialize(4096);
+    }
 
-    // open a single audio channel with unsigned 8-bit samples
-    // 44.1 khz and 1024 sample buffers
-    // callback is fired 43 times a second
+    // open a single audio channel with signed 16-bit samples
+    // 44.1 khz and 2048 sample buffers, filled by queueing each audio frame
     SDL_AudioSpec spec = {
-            .freq = 44100,
-            .format = AUDIO_U8,
+            .freq = sampleRate,
+            .format = AUDIO_S16SYS,
             .channels = 1,
             .samples = 2048,
-
-            // functor
-//            .callback = populateFuncPtr,
             .userdata = this,
     };
 
@@ -253,6 +241,8 @@ Audio::close() {
 
 void
 Audio::setChannelStatus(tCPU::byte status) {
+    catchUp();
+
     this->channelStatus = status;
 
     square1.enabled = ((status >> 0u) & 1u) == 1u;
@@ -276,6 +266,8 @@ Audio::setChannelStatus(tCPU::byte status) {
         SDL_PauseAudio(1);
     }
 #endif
+
+    refreshLevels();
 }
 
 tCPU::byte
@@ -301,6 +293,8 @@ Audio::writeDAC(tCPU::byte value) {
 
 void
 Audio::setSquare1Envelope(tCPU::byte value) {
+    catchUp();
+
     this->square1.volume = value & 0x0f; // constant volume or envelope decay period
 
     // if bit is set (1): envelope decay is disabled and volume is sent directly to DAC
@@ -312,10 +306,14 @@ Audio::setSquare1Envelope(tCPU::byte value) {
     PrintDbg("  volume = %d / saw-disabled = %d / length-disabled = %d / duty = %d",
              this->square1.volume, this->square1.sawEnvelopeDisabled,
              this->square1.lengthCounterDisabled, this->square1.dutyCycle);
+
+    refreshLevels();
 }
 
 // $4003
 void Audio::setSquare1NoteHigh(tCPU::byte value) {
+    catchUp();
+
     square1.timerPeriod &= 0x00ff; // clear upper bits
     square1.timerPeriod |= (value & 0x7) << 8; // OR upper 3 bits
     square1.lengthCounterLoad = lengthCounterLookup[(value & 0xf8) >> 3]; // upper 5 bits
@@ -327,12 +325,18 @@ void Audio::setSquare1NoteHigh(tCPU::byte value) {
 
     PrintDbg("  timerPeriod (high bits) = %d / lengthCounter = %d", this->square1.timerPeriod,
              this->square1.lengthCounterLoad);
+
+    refreshLevels();
 }
 
 void Audio::setSquare1NoteLow(tCPU::byte value) {
+    catchUp();
+
     this->square1.timerPeriod &= 0xff00; // clear lower 8 bits
     this->square1.timerPeriod |= value; // OR lower 8 bits
     PrintDbg("  timerPeriod (low bits) = %d", this->square1.timerPeriod);
+
+    refreshLevels();
 }
 
 void Audio::setSquare1Sweep(tCPU::byte value) {
@@ -356,6 +360,8 @@ void Audio::setSquare1Sweep(tCPU::byte value) {
 
 void
 Audio::setSquare2Envelope(tCPU::byte value) {
+    catchUp();
+
     square2.volume = value & 0x0f;
     square2.sawEnvelopeDisabled = value & (1 << 4);
     square2.lengthCounterDisabled = value & (1 << 5);
@@ -364,9 +370,13 @@ Audio::setSquare2Envelope(tCPU::byte value) {
     PrintDbg("  volume = %d / saw-disabled = %d / length-disabled = %d / duty = %d",
              square2.volume, square2.sawEnvelopeDisabled,
              square2.lengthCounterDisabled, square2.dutyCycle);
+
+    refreshLevels();
 }
 
 void Audio::setSquare2NoteHigh(tCPU::byte value) {
+    catchUp();
+
     square2.timerPeriod &= 0x00ff; // clear upper bits
     square2.timerPeriod |= (value & 0x7) << 8; // OR upper 3 bits
     square2.lengthCounterLoad = lengthCounterLookup[(value & 0xf8) >> 3]; // upper 5 bits
@@ -378,12 +388,18 @@ void Audio::setSquare2NoteHigh(tCPU::byte value) {
 
     PrintDbg("  timerPeriod (high bits) = %d / lengthCounter = %d", this->square2.timerPeriod,
              this->square2.lengthCounterLoad);
+
+    refreshLevels();
 }
 
 void Audio::setSquare2NoteLow(tCPU::byte value) {
+    catchUp();
+
     this->square2.timerPeriod &= 0xff00; // clear lower 8 bits
     this->square2.timerPeriod |= value; // OR lower 8 bits
     PrintDbg("  timerPeriod (low bits) = %d", this->square2.timerPeriod);
+
+    refreshLevels();
 }
 
 void Audio::setSquare2Sweep(tCPU::byte value) {
@@ -420,234 +436,28 @@ double hamming(int i, int nn) {
     return (0.54 - 0.46 * cos(2.0 * M_PI * (double) i / (double) (nn - 1)));
 }
 
-void Audio::execute(int cpuCycles) {
-    // for simplicity we will use 1 apu cycle = 1 cpu cycle
-    apuCycles += cpuCycles;
-    apuSampleCycleCounter += cpuCycles;
-
-    // 1789773 cycles per second for nes CPU
-    // 44100 samples per second for soundcard
-    // 1789773 / 44100 = 40.5844217 cpu cycles per sample
-    // 1789773 / 48000 = 37.2869375 cpu cycles per sample
-    // we need to sample the APU about every 40 cpu cycles
-    // and once enough samples are collected, push to the soundcard
-    //   512 samples = 12msec of audio
-    //   1024 samples = 23msec of audio
-    //   2048 = 46msec of audio
-    // vsync @ 60hz = 16msec per frame
-    // with up to 5-10msec delay per frame for vsync, 1024 is smallest safe buffer to use
-
-    static int sampleInterval = 34;
-
-    if (apuSampleCycleCounter >= sampleInterval) {
-        // clock pulse channels every other CPU cycle
-        for (int i = 0; i < apuSampleCycleCounter; i += 2) {
-            if (square1.timerValue == 0) {
-                // timer hit, step in duty cycle
-                square1.dutyStep = (square1.dutyStep + 1) % 8;
-                // reset timer
-                square1.timerValue = square1.timerPeriodReloader;
-            } else {
-                // countdown
-                square1.timerValue--;
-            }
-
-            if (square2.timerValue == 0) {
-                // timer hit, step in duty cycle
-                square2.dutyStep = (square2.dutyStep + 1) % 8;
-                // reset timer
-                square2.timerValue = square2.timerPeriodReloader;
-            } else {
-                // countdown
-                square2.timerValue--;
-            }
-        }
-
-        // clock triangle channel every CPU cycle
-        for (int i = 0; i < apuSampleCycleCounter; i++) {
-//            if (triangle.counterMode == LENGTH_COUNTER && triangle.lengthCounter > 0) {
-                if (triangle.timerValue == 0) {
-                    triangle.dutyStep = (triangle.dutyStep + 1) % 32;
-                    triangle.timerValue = triangle.timerPeriodReloader;
-                } else {
-                    triangle.timerValue--;
-                }
-//            }
-        }
-
-        for (int i = 0; i < apuSampleCycleCounter; i += 2) {
-//            if (noise.lengthCounter > 0) {
-            if (noise.timerPeriod == 0) {
-                // if loop mode enabled, xor against value of bit-6
-                // otherwise xor against bit-1
-                uint16_t xorValue = (noise.loopNoise ? (noise.shiftRegister >> 6u) : (noise.shiftRegister >> 1u)) & 1u; // loop on bit 6
-                uint16_t feedback = (noise.shiftRegister & 1u) ^xorValue; // xor against bit-0
-                noise.shiftRegister >>= 1u; // shift right
-//                    noise.shiftRegister &= ~(1 << 13); // clear bit 14
-                noise.shiftRegister |= (feedback << 14u); // set bit 14
-                noise.timerPeriod = noise.timerPeriodReloader;
-
-//                    char srBuf[33];
-//                    SDL_itoa(noise.shiftRegister, srBuf, 2);
-//                    PrintApu("noise.shiftRegister = %015s", srBuf);
-
-            } else {
-                noise.timerPeriod--;
-            }
-//            }
-        }
-
-        // output square wave
-        double value1 = 0, value2 = 0, value3 = 0, value4 = 0;
-        if (square1.enabled && square2.lengthCounterLoad > 0) {
-            value1 = dutyCycleSequence[square1.dutyCycle][square1.dutyStep] ? square1.volume : 0;
-
-            if (square1.lengthCounterLoad == 0) {
-                value1 = 0;
-            }
-
-            if (square1.timerPeriod < 8) {
-                // silence what will be otherwise supersonic/popping
-//                value1 = 0;
-            }
-        }
-        if (square2.enabled && square2.lengthCounterLoad > 0) {
-            value2 = dutyCycleSequence[square2.dutyCycle][square2.dutyStep] ? square2.volume : 0;
-
-            if (square2.lengthCounterLoad == 0) {
-                value2 = 0;
-            }
-        }
-
-        if (triangle.enabled) {
-            value3 = (triangleSequence[triangle.dutyStep]);
-
-            if (triangle.counterMode == LENGTH_COUNTER && triangle.lengthCounter == 0) {
-                value3 = 0;
-            }
-        }
-
-        if (noise.enabled) {
-            value4 = noise.volume;
-
-            if (!noise.constantVolume) {
-                value4 = noise.decayLevel;
-            }
-
-            // mute noise channel if bit-0 of shift-register is set
-            // or length counter is zero
-            if (((noise.shiftRegister & 1u) == 1u) || (noise.lengthCounter == 0)) {
-                value4 = 0;
-            }
-        }
-
-        double sampleAmplitude = 50;
-        double sampleFrequency = 440;
-
-//        value1 = value2 = value3 = 0;
-
-//         sample clean sine wave
-//        value1 = sampleAmplitude * sin(sampleFrequency * 2.0 * M_PI * sampleWaveTime);
-
-        // sample clean square wave
-//        value1 = sampleAmplitude * (2 * (2 * floor(sampleFrequency * sampleWaveTime) - floor(sampleFrequency * 2 * sampleWaveTime)) + 1);
-
-        // sample clean pulse wave
-//        value2 = sampleAmplitude * ((2 * floor(sampleFrequency * sampleWaveTime) - floor(sampleFrequency * 2 * sampleWaveTime)) + 1);
-
-        // nes sequencer pulse wave
-//        int step = (int) floor(8 * (sampleFrequency * sampleWaveTime)) % 8;
-//        value1 = sampleAmplitude * dutyCycleSequence[2][step];
-
-        // sample clean triangle wave
-//        value1 = sampleAmplitude * M_2_PI * asin(sin(sampleFrequency * 2 * M_PI * sampleWaveTime));
-//        value3 = sampleAmplitude * (M_1_PI * asin(sin(sampleFrequency * 2 * M_PI * sampleWaveTime)) + .5);
-
-        // nes sequencer triangle wave
-//        int step = (int) round(30 * (sampleFrequency * sampleWaveTime)) % 30;
-//        value1 = (triangleSequence[step]) * 7;
-
-        sampleWaveTime += 1.0 / 44100.0;
-
-        double amplitude = value3 + value4;
-
-        double square_approximation = 0.00752 * (value1 + value2);
-        double triangle_noise_dmc_approximation = 0.00851 * value2 + 0.00494 * value4;
-
-        amplitude = 80.0 * (square_approximation + triangle_noise_dmc_approximation);
-
-        buffer[bufferWriteIdx++] = 128 + amplitude;
-
-        apuSampleCycleCounter = 0;
-
-        // write samples for each channel
-        if (square1Debug.put(value1)) {
-            square1Debug.compute(raster->square1FFT, raster->square1Waveform);
-        }
-
-        if (square2Debug.put(value2)) {
-            square2Debug.compute(raster->square2FFT, raster->square2Waveform);
-        }
-
-        if (triangleDebug.put(value3)) {
-            triangleDebug.compute(raster->triangleFFT, raster->triangleWaveform);
-        }
-
-        if (noiseDebug.put(value4)) {
-            noiseDebug.compute(raster->noiseFFT, raster->noiseWaveform);
-        }
-
-        const int samplesPerSecond = 44100;
-        const int writeSize = 441; // 10 msec worth of samples @ 44.1khz
-
-        if (bufferWriteIdx >= writeSize) {
-			#if AUDIO_ENABLED
-            int queued = SDL_GetQueuedAudioSize(1);
-
-//            PrintApu("Soundcard has %d bytes queued. sampleInterval = %d", queued, sampleInterval);
-
-            if (queued > 20000) {
-                SDL_ClearQueuedAudio(1);
-                PrintApu("*** DROPPED AUDIO QUEUE ***");
-            }
-
-            if (square1.enabled || square2.enabled || triangle.enabled || noise.enabled) {
-                if (SDL_QueueAudio(1, buffer, bufferWriteIdx) != 0) {
-                    PrintError("SDL_QueueAudio() had an error: %s", SDL_GetError());
-                }
-            }
-
-            queued += bufferWriteIdx;
-
-            // keep queue from growing too large
-            const int maxQueueSampleDepth = samplesPerSecond / 5;
-            if (queued > maxQueueSampleDepth) {
-                int delay = (int) round(double(queued - maxQueueSampleDepth) / (double(samplesPerSecond) / 1000.0));
-                if (delay > 1) {
-                    auto now = std::chrono::high_resolution_clock::now();
-                    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
-                    auto actual_sleep = std::chrono::duration_cast<std::chrono::milliseconds>(
-                            std::chrono::high_resolution_clock::now() - now);
-                    PrintApu("throttling apu: wanted=%d msec got=%d msec (queued=%d samples)", delay, actual_sleep, queued);
-                }
-            }
-			#endif
-
-            bufferWriteIdx -= writeSize;
-        }
+/**
+ * Reached from execute() at the end of an audio frame or on a frame sequencer step.
+ * For simplicity we will use 1 apu cycle = 1 cpu cycle.
+ */
+void Audio::executeEvents() {
+    // the channels are not stepped per cycle, only when their output can change (see catchUp)
+    if (frameTime >= FRAME_CYCLES) {
+        endFrame();
     }
 
     // every 7457 do a step
     // in 5-step mode there is an extra delay step
 
-    static int frameSequenceStep = 0;
-
-    int currentStep = floor(apuCycles / 7457);
+    int currentStep = apuCycles / 7457;
     if (frameSequenceStep != currentStep) {
         frameSequenceStep = currentStep;
         // perform step
 //        PrintApu("Stepping frame sequence: %d at apu cycle %d", frameSequenceStep, apuCycles);
 
+        // envelopes and length counters change the levels from here on
+        catchUp();
+
         switch (frameSequenceStep) {
             case 5:
                 if (this->frameCounterMode == FIVE_STEP) {
@@ -682,8 +492,12 @@ void Audio::execute(int cpuCycles) {
             default:
                 break;
         }
+
+        refreshLevels();
     }
 
+    nextSequencerStep = (frameSequenceStep + 1) * 7457;
+
     // 37281
     // 29828
     // 22371
@@ -691,6 +505,264 @@ void Audio::execute(int cpuCycles) {
     // 7457
 }
 
+static bool isAudible(const SquareEnvelope &square) {
+    // the hardware silences periods under 8, they would be ultrasonic
+    return square.enabled && square.lengthCounter > 0 && square.volume > 0 && square.timerPeriod >= 8;
+}
+
+static bool isAudible(const TriangleEnvelope &triangle) {
+    return triangle.enabled && !(triangle.counterMode == LENGTH_COUNTER && triangle.lengthCounter == 0);
+}
+
+static int noiseVolume(const NoiseEnvelope &noise) {
+    return noise.constantVolume ? noise.volume : noise.decayLevel;
+}
+
+static bool isAudible(const NoiseEnvelope &noise) {
+    return noise.enabled && noise.lengthCounter > 0 && noiseVolume(noise) > 0;
+}
+
+/**
+ * Synthesize every channel up to the current cpu cycle. Called before anything changes how a channel
+ * sounds, so a channel's timer always runs on unchanged settings in between and only the steps
+ * that move its output cost anything.
+ *
+ * The mixer is nonlinear, a level change has to be mixed with the other channels' levels at the same
+ * cycle, so the audible channels step together, earliest step first. A silent channel's level does not
+ * move, it skips to the end in one go.
+ */
+void Audio::catchUp() {
+    if (channelTime == frameTime) {
+        return;
+    }
+
+    // cpu cycles between steps: squares step every 2 * (period + 1), the triangle every period + 1,
+    // the noise shift register every reloaded period
+    tCPU::dword period[NUM_CHANNELS] = {
+            (square1.timerPeriod + 1u) * 2, (square2.timerPeriod + 1u) * 2,
+            triangle.timerPeriod + 1u, (tCPU::dword) noise.timerPeriodReloader
+    };
+    tCPU::dword next[NUM_CHANNELS] = {
+            channelTime + square1.timerValue, channelTime + square2.timerValue,
+            channelTime + triangle.timerValue, channelTime + noise.timerPeriod
+    };
+    // triangle periods under 2 (over 30 kHz) hold the sequencer instead of stepping every cycle or two
+    // for nothing audible
+    bool stepping[NUM_CHANNELS] = {
+            isAudible(square1), isAudible(square2), isAudible(triangle) && triangle.timerPeriod >= 2, isAudible(noise)
+    };
+
+    for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+        if (!stepping[channel] && next[channel] < frameTime) {
+            tCPU::dword steps = (frameTime - next[channel] + period[channel] - 1) / period[channel];
+            skipSteps((AudioChannel) channel, steps);
+            next[channel] += steps * period[channel];
+        }
+    }
+
+    // the silent channels are past the end now, only audible ones take part
+    while (true) {
+        int earliest = NUM_CHANNELS;
+        tCPU::dword time = frameTime, following = frameTime;
+        for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+            if (next[channel] < time) {
+                following = time;
+                earliest = channel;
+                time = next[channel];
+            } else if (next[channel] < following) {
+                following = next[channel];
+            }
+        }
+        if (earliest == NUM_CHANNELS) {
+            break;
+        }
+
+        // the earliest channel runs on until another one is due
+        next[earliest] = run((AudioChannel) earliest, time, following, period[earliest]);
+    }
+
+    square1.timerValue = next[SQUARE_1] - frameTime;
+    square2.timerValue = next[SQUARE_2] - frameTime;
+    triangle.timerValue = next[TRIANGLE] - frameTime;
+    noise.timerPeriod = next[NOISE] - frameTime;
+
+    channelTime = frameTime;
+}
+
+/**
+ * Timer steps of an audible channel every period cpu cycles, the one at time and any more before until:
+ * duty or sequence steps, or shifts of the noise register. Returns the time of the next step.
+ */
+tCPU::dword Audio::run(AudioChannel channel, tCPU::dword time, tCPU::dword until, tCPU::dword period) {
+    switch (channel) {
+        case SQUARE_1:
+        case SQUARE_2: {
+            SquareEnvelope &square = channel == SQUARE_1 ? square1 : square2;
+            const int *sequence = dutyCycleSequence[square.dutyCycle];
+            do {
+                square.dutyStep = (square.dutyStep + 1) % 8;
+                setLevel(channel, sequence[square.dutyStep] ? square.volume : 0, time);
+                time += period;
+            } while (time < until);
+            break;
+        }
+        case TRIANGLE:
+            do {
+                triangle.dutyStep = (triangle.dutyStep + 1) % 32;
+                setLevel(TRIANGLE, triangleSequence[triangle.dutyStep], time);
+                time += period;
+            } while (time < until);
+            break;
+        case NOISE: {
+            int volume = noiseVolume(noise);
+            do {
+                // if loop mode enabled, xor against value of bit-6
+                // otherwise xor against bit-1
+                uint16_t xorValue = (noise.loopNoise ? (noise.shiftRegister >> 6u) : (noise.shiftRegister >> 1u)) & 1u;
+                uint16_t feedback = (noise.shiftRegister & 1u) ^ xorValue; // xor against bit-0
+                noise.shiftRegister >>= 1u; // shift right
+                noise.shiftRegister |= (feedback << 14u); // set bit 14
+
+                // muted while bit-0 of shift-register is set
+                setLevel(NOISE, (noise.shiftRegister & 1u) ? 0 : volume, time);
+                time += period;
+            } while (time < until);
+            break;
+        }
+        default:
+            break;
+    }
+
+    return time;
+}
+
+/**
+ * Steps of a silent channel, only the sequencer position moves. The triangle holds at periods under 2,
+ * the noise register's position in its sequence is not heard.
+ */
+void Audio::skipSteps(AudioChannel channel, tCPU::dword steps) {
+    switch (channel) {
+        case SQUARE_1:
+            square1.dutyStep = (square1.dutyStep + steps) % 8;
+            break;
+        case SQUARE_2:
+            square2.dutyStep = (square2.dutyStep + steps) % 8;
+            break;
+        case TRIANGLE:
+            if (triangle.timerPeriod >= 2) {
+                triangle.dutyStep = (triangle.dutyStep + steps) % 32;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Levels after a register write or a frame sequencer step, the channels already caught up
+ */
+void Audio::refreshLevels() {
+    const SquareEnvelope *squares[2] = {&square1, &square2};
+    for (int i = 0; i < 2; i++) {
+        const SquareEnvelope &square = *squares[i];
+        int level = isAudible(square) && dutyCycleSequence[square.dutyCycle][square.dutyStep] ? square.volume : 0;
+        setLevel(i == 0 ? SQUARE_1 : SQUARE_2, level, channelTime);
+    }
+
+    setLevel(TRIANGLE, isAudible(triangle) ? triangleSequence[triangle.dutyStep] : 0, channelTime);
+    setLevel(NOISE, isAudible(noise) && (noise.shiftRegister & 1u) == 0 ? noiseVolume(noise) : 0, channelTime);
+}
+
+/**
+ * One channel's output changes at cpu cycle time of the frame, the mixer's output moves with it
+ */
+void Audio::setLevel(AudioChannel channel, int level, tCPU::dword time) {
+    if (levels[channel] == level) {
+        return;
+    }
+
+    // the old level lasted until now, sample it for the APU debugger while it is open
+    if (raster->square1FFT != nullptr) {
+        recordDebug(channel, time);
+    }
+
+    levels[channel] = level;
+
+    float output = pulseMix[levels[SQUARE_1] + levels[SQUARE_2]] + tndMix[3 * levels[TRIANGLE] + 2 * levels[NOISE]];
+    synthesis->addDelta(time, output - mixerOutput);
+    mixerOutput = output;
+}
+
+void Audio::recordDebug(AudioChannel channel, tCPU::dword until) {
+    tCPU::byte *fft[NUM_CHANNELS] = {raster->square1FFT, raster->square2FFT, raster->triangleFFT, raster->noiseFFT};
+    tCPU::byte *waveform[NUM_CHANNELS] = {
+            raster->square1Waveform, raster->square2Waveform, raster->triangleWaveform, raster->noiseWaveform
+    };
+
+    ChannelDebug &debug = channelDebug[channel];
+    for (; debug.nextSampleTime < until; debug.nextSampleTime += debugSampleInterval) {
+        if (debug.put(levels[channel])) {
+            debug.compute(fft[channel], waveform[channel]);
+        }
+    }
+}
+
+/**
+ * Close the audio frame at the current cpu cycle and hand its samples to the soundcard
+ */
+void Audio::endFrame() {
+    catchUp();
+
+    bool debugging = raster->square1FFT != nullptr;
+    for (int channel = 0; channel < NUM_CHANNELS; channel++) {
+        if (debugging) {
+            recordDebug((AudioChannel) channel, frameTime);
+        }
+        channelDebug[channel].nextSampleTime = debugging ? channelDebug[channel].nextSampleTime - frameTime : 0;
+    }
+
+    synthesis->endFrame(frameTime);
+    frameTime = channelTime = 0;
+
+#if AUDIO_ENABLED
+    int count = synthesis->readSamples(samples, maxFrameSamples);
+
+    const int samplesPerSecond = sampleRate;
+    int queued = SDL_GetQueuedAudioSize(1) / sizeof(int16_t);
+
+//    PrintApu("Soundcard has %d samples queued", queued);
+
+    if (queued > 20000) {
+        SDL_ClearQueuedAudio(1);
+        PrintApu("*** DROPPED AUDIO QUEUE ***");
+    }
+
+    if (square1.enabled || square2.enabled || triangle.enabled || noise.enabled) {
+        if (SDL_QueueAudio(1, samples, count * sizeof(int16_t)) != 0) {
+            PrintError("SDL_QueueAudio() had an error: %s", SDL_GetError());
+        }
+    }
+
+    queued += count;
+
+    // keep queue from growing too large
+    const int maxQueueSampleDepth = samplesPerSecond / 5;
+    if (queued > maxQueueSampleDepth) {
+        int delay = (int) round(double(queued - maxQueueSampleDepth) / (double(samplesPerSecond) / 1000.0));
+        if (delay > 1) {
+            auto now = std::chrono::high_resolution_clock::now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            auto actual_sleep = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::high_resolution_clock::now() - now);
+            PrintApu("throttling apu: wanted=%d msec got=%d msec (queued=%d samples)", delay, actual_sleep, queued);
+        }
+    }
+#else
+    // nowhere to play them, the buffer still has to make room for the next frame
+    synthesis->readSamples(samples, maxFrameSamples);
+#endif
+}
+
 void Audio::executeQuarterFrame() {
     // update envelopes and triangle's linear counter (~240hz)
 
@@ -761,6 +833,8 @@ void Audio::executeHalfFrame() {
 }
 
 void Audio::setTriangleDuration(tCPU::byte value) {
+    catchUp();
+
     // bit 7 halts the length-counter, starting the linear-counter
     triangle.counterMode = ((value & 0x80) != 0) ? LINEAR_COUNTER : LENGTH_COUNTER;
     triangle.linearCounterLoad = value & 0x7f;
@@ -770,9 +844,13 @@ void Audio::setTriangleDuration(tCPU::byte value) {
     PrintDbg("  counter-type = %s / linear-counter-load = %d",
              triangle.counterMode == LENGTH_COUNTER ? "length-counter" : "linear-counter",
              triangle.linearCounterLoad);
+
+    refreshLevels();
 }
 
 void Audio::setTrianglePeriodHigh(tCPU::byte value) {
+    catchUp();
+
     // set upper 3 bits of the 11-bit register
     triangle.timerPeriod &= 0x00ff; // clear upper 8 bits
     triangle.timerPeriod |= (value & 0x7) << 8; // OR upper 3 bits
@@ -782,40 +860,57 @@ void Audio::setTrianglePeriodHigh(tCPU::byte value) {
 
     triangle.lengthCounter = lengthCounterLookup[lengthCounterIdx];
     triangle.linearCounterReloadEnabled = true;
-    triangle.phase = 0;
 
 //    PrintApu("  timerPeriod = %d / length-counter = %d (idx = %d)", triangle.timerPeriod, triangle.lengthCounter,
 //             lengthCounterIdx);
+
+    refreshLevels();
 }
 
 void Audio::setTrianglePeriodLow(tCPU::byte value) {
+    catchUp();
+
     // set lower 8 bits of the 11-bit register
     triangle.timerPeriod &= 0xff00; // clear lower 8 bits
     triangle.timerPeriod |= value; // OR lower 8 bits
 
 //    PrintApu("  timerPeriod (low bits) = %d", triangle.timerPeriod);
+
+    refreshLevels();
 }
 
 void Audio::setNoiseEnvelope(tCPU::byte value) {
+    catchUp();
+
     noise.lengthCounterHalt = (value >> 5) & 1;
     noise.constantVolume = (value >> 4) & 1;
     noise.volume = value & 0xFU;
     noise.dividerPeriodReloader = (value & 0xFU) + 1; // number of quarter-frames
 
 //    PrintApu("  counter-halt = %d / constant-volume = %d / volume = %d", noise.lengthCounterHalt, noise.constantVolume, noise.volume);
+
+    refreshLevels();
 }
 
 void Audio::setNoisePeriod(tCPU::byte value) {
+    catchUp();
+
     noise.loopNoise = (value >> 7) & 1;
     noise.timerPeriodReloader = noisePeriodLookup[value & 0xFU];
     noise.timerPeriod = noise.timerPeriodReloader;
 
 //    PrintApu("  loop-noise = %d / timer-period = %d (idx = %d)", noise.loopNoise, noise.timerPeriodReloader, (value & 0xFU));
+
+    refreshLevels();
 }
 
 void Audio::setNoiseLength(tCPU::byte value) {
+    catchUp();
+
     noise.lengthCounterLoad = lengthCounterLookup[value >> 3u];
     noise.lengthCounter = noise.lengthCounterLoad;
     noise.envelopeStart = true;
 //    PrintApu("  length-counter = %d", noise.lengthCounterLoad);
+
+    refreshLevels();
 }
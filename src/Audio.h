@@ -6,6 +6,7 @@
 #include <chrono>
 #include "Platform.h"
 #include "PPU.h"
+#include "BandLimitedBuffer.h"
 
 struct Sweep {
     bool enabled;
@@ -16,25 +17,20 @@ struct Sweep {
 
 struct SquareEnvelope {
     bool enabled = false;
-    tCPU::byte volume;
+    tCPU::byte volume = 0;
     bool sawEnvelopeDisabled;
     bool lengthCounterDisabled;
-    tCPU::byte dutyCycle;
+    tCPU::byte dutyCycle = 0;
     tCPU::byte dutyStep = 0;
-    int phase = 0;
 
-    int timerValue = 0;
+    int timerValue = 0; // cpu cycles until the next duty step
 
-    tCPU::word timerPeriod; // 11 bit note period
+    tCPU::word timerPeriod = 0; // 11 bit note period
     tCPU::word timerPeriodReloader; // actual value to use
-    tCPU::byte lengthCounterLoad; // 5 bit waveform duration until silence
+    tCPU::byte lengthCounterLoad = 0; // 5 bit waveform duration until silence
     tCPU::byte lengthCounter = 0;
 
     Sweep sweep;
-
-    tCPU::byte *buffer;
-    int bufferIdx = 0;
-    int bufferStart = 0;
 };
 
 enum CounterMode {
@@ -50,8 +46,8 @@ struct NoiseEnvelope {
     bool constantVolume = true;
     int volume = 0;
     bool loopNoise;
-    int timerPeriod = 0;
-    int timerPeriodReloader;
+    int timerPeriod = 0; // cpu cycles until the next shift
+    int timerPeriodReloader = 4;
     int lengthCounter = 0;
     int lengthCounterLoad;
     uint16_t shiftRegister = 1; // 15-bits
@@ -70,19 +66,23 @@ struct TriangleEnvelope {
     tCPU::byte linearCounter = 0;
     tCPU::word timerPeriod = 0;
     tCPU::word timerPeriodReloader = 0; // 11 bit note period
-    tCPU::word timerValue = 0;
+    tCPU::word timerValue = 0; // cpu cycles until the next sequence step
 
     bool controlFlagEnabled = false;
     bool linearCounterReloadEnabled = false;
 
-    int phase = 0;
     int dutyStep = 0;
 };
 
+enum AudioChannel {
+    SQUARE_1, SQUARE_2, TRIANGLE, NOISE, NUM_CHANNELS
+};
+
 struct ChannelDebug {
     double *samples, *fft;
     int currentIdx, fftSize;
     fftw_plan plan;
+    tCPU::dword nextSampleTime = 0; // cpu cycle of the current audio frame
     void initialize(int numSamples);
     bool put(double sample);
     void compute(tCPU::byte *fft, tCPU::byte *waveform);
@@ -94,12 +94,6 @@ public:
 
     void close();
 
-    void populate(Uint8 *stream, int len);
-
-    static void populateFuncPtr(void *data, Uint8 *stream, int len) {
-        static_cast<Audio *>(data)->populate(stream, len);
-    }
-
     void configureFrameSequencer(tCPU::byte value);
 
     void setChannelStatus(tCPU::byte status);
@@ -124,7 +118,15 @@ public:
 
     void setSquare2Sweep(tCPU::byte value);
 
-    void execute(int cpuCycles);
+    // cheap enough for every instruction, the work waits for frame sequencer steps and audio frame ends
+    void execute(int cpuCycles) {
+        apuCycles += cpuCycles;
+        frameTime += cpuCycles;
+
+        if (apuCycles >= nextSequencerStep || frameTime >= FRAME_CYCLES) {
+            executeEvents();
+        }
+    }
 
     void setTriangleDuration(tCPU::byte value);
 
@@ -139,14 +141,26 @@ public:
     void setNoiseLength(tCPU::byte value);
 
 private:
+    // cpu cycles per audio frame (10 msec), samples are handed to the soundcard at the end of each
+    static const tCPU::dword FRAME_CYCLES = 17898;
+
     tCPU::byte channelStatus;
     tCPU::word apuCycles = 0;
-    tCPU::word apuSampleCycleCounter = 0;
-    tCPU::byte *buffer;
-    int bufferReadIdx = 0, bufferWriteIdx = 0, bufferAvailable = 0;
-    int bufferSize = 8192 * 8;
+    int frameSequenceStep = 0;
+    tCPU::word nextSequencerStep = 7457;
+
+    // cpu cycles into the current audio frame, the channels are synthesized up to it only when
+    // something changes their output: a register write, a frame sequencer step, the end of the frame
+    tCPU::dword frameTime = 0;
+    tCPU::dword channelTime = 0;
 
-    double sampleWaveTime = 0;
+    BandLimitedBuffer *synthesis;
+    int16_t *samples;
+
+    // 4-bit output of each channel and the mixer's output for them
+    int levels[NUM_CHANNELS] = {};
+    float mixerOutput = 0;
+    float pulseMix[31], tndMix[203];
 
     FrameCounterMode frameCounterMode = FOUR_STEP;
     SquareEnvelope square1;
@@ -154,15 +168,31 @@ private:
     TriangleEnvelope triangle;
     NoiseEnvelope noise;
 
+    void executeEvents();
+
     void executeHalfFrame();
 
     void executeQuarterFrame();
 
+    void catchUp();
+
+    tCPU::dword run(AudioChannel channel, tCPU::dword time, tCPU::dword until, tCPU::dword period);
+
+    void skipSteps(AudioChannel channel, tCPU::dword steps);
+
+    void refreshLevels();
+
+    void setLevel(AudioChannel channel, int level, tCPU::dword time);
+
+    void endFrame();
+
     bool issueIRQ = false;
 
     // debugging
-    ChannelDebug square1Debug, square2Debug, triangleDebug, noiseDebug;
+    ChannelDebug channelDebug[NUM_CHANNELS];
     Raster *raster;
+
+    void recordDebug(AudioChannel channel, tCPU::dword until);
 };
 
 
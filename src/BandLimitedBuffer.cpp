@@ -0,0 +1,127 @@
+#include "BandLimitedBuffer.h"
+#include "Logging.h"
+#include <emmintrin.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+BandLimitedBuffer::BandLimitedBuffer(double clockRate, int sampleRate, int maxSamples) {
+    factor = (uint64_t) (sampleRate / clockRate * 4294967296.0 + 0.5);
+    size = maxSamples + TAPS;
+    deltas = new float[size];
+    memset(deltas, 0, size * sizeof(float));
+
+    // the NES output stage has a 90 Hz high-pass, without it the unipolar DAC sits at a DC offset
+    highPassFactor = (float) exp(-2.0 * M_PI * 90.0 / sampleRate);
+
+    buildKernel();
+}
+
+BandLimitedBuffer::~BandLimitedBuffer() {
+    delete[] deltas;
+}
+
+/**
+ * kernel[p][i] is how much of a unit step p / PHASES samples past a sample boundary lands in tap i:
+ * the difference of a band-limited step (integrated Blackman-windowed sinc) between neighbouring
+ * samples. Every row sums to 1, so integrating the taps reproduces the step exactly.
+ */
+void
+BandLimitedBuffer::buildKernel() {
+    const int halfWidth = TAPS / 2 - 1;
+    const int resolution = PHASES * 8;
+    const double cutoff = 0.9; // of the output Nyquist frequency
+
+    // step response on a grid fine enough to hit every phase exactly
+    int points = 2 * halfWidth * resolution + 1;
+    std::vector<double> step(points);
+    double previous = 0;
+    for (int k = 0; k < points; k++) {
+        double x = (double) k / resolution - halfWidth;
+        double sinc = x == 0 ? cutoff : sin(M_PI * cutoff * x) / (M_PI * x);
+        double window = 0.42 + 0.5 * cos(M_PI * x / halfWidth) + 0.08 * cos(2 * M_PI * x / halfWidth);
+        double impulse = sinc * window;
+
+        step[k] = k == 0 ? 0 : step[k - 1] + (previous + impulse) / (2 * resolution);
+        previous = impulse;
+    }
+
+    auto stepAt = [&](int gridIndex) {
+        if (gridIndex <= 0) {
+            return 0.0;
+        }
+        if (gridIndex >= points - 1) {
+            return 1.0;
+        }
+        return step[gridIndex] / step[points - 1];
+    };
+
+    for (int phase = 0; phase <= PHASES; phase++) {
+        for (int tap = 0; tap < TAPS; tap++) {
+            // tap sits at tap - halfWidth - phase / PHASES samples from the step
+            int gridIndex = tap * resolution - phase * (resolution / PHASES);
+            kernel[phase][tap] = (float) (stepAt(gridIndex) - stepAt(gridIndex - resolution));
+        }
+    }
+}
+
+void
+BandLimitedBuffer::addDelta(tCPU::dword time, float delta) {
+    uint64_t position = offset + time * factor;
+    int index = available + (int) (position >> 32);
+    if (index + TAPS > size) {
+        PrintError("Band-limited buffer overflow, dropping an amplitude step");
+        return;
+    }
+
+    uint32_t fraction = (uint32_t) position;
+    int phase = fraction >> (32 - PHASE_BITS);
+    float weight = (float) ((fraction >> (32 - PHASE_BITS - 16)) & 0xFFFF) * (1.0f / 65536.0f);
+
+    // output += delta * lerp(kernel[phase], kernel[phase + 1], weight), four taps at a time
+    const float *below = kernel[phase], *above = kernel[phase + 1];
+    float *output = deltas + index;
+    __m128 scaledBelow = _mm_set1_ps(delta * (1.0f - weight));
+    __m128 scaledAbove = _mm_set1_ps(delta * weight);
+    for (int tap = 0; tap < TAPS; tap += 4) {
+        __m128 step = _mm_add_ps(_mm_mul_ps(_mm_load_ps(below + tap), scaledBelow),
+                                 _mm_mul_ps(_mm_load_ps(above + tap), scaledAbove));
+        _mm_storeu_ps(output + tap, _mm_add_ps(_mm_loadu_ps(output + tap), step));
+    }
+}
+
+void
+BandLimitedBuffer::endFrame(tCPU::dword time) {
+    offset += time * factor;
+    available += (int) (offset >> 32);
+    offset &= 0xFFFFFFFFULL;
+
+    if (available > size - TAPS) {
+        available = size - TAPS;
+    }
+}
+
+int
+BandLimitedBuffer::readSamples(int16_t *output, int count) {
+    if (count > available) {
+        count = available;
+    }
+
+    for (int i = 0; i < count; i++) {
+        integrator += deltas[i];
+
+        highPassOutput = integrator - highPassInput + highPassFactor * highPassOutput;
+        highPassInput = integrator;
+
+        float sample = highPassOutput * 32767.0f;
+        output[i] = (int16_t) (sample > 32767.0f ? 32767.0f : sample < -32768.0f ? -32768.0f : sample);
+    }
+
+    // keep the tails of the steps still reaching into unfinished samples
+    int remaining = available - count + TAPS;
+    memmove(deltas, deltas + count, remaining * sizeof(float));
+    memset(deltas + remaining, 0, count * sizeof(float));
+    available -= count;
+
+    return count;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Platform.h"
+#include <cstdint>
+
+/**
+ * Band-limited synthesis: channels report amplitude steps (deltas) at CPU cycle timestamps, each step
+ * is added as a windowed-sinc step kernel at the output rate, reading the samples out integrates them.
+ * Costs one kernel add per step instead of one evaluation per CPU cycle and does not alias.
+ *
+ * Timestamps are CPU cycles since the last endFrame(), which makes everything before it readable.
+ */
+class BandLimitedBuffer {
+public:
+    BandLimitedBuffer(double clockRate, int sampleRate, int maxSamples);
+
+    ~BandLimitedBuffer();
+
+    // output moves by delta at clock cycle time of the current frame
+    void addDelta(tCPU::dword time, float delta);
+
+    // samples before clock cycle time are complete, the next frame starts there
+    void endFrame(tCPU::dword time);
+
+    int samplesAvailable() const {
+        return available;
+    }
+
+    // up to count finished samples, returns how many were written
+    int readSamples(int16_t *output, int count);
+
+private:
+    // kernel resolution in fractions of an output sample, linearly interpolated in between
+    static const int PHASES = 32;
+    static const int TAPS = 16;
+    static const int PHASE_BITS = 5;
+
+    alignas(16) float kernel[PHASES + 1][TAPS];
+
+    // output samples per clock and output position of the frame start, both 32.32 fixed point
+    uint64_t factor;
+    uint64_t offset = 0;
+
+    // deltas of the finished samples plus the kernel tail reaching past them
+    float *deltas;
+    int size;
+    int available = 0;
+
+    // running sum of the deltas, and the DC blocker's state
+    float integrator = 0;
+    float highPassInput = 0, highPassOutput = 0;
+    float highPassFactor;
+
+    void buildKernel();
+};
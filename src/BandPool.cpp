@@ -0,0 +1,69 @@
+#include "BandPool.h"
+
+BandPool::BandPool(int threads) : bands(threads + 1) {
+    for (int band = 1; band <= threads; band++) {
+        workers.emplace_back(&BandPool::work, this, band);
+    }
+}
+
+BandPool::~BandPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    jobStarted.notify_all();
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void
+BandPool::run(int rows, const std::function<void(int, int)> &job) {
+    if (bands == 1) {
+        job(0, rows);
+        return;
+    }
+
+    std::lock_guard<std::mutex> turn(runLock);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        this->job = &job;
+        this->rows = rows;
+        pendingWorkers = bands - 1;
+        jobNumber++;
+    }
+    jobStarted.notify_all();
+
+    job(0, rows / bands);
+
+    std::unique_lock<std::mutex> guard(lock);
+    jobFinished.wait(guard, [this] { return pendingWorkers == 0; });
+}
+
+void
+BandPool::work(int band) {
+    int jobsSeen = 0;
+
+    while (true) {
+        const std::function<void(int, int)> *job;
+        int rows;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            jobStarted.wait(guard, [&] { return jobNumber != jobsSeen || !running; });
+            if (!running) {
+                return;
+            }
+            jobsSeen = jobNumber;
+            job = this->job;
+            rows = this->rows;
+        }
+
+        (*job)(rows * band / bands, rows * (band + 1) / bands);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--pendingWorkers == 0) {
+            jobFinished.notify_one();
+        }
+    }
+}
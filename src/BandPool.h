@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of threads that split a frame's rows into equal bands.
+ * The calling thread takes the first band and run() returns once every band is done,
+ * so jobs need no synchronization of their own. Shared by the CPU output filters: callers on
+ * different threads take turns, a job must not call run() itself.
+ */
+class BandPool {
+public:
+    // threads besides the calling one
+    BandPool(int threads);
+
+    ~BandPool();
+
+    int getBands() const {
+        return bands;
+    }
+
+    // job(first, last) for each band of [0, rows)
+    void run(int rows, const std::function<void(int, int)> &job);
+
+private:
+    int bands;
+    std::vector<std::thread> workers;
+
+    // job being run, read by the workers
+    const std::function<void(int, int)> *job = nullptr;
+    int rows = 0;
+
+    // held for a whole run(), the job state above belongs to one caller at a time
+    std::mutex runLock;
+
+    std::mutex lock;
+    std::condition_variable jobStarted, jobFinished;
+    int jobNumber = 0;
+    int pendingWorkers = 0;
+    bool running = true;
+
+    void work(int band);
+};
@@ -1,6 +1,9 @@
 #include "CPU.h"
+#include "DMA.h"
 #include <cstdio>
 
+tCPU::byte InterruptLines::Asserted = 0;
+
 CPU::CPU(Registers *registers, Memory *memory, Stack *stack)
         : registers(registers), memory(memory), stack(stack) {
 
@@ -69,6 +72,39 @@ CPU::reset() {
     registers->PC = memory->readWord(RESET_VECTOR_ADDR);
 }
 
+/**
+ * Take a pending NMI, or an IRQ if interrupts are not masked.
+ * Called between instructions only when some interrupt line is asserted.
+ */
+void
+CPU::serviceInterrupts() {
+    if (InterruptLines::Asserted & InterruptLines::NMI) {
+        InterruptLines::Asserted &= ~InterruptLines::NMI;
+        interrupt(NMI_VECTOR_ADDR);
+    } else if (!registers->P.I) {
+        // line stays asserted until the device acknowledges it
+        interrupt(IRQ_VECTOR_ADDR);
+    }
+}
+
+/**
+ * Hardware interrupt sequence
+ * https://www.pagetable.com/?p=410
+ */
+void
+CPU::interrupt(tCPU::word vectorAddress) {
+    // clear break flag
+    registers->P.B = 0;
+    stack->pushStackWord(registers->PC);
+    stack->pushStackByte(registers->P.asByte());
+
+    // disable irq
+    registers->P.I = 1;
+    registers->PC = memory->readWord(vectorAddress);
+
+    addCycles(7);
+}
+
 int
 CPU::executeOpcode(int code) {
     unsigned char opcodeSize = opcodes[code].Bytes;
@@ -115,17 +151,29 @@ CPU::executeOpcode(int code) {
         PrintInfo("%-45s %s", instruction, cpuState);
     }
 
+    Heatmap::cpu(registers->PC, HEATMAP_EXECUTE);
+
+    // opcode and operand bytes in the code/data log
+    CodeDataLog::prg(registers->PC, CDL_PRG_CODE | CDL_PRG_OPCODE);
+    for (int i = 1; i < opcodeSize; i++) {
+        CodeDataLog::prg(registers->PC + i, CDL_PRG_CODE);
+    }
+
     // update program counter
     registers->LastPC = registers->PC;
     registers->PC += opcodeSize;
 
     MemoryAddressResolveBase::PageBoundaryCrossed = false;
-    MemoryIO::cpuCyclesPenalty = 0;
 
     instructions->execute(code, ctx);
 
+    // jmp ($xxxx) target
+    if (CodeDataLog::IsEnabled && opcodes[code].AddressMode == ADDR_MODE_INDIRECT_ABSOLUTE) {
+        CodeDataLog::prg(registers->PC, CDL_PRG_INDIRECT_CODE);
+    }
+
     // opcode cycle count + any page boundary penalty
-    uint8_t cycles = opcodes[code].Cycles;
+    int cycles = opcodes[code].Cycles;
     if (opcodes[code].PageBoundaryCondition && MemoryAddressResolveBase::PageBoundaryCrossed) {
         cycles++;
     }
@@ -135,8 +183,11 @@ CPU::executeOpcode(int code) {
         cycles++;
     }
 
-    // TODO: add APU/PPU cpu delays
-//    cycles += MemoryIO::cpuCyclesPenalty;
+    // cpu halted by dma during this instruction; stores and read-modify-writes put their
+    // last write on the opcode's last base cycle, penalty cycles only come with reads and branches
+    if (dma != nullptr) {
+        cycles += dma->takeStall(numCycles + opcodes[code].Cycles - 1);
+    }
 
     // number of bytes read to execute opcode also counts as cycles
     numCycles += cycles;
@@ -144,6 +195,11 @@ CPU::executeOpcode(int code) {
     return cycles;
 }
 
+void
+CPU::useDMA(DMA *dma) {
+    this->dma = dma;
+}
+
 uint64_t
 CPU::getCycleRuntime() {
     return numCycles;
@@ -7,6 +7,11 @@
 #include "Platform.h"
 #include "Instructions.h"
 #include "Registers.h"
+#include "Interrupts.h"
+#include "CodeDataLogger.h"
+#include "MemoryHeatmap.h"
+
+class DMA;
 
 class CPU {
 public:
@@ -18,6 +23,10 @@ public:
     void reset();
     int executeOpcode(int code);
 
+    void serviceInterrupts();
+
+    void useDMA(DMA *dma);
+
     uint64_t getCycleRuntime();
     void addCycles(int cycles) {
         numCycles += cycles;
@@ -27,6 +36,7 @@ protected:
     Registers* registers;
     Memory* memory;
     Stack* stack;
+    DMA* dma = nullptr;
 
     Opcode* opcodes = new Opcode[0x100];
     uint64_t numCycles = 0;
@@ -38,7 +48,9 @@ protected:
 
     bool cpuAlive = true;
     void writePrgPage(int i, uint8_t buffer[]);
+    void interrupt(tCPU::word vectorAddress);
 };
 
 static const int RESET_VECTOR_ADDR = 0xFFFC;
-static const int NMI_VECTOR_ADDR = 0xFFFA;
\ No newline at end of file
+static const int NMI_VECTOR_ADDR = 0xFFFA;
+static const int IRQ_VECTOR_ADDR = 0xFFFE;
\ No newline at end of file
@@ -5,6 +5,10 @@
 const unsigned int PRG_ROM_PAGE_SIZE = 0x4000;
 const unsigned int CHR_ROM_PAGE_SIZE = 0x2000;
 
+// MMC3 boards top out at 512KiB PRG and 256KiB CHR
+const unsigned int MAX_PRG_ROM_PAGES = 32;
+const unsigned int MAX_CHR_ROM_PAGES = 32;
+
 #pragma pack(push, 1)
 struct RomHeader {
     uint8_t signature[4];
@@ -18,7 +22,9 @@ struct RomHeader {
 #pragma pack(pop)
 
 enum eMirroringType {
-    VERTICAL_MIRRORING, HORIZONTAL_MIRRORING
+    VERTICAL_MIRRORING, HORIZONTAL_MIRRORING,
+    SINGLE_SCREEN_LOWER, SINGLE_SCREEN_UPPER,
+    FOUR_SCREEN_MIRRORING
 };
 
 struct RomInfo {
@@ -39,8 +45,8 @@ struct ChrRomPage {
 
 struct Cartridge {
     Cartridge() {
-        programDataPages = new PrgRomPage[20];
-        characterDataPages = new ChrRomPage[10];
+        programDataPages = new PrgRomPage[MAX_PRG_ROM_PAGES];
+        characterDataPages = new ChrRomPage[MAX_CHR_ROM_PAGES];
     }
 
     RomHeader header;
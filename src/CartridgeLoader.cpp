@@ -68,9 +68,14 @@ CartridgeLoader::analyzeHeader(Cartridge &rom) {
     rom.info.trainerPresent = (CB1 & 0x04) != 0;
     rom.info.fourScreenVRAM = (CB1 & 0x08) != 0;
 
+    // cartridge supplies the other two nametables, mirroring bit is ignored
+    if (rom.info.fourScreenVRAM) {
+        rom.info.mirroring = FOUR_SCREEN_MIRRORING;
+    }
+
     // sanity check
-    assert(rom.header.numPrgPages < 10);
-    assert(rom.header.numChrPages < 10);
+    assert(rom.header.numPrgPages <= MAX_PRG_ROM_PAGES);
+    assert(rom.header.numChrPages <= MAX_CHR_ROM_PAGES);
 
     // determine memory mapper type (256 possible variants)
     int mapperId = ((rom.header.CB1 & 0xF0) >> 4) | (rom.header.CB2 & 0xF0);
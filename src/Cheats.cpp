@@ -0,0 +1,78 @@
+#include "Cheats.h"
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+/**
+ * Raw cheats carry a colon, everything else is treated as a Game Genie code
+ */
+Cheat
+Cheats::decode(const std::string &code) {
+    if (code.find(':') != std::string::npos) {
+        return decodeRaw(code);
+    }
+
+    return decodeGameGenie(code);
+}
+
+/**
+ * Each letter is a nibble, the bits are scrambled across address, value and compare
+ * http://tuxnes.sourceforge.net/gamegenie.html
+ */
+Cheat
+Cheats::decodeGameGenie(const std::string &code) {
+    static const char *letters = "APZLGITYEOXUKSVN";
+
+    if (code.length() != 6 && code.length() != 8) {
+        CheatFormatException::emit("Game Genie code '%s' must have 6 or 8 letters", code.c_str());
+    }
+
+    int n[8] = {0};
+    for (size_t i = 0; i < code.length(); i++) {
+        const char *letter = strchr(letters, toupper(code[i]));
+        if (letter == nullptr || *letter == 0) {
+            CheatFormatException::emit("Game Genie code '%s' has invalid letter '%c'", code.c_str(), code[i]);
+        }
+        n[i] = (int) (letter - letters);
+    }
+
+    Cheat cheat;
+    cheat.address = (tCPU::word) (0x8000 + (((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8)
+                                            | ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8)));
+
+    if (code.length() == 6) {
+        cheat.value = (tCPU::byte) (((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[5] & 8));
+    } else {
+        cheat.value = (tCPU::byte) (((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[7] & 8));
+        cheat.compare = (tCPU::byte) (((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8));
+        cheat.hasCompare = true;
+    }
+
+    return cheat;
+}
+
+/**
+ * Hex `address:value` or `address:value:compare`, address must be in PRG ROM ($8000-$FFFF)
+ */
+Cheat
+Cheats::decodeRaw(const std::string &code) {
+    unsigned int address, value, compare;
+    int consumed = 0;
+
+    // consumed ends up after the last field that parsed, anything left over rejects the code
+    int fields = sscanf(code.c_str(), "%x:%x%n:%x%n", &address, &value, &consumed, &compare, &consumed);
+    if (fields < 2 || consumed != (int) code.size() || address < 0x8000 || address > 0xFFFF || value > 0xFF
+        || (fields == 3 && compare > 0xFF)) {
+        CheatFormatException::emit("Raw cheat '%s' must be address:value[:compare] within $8000-$FFFF", code.c_str());
+    }
+
+    Cheat cheat;
+    cheat.address = (tCPU::word) address;
+    cheat.value = (tCPU::byte) value;
+    if (fields == 3) {
+        cheat.hasCompare = true;
+        cheat.compare = (tCPU::byte) compare;
+    }
+
+    return cheat;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Platform.h"
+#include "Exceptions.h"
+#include <string>
+
+/**
+ * A single PRG ROM patch
+ * Applied when the 8KiB bank holding it is mapped, and only if the ROM byte matches the compare value (when present)
+ */
+struct Cheat {
+    tCPU::word address;
+    tCPU::byte value;
+    bool hasCompare = false;
+    tCPU::byte compare = 0;
+};
+
+class CheatFormatException : public ExceptionBase<CheatFormatException> {
+public:
+    CheatFormatException(const char *str)
+            : ExceptionBase(str) {}
+};
+
+/**
+ * Decodes Game Genie codes (6 or 8 letters) and raw `address:value[:compare]` hex cheats
+ */
+class Cheats {
+public:
+    static Cheat decode(const std::string &code);
+
+    static Cheat decodeGameGenie(const std::string &code);
+
+    static Cheat decodeRaw(const std::string &code);
+};
@@ -0,0 +1,52 @@
+#include "CodeDataLogger.h"
+#include "Logging.h"
+#include <cstdio>
+#include <cstring>
+
+MemoryMapper *CodeDataLogger::mapper = nullptr;
+tCPU::byte *CodeDataLogger::prgFlags = nullptr;
+tCPU::byte *CodeDataLogger::chrFlags = nullptr;
+tCPU::dword CodeDataLogger::prgSize = 0;
+tCPU::dword CodeDataLogger::chrSize = 0;
+
+void
+CodeDataLogger::attach(MemoryMapper *mapper, Cartridge &rom) {
+    CodeDataLogger::mapper = mapper;
+
+    prgSize = rom.header.numPrgPages * PRG_ROM_PAGE_SIZE;
+    chrSize = rom.header.numChrPages * CHR_ROM_PAGE_SIZE;
+
+    prgFlags = new tCPU::byte[prgSize];
+    memset(prgFlags, 0, prgSize);
+
+    // CHR-RAM boards have nothing to log, keep a valid pointer anyway
+    chrFlags = new tCPU::byte[chrSize > 0 ? chrSize : 1];
+    memset(chrFlags, 0, chrSize);
+
+    PrintInfo("Code/data logger tracking %d PRG bytes and %d CHR bytes", prgSize, chrSize);
+}
+
+bool
+CodeDataLogger::save(const char *path) {
+    if (prgFlags == nullptr) {
+        return false;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        PrintError("Could not open %s for writing", path);
+        return false;
+    }
+
+    bool written = fwrite(prgFlags, 1, prgSize, file) == prgSize
+                   && fwrite(chrFlags, 1, chrSize, file) == chrSize;
+    fclose(file);
+
+    if (!written) {
+        PrintError("Could not write code/data log to %s", path);
+        return false;
+    }
+
+    PrintInfo("Wrote code/data log to %s", path);
+    return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Platform.h"
+#include "Cartridge.h"
+#include "MemoryMapper.h"
+
+// compile-time policy; normal builds leave this off and every hook compiles to nothing
+#ifndef CDL_ENABLED
+#define CDL_ENABLED false
+#endif
+
+/**
+ * CDL flags per PRG byte (FCEUX layout)
+ * bits 2-3 hold the CPU window ($8000/$A000/$C000/$E000) the bank was mapped into
+ * bit 7 is unused by FCEUX, we set it on opcode bytes so operands can be told apart
+ */
+enum CdlPrgFlags {
+    CDL_PRG_CODE = 0x01,
+    CDL_PRG_DATA = 0x02,
+    CDL_PRG_INDIRECT_CODE = 0x10,
+    CDL_PRG_INDIRECT_DATA = 0x20,
+    CDL_PRG_PCM = 0x40,
+    CDL_PRG_OPCODE = 0x80
+};
+
+/**
+ * CDL flags per CHR byte
+ */
+enum CdlChrFlags {
+    CDL_CHR_RENDERED = 0x01,
+    CDL_CHR_READ = 0x02
+};
+
+/**
+ * Code/data log storage, one flag byte per PRG and CHR ROM byte
+ */
+class CodeDataLogger {
+public:
+    static void attach(MemoryMapper *mapper, Cartridge &rom);
+
+    // writes PRG flags followed by CHR flags, the standard .cdl layout
+    static bool save(const char *path);
+
+    static inline void logPrg(tCPU::word address, tCPU::byte flags) {
+        if (address >= 0x8000) {
+            prgFlags[mapper->getPrgRomOffset(address)] |= flags | (((address >> 13) & 0x3) << 2);
+        }
+    }
+
+    static inline void logChr(tCPU::word address, tCPU::byte flags) {
+        int offset = mapper->getChrRomOffset(address);
+        if (offset >= 0) {
+            chrFlags[offset] |= flags;
+        }
+    }
+
+private:
+    static MemoryMapper *mapper;
+    static tCPU::byte *prgFlags;
+    static tCPU::byte *chrFlags;
+    static tCPU::dword prgSize;
+    static tCPU::dword chrSize;
+};
+
+/**
+ * Hooks called from the CPU and PPU access paths
+ */
+template<bool Enabled>
+struct CodeDataLogPolicy {
+    static const bool IsEnabled = false;
+
+    static inline void prg(tCPU::word address, tCPU::byte flags) {}
+
+    static inline void chr(tCPU::word address, tCPU::byte flags) {}
+};
+
+template<>
+struct CodeDataLogPolicy<true> {
+    static const bool IsEnabled = true;
+
+    static inline void prg(tCPU::word address, tCPU::byte flags) {
+        CodeDataLogger::logPrg(address, flags);
+    }
+
+    static inline void chr(tCPU::word address, tCPU::byte flags) {
+        CodeDataLogger::logChr(address, flags);
+    }
+};
+
+typedef CodeDataLogPolicy<CDL_ENABLED> CodeDataLog;
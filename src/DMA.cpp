@@ -0,0 +1,31 @@
+#include "DMA.h"
+#include "Memory.h"
+#include "PPU.h"
+#include "Logging.h"
+
+DMA::DMA(Memory *memory, PPU *ppu)
+        : memory(memory), ppu(ppu) {
+}
+
+void
+DMA::transferOAM(tCPU::byte page) {
+    PrintDbg("OAM DMA from $%04X", page << 8);
+
+    const tCPU::byte *source = memory->getPagePointer(page);
+    if (source != nullptr) {
+        // plain ram/rom, one bulk copy
+        ppu->StartSpriteXferDMA(source);
+    } else {
+        // i/o ports (or watched pages) need every read to go through the bus
+        tCPU::byte buffer[256];
+        tCPU::word startAddress = page << 8;
+        for (int i = 0; i < 256; i++) {
+            buffer[i] = memory->readByte(startAddress + i);
+        }
+        ppu->StartSpriteXferDMA(buffer);
+    }
+
+    // 1 halt cycle + 256 read/write pairs, odd start cycle adds another
+    pendingStall += 513;
+    pendingAlignment = true;
+}
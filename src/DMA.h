@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Platform.h"
+
+class Memory;
+class PPU;
+
+/**
+ * Direct memory access unit
+ * OAM DMA ($4014) copies a 256-byte page into sprite memory.
+ * It halts the CPU; the stolen cycles are charged to the instruction that triggered them.
+ */
+class DMA {
+public:
+    DMA(Memory *memory, PPU *ppu);
+
+    // $4014: copy page $XX00-$XXFF into sprite memory
+    void transferOAM(tCPU::byte page);
+
+    /**
+     * Cycles the CPU was halted for during the last instruction, writeCycle being the cpu cycle its
+     * last write landed on. OAM DMA halts from the cycle after the $4014 write for 513 cycles,
+     * plus one to align when that is an odd cycle.
+     */
+    int takeStall(uint64_t writeCycle) {
+        if (pendingStall == 0) {
+            return 0;
+        }
+
+        int stall = pendingStall;
+        if (pendingAlignment && ((writeCycle + 1) & 1)) {
+            stall++;
+        }
+
+        pendingStall = 0;
+        pendingAlignment = false;
+        return stall;
+    }
+
+private:
+    Memory *memory;
+    PPU *ppu;
+
+    int pendingStall = 0;
+    bool pendingAlignment = false;
+};
@@ -0,0 +1,284 @@
+#include "DebugViews.h"
+#include "Logging.h"
+#include <algorithm>
+#include <cstring>
+
+DebugViews::DebugViews(Raster *raster) : raster(raster) {
+}
+
+DebugViews::~DebugViews() {
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running = false;
+        }
+        started.notify_one();
+        worker.join();
+    }
+
+    delete[] (tCPU::byte *) patternTable;
+    delete[] (tCPU::byte *) attributeTable;
+    delete[] (tCPU::byte *) palette;
+    delete[] (tCPU::byte *) nametables;
+    delete[] nametableTiles;
+}
+
+void
+DebugViews::update(PPU *ppu) {
+    // nothing runs until the debugger first asks for views
+    if (!worker.joinable()) {
+        worker = std::thread(&DebugViews::run, this);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (busy) {
+            // still drawing, look again next frame
+            return;
+        }
+    }
+
+    if (pendingViews) {
+        publish(pendingViews);
+        pendingViews = 0;
+    }
+
+    if (++framesSinceRefresh < refreshInterval) {
+        return;
+    }
+    framesSinceRefresh = 0;
+
+    // the old snapshot becomes the one to compare against, the other buffer takes the new one
+    std::swap(snapshot, previous);
+    ppu->captureDebugSnapshot(*snapshot);
+
+    int views = findChangedViews();
+    firstSnapshot = false;
+    if (!views) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pendingViews = views;
+        busy = true;
+    }
+    started.notify_one();
+}
+
+/**
+ * Compare the new snapshot against the last one, everything is new the first time
+ */
+int
+DebugViews::findChangedViews() {
+    if (firstSnapshot) {
+        rebuildNametables = true;
+        return VIEW_PATTERN_TABLE | VIEW_ATTRIBUTES | VIEW_PALETTE | VIEW_NAMETABLES;
+    }
+
+    bool patterns = memcmp(snapshot->patterns, previous->patterns, sizeof(snapshot->patterns)) != 0;
+    bool nametables = memcmp(snapshot->nametables, previous->nametables, sizeof(snapshot->nametables)) != 0;
+    bool colors = memcmp(snapshot->colors, previous->colors, sizeof(snapshot->colors)) != 0;
+    bool paletteColors = memcmp(snapshot->paletteColors, previous->paletteColors, sizeof(snapshot->paletteColors)) != 0;
+    bool scrolled = snapshot->vramAddress != previous->vramAddress || snapshot->fineX != previous->fineX
+                    || snapshot->nameTableAddress != previous->nameTableAddress;
+
+    rebuildNametables = colors || memcmp(snapshot->nametableImage, previous->nametableImage,
+                                         sizeof(snapshot->nametableImage)) != 0;
+
+    int views = 0;
+    if (patterns || colors) {
+        views |= VIEW_PATTERN_TABLE;
+    }
+    if (nametables || snapshot->nameTableAddress != previous->nameTableAddress) {
+        views |= VIEW_ATTRIBUTES;
+    }
+    if (paletteColors) {
+        views |= VIEW_PALETTE;
+    }
+    if (rebuildNametables || scrolled) {
+        views |= VIEW_NAMETABLES;
+    }
+    return views;
+}
+
+/**
+ * Trade a finished view for the raster's copy, the worker redraws every pixel of a view it touches
+ */
+static inline void swapView(tCPU::byte *&published, tCPU::dword *&drawn) {
+    tCPU::byte *finished = (tCPU::byte *) drawn;
+    drawn = (tCPU::dword *) published;
+    published = finished;
+}
+
+void
+DebugViews::publish(int views) {
+    if (views & VIEW_PATTERN_TABLE) {
+        swapView(raster->patternTable, patternTable);
+    }
+    if (views & VIEW_ATTRIBUTES) {
+        swapView(raster->attributeTable, attributeTable);
+    }
+    if (views & VIEW_PALETTE) {
+        swapView(raster->palette, palette);
+    }
+    if (views & VIEW_NAMETABLES) {
+        swapView(raster->nametables, nametables);
+    }
+    raster->changedViews |= views;
+}
+
+void
+DebugViews::run() {
+    while (true) {
+        int views;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            started.wait(guard, [this] { return busy || !running; });
+            if (!running) {
+                return;
+            }
+            views = pendingViews;
+        }
+
+        if (views & VIEW_PATTERN_TABLE) {
+            drawPatternTables();
+        }
+        if (views & VIEW_ATTRIBUTES) {
+            drawAttributes();
+        }
+        if (views & VIEW_PALETTE) {
+            drawPalette();
+        }
+        if (views & VIEW_NAMETABLES) {
+            if (rebuildNametables) {
+                drawNametableTiles();
+            }
+            drawNametables();
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        busy = false;
+    }
+}
+
+/**
+ * Both pattern tables, 256 tiles each as a 16x16 grid of 8x8 tiles, in background palette 0.
+ * Renders into a 128x256 target.
+ */
+void
+DebugViews::drawPatternTables() {
+    // rows of tiles across both tables
+    for (int i = 0; i < 32; i++) {
+        // columns
+        for (int j = 0; j < 16; j++) {
+            const tCPU::byte *tile = snapshot->patterns + (i * 16 + j) * 16;
+            tCPU::dword *dst = patternTable + (i * 128 + j) * 8;
+
+            // 8 rows, each row takes two bytes: one bit plane each
+            for (int k = 0; k < 8; k++) {
+                tCPU::byte pattern1 = tile[k];
+                tCPU::byte pattern2 = tile[k + 8];
+
+                for (int l = 0; l < 8; l++) {
+                    int color = (pattern1 >> (7 - l) & 1) | (pattern2 >> (7 - l) & 1) << 1;
+                    dst[k * 128 + l] = snapshot->colors[color] | 0xff000000;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Attributes of the selected nametable
+ *
+ * 8x8 attribute bytes, each covers 32x32 pixels as 2x2 blocks of 16x16 pixels with 2 color bits each.
+ * Drawn 4 times the size of the 128x128 view it covers: 256x256, grey levels for the color bits.
+ */
+void
+DebugViews::drawAttributes() {
+    std::fill(attributeTable, attributeTable + 256 * 256, 0xff333333);
+
+    const tCPU::byte *attributes = snapshot->nametables + (snapshot->nameTableAddress - 0x2000) + 0x3C0;
+
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            tCPU::byte attribute = attributes[i * 8 + j];
+            unsigned int dstAddr = (i * 256 + j) * 32;
+
+            // four 16x16 blocks, b steps down and c steps right, 2 color bits each
+            for (unsigned int b = 0; b < 2; b++) {
+                for (unsigned int c = 0; c < 2; c++) {
+                    tCPU::byte color = (attribute >> ((b + c * 2) * 2)) & 3;
+                    tCPU::dword grey = 0xff000000 | (color * 64) * 0x010101;
+                    unsigned int blockAddr = dstAddr + (b * 256 + c) * 16;
+
+                    for (unsigned int k = 0; k < 16; k++) {
+                        std::fill(attributeTable + blockAddr + k * 256, attributeTable + blockAddr + k * 256 + 16, grey);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * 32 palette entries from $3F00 as 8x8 blocks, 4 rows each starting one palette further
+ */
+void
+DebugViews::drawPalette() {
+    for (int row = 0; row < 4; row++) {
+        for (int p = 0; p < 32; p++) {
+            tCPU::dword color = snapshot->paletteColors[(p + row * 4) & 0x1F] | 0xff000000;
+            tCPU::dword *dst = palette + row * 256 * 8 + p * 8;
+
+            for (int y = 0; y < 8; y++) {
+                std::fill(dst + y * 256, dst + y * 256 + 8, color);
+            }
+        }
+    }
+}
+
+/**
+ * All four nametables as the PPU sees them through mirroring into 512x512, each 256x240 one
+ * on a 256x256 cell. The pixels are the renderer's own pre-rendered nametables, only colored here.
+ */
+void
+DebugViews::drawNametableTiles() {
+    std::fill(nametableTiles, nametableTiles + 512 * 512, 0xff333333);
+
+    for (int a = 0; a < 2; a++) {
+        for (int y = 0; y < 240; y++) {
+            const tCPU::byte *indices = snapshot->nametableImage + (a * 240 + y) * NametableCache::WIDTH;
+            tCPU::dword *dst = nametableTiles + (a * 256 + y) * 512;
+
+            for (int x = 0; x < 512; x++) {
+                dst[x] = snapshot->colors[indices[x]];
+            }
+        }
+    }
+}
+
+/**
+ * Nametable tiles with the scroll viewport outlined on top
+ */
+void
+DebugViews::drawNametables() {
+    memcpy(nametables, nametableTiles, 512 * 512 * 4);
+
+    unsigned short int tileScroll = snapshot->vramAddress & 0x0FFF;
+    unsigned short int tileScrollPixels = tileScroll * 8;
+    unsigned short int nametableOffsetX = ((snapshot->nameTableAddress - 0x2000) / 0x400) * 256;
+    unsigned short int horizontalScrollPixels = nametableOffsetX + snapshot->fineX + tileScrollPixels;
+
+    const tCPU::dword white = 0xffffffff;
+    for (int i = 0; i < 256; i++) {
+        // left and right vertical lines
+        nametables[i * 512 + horizontalScrollPixels % 512] = white;
+        nametables[i * 512 + (horizontalScrollPixels + 255) % 512] = white;
+
+        // top and bottom lines
+        nametables[(i + horizontalScrollPixels) % 512] = white;
+        nametables[255 * 512 + (i + horizontalScrollPixels) % 512] = white;
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Platform.h"
+#include "PPU.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * PPU state the debug views are drawn from, copied at vblank
+ */
+struct DebugSnapshot {
+    // $0000-$1FFF through the current CHR windows
+    tCPU::byte patterns[0x2000];
+    // PPU_RAM $2000-$2FFF, the four nametable pages as stored
+    tCPU::byte nametables[0x1000];
+    // the four nametables as mirrored, background palette indices out of NametableCache
+    tCPU::byte nametableImage[NametableCache::WIDTH * NametableCache::HEIGHT];
+    // $3F00-$3F1F as plain NES colors
+    tCPU::dword paletteColors[32];
+    // final colors the scanline renderer uses
+    tCPU::dword colors[PALETTE_INDEX_CLEARED + 1];
+
+    tCPU::word backgroundPatternTable;
+    tCPU::word nameTableAddress;
+    tCPU::word vramAddress;
+    tCPU::byte fineX;
+};
+
+/**
+ * Pattern table, attribute, palette and nametable debug views.
+ *
+ * Drawn on a worker thread from a snapshot, at most every refresh interval, and only the views whose
+ * source memory changed since the previous snapshot. The worker starts with the first update().
+ * Finished views are swapped into the raster and flagged in Raster::changedViews so the GUI uploads
+ * just those textures.
+ */
+class DebugViews {
+public:
+    DebugViews(Raster *raster);
+
+    ~DebugViews();
+
+    // frames between snapshots, 6 refreshes the views at 10 Hz
+    void setRefreshInterval(int frames) {
+        refreshInterval = frames;
+    }
+
+    // main thread, once per frame: publish views the worker finished, snapshot the PPU when due
+    void update(PPU *ppu);
+
+private:
+    Raster *raster;
+    int refreshInterval = 6;
+    int framesSinceRefresh = 0;
+
+    DebugSnapshot snapshots[2];
+    DebugSnapshot *snapshot = &snapshots[0], *previous = &snapshots[1];
+    bool firstSnapshot = true;
+
+    // views handed to the worker, and whether the nametable tiles need drawing again (not just the viewport)
+    int pendingViews = 0;
+    bool rebuildNametables = false;
+
+    // worker output, swapped with the raster's buffers once complete, so allocated the way the raster's are
+    tCPU::dword *patternTable = (tCPU::dword *) new tCPU::byte[128 * 256 * 4];
+    tCPU::dword *attributeTable = (tCPU::dword *) new tCPU::byte[256 * 256 * 4];
+    tCPU::dword *palette = (tCPU::dword *) new tCPU::byte[256 * 32 * 4];
+    tCPU::dword *nametables = (tCPU::dword *) new tCPU::byte[512 * 512 * 4];
+    tCPU::dword *nametableTiles = new tCPU::dword[512 * 512];
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable started;
+    bool busy = false;
+    bool running = true;
+
+    int findChangedViews();
+
+    void publish(int views);
+
+    void run();
+
+    void drawPatternTables();
+
+    void drawAttributes();
+
+    void drawPalette();
+
+    void drawNametableTiles();
+
+    void drawNametables();
+};
@@ -9,6 +9,8 @@
 
 //#include <SDL2/SDL_opengl.h>
 #include "GUI.h"
+#include "MemoryHeatmap.h"
+#include "PaletteExpander.h"
 #include "Logging.h"
 
 GLenum glCheckError_(const char *file, int line) {
@@ -47,6 +49,9 @@ GUI::GUI(Raster *raster)
     showEnhancedPPU = false;
     showDebuggerPPU = true;
     showDebuggerAPU = false;
+    showNtscFilter = false;
+    scaleFilter = SCALE_EPX;
+    scaleFactor = 0;
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         PrintError("SDL_Init failed: %s", SDL_GetError());
@@ -54,6 +59,8 @@ GUI::GUI(Raster *raster)
     }
 
     if (showDebuggerAPU) {
+        raster->createApuDebugSurfaces();
+
         // Create software-rendering Window
         apuDebugWindow = SDL_CreateWindow("APU Debugger", 0, 0, 520, 828, SDL_WINDOW_ALLOW_HIGHDPI);
         if (apuDebugWindow == nullptr) {
@@ -89,8 +96,10 @@ GUI::GUI(Raster *raster)
     }
 
     if (showDebuggerPPU) {
+        raster->createPpuDebugSurfaces();
+
         // Create software-rendering Window
-        ppuDebugWindow = SDL_CreateWindow("NES - Debug", 0, 330, 1320, 564, SDL_WINDOW_ALLOW_HIGHDPI);
+        ppuDebugWindow = SDL_CreateWindow("NES - Debug", 0, 330, 1586, 564, SDL_WINDOW_ALLOW_HIGHDPI);
         if (ppuDebugWindow == nullptr) {
             PrintError("SDL_CreateWindow#1 failed: %s", SDL_GetError());
             throw std::runtime_error("SDL_CreateWindow#1 failed");
@@ -111,13 +120,15 @@ GUI::GUI(Raster *raster)
                       SDL_BYTESPERPIXEL(info.texture_formats[i]));
         }
 
-        finalTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 256, 256);
+        finalTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 256, 240);
+        expandedScreen = new tCPU::dword[256 * 240];
         patternTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 128, 256);
         attributeTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 256, 256);
         paletteTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 256, 32);
         nametableTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 512, 512);
         backgroundMaskTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_NV12, SDL_TEXTUREACCESS_STREAMING, 256, 256);
         spriteMaskTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_NV12, SDL_TEXTUREACCESS_STREAMING, 256, 256);
+        heatmapTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 256, 256);
 
         if (finalTexture == nullptr) {
             PrintError("SDL_CreateTexture failed: %s", SDL_GetError());
@@ -260,6 +271,10 @@ GUI::render() {
         //PrintInfo("Rendering PPU Debugger took %d msec", std::chrono::duration_cast<std::chrono::milliseconds>(span));
     }
 
+    if (scaleFactor > 0) {
+        renderScaledOutput();
+    }
+
     if (showEnhancedPPU) {
         auto now = std::chrono::high_resolution_clock::now();
         // render into opengl window
@@ -317,11 +332,39 @@ GUI::render() {
 }
 
 void GUI::renderDebugViews() {// store internal buffers as a texture
-    uploadTexture(finalTexture, raster->screenBuffer, 256 * 4);
-    uploadTexture(patternTexture, raster->patternTable, 128 * 4);
-    uploadTexture(attributeTexture, raster->attributeTable, 256 * 4);
-    uploadTexture(paletteTexture, raster->palette, 256 * 4);
-    uploadTexture(nametableTexture, raster->nametables, 512 * 4);
+    if (showNtscFilter) {
+        if (ntscFilter == nullptr) {
+            createFilterPool();
+            ntscFilter = new NtscFilter(filterPool);
+            ntscScreen = new tCPU::dword[NtscFilter::OUTPUT_WIDTH * 240];
+            ntscTexture = SDL_CreateTexture(ppuDebugRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                            NtscFilter::OUTPUT_WIDTH, 240);
+        }
+        ntscFilter->filter(raster->screenBuffer, raster->emphasis, ntscScreen, burstPhase);
+        burstPhase = (burstPhase + 1) % 3;
+        uploadTexture(ntscTexture, ntscScreen, NtscFilter::OUTPUT_WIDTH * 4);
+    } else {
+        PaletteExpander::expand(raster->screenBuffer, raster->emphasis, expandedScreen, 240);
+        uploadTexture(finalTexture, expandedScreen, 256 * 4);
+    }
+
+    // these refresh at a lower rate, and only when their source memory changed
+    if (raster->changedViews & VIEW_PATTERN_TABLE) {
+        uploadTexture(patternTexture, raster->patternTable, 128 * 4);
+    }
+    if (raster->changedViews & VIEW_ATTRIBUTES) {
+        uploadTexture(attributeTexture, raster->attributeTable, 256 * 4);
+    }
+    if (raster->changedViews & VIEW_PALETTE) {
+        uploadTexture(paletteTexture, raster->palette, 256 * 4);
+    }
+    if (raster->changedViews & VIEW_NAMETABLES) {
+        uploadTexture(nametableTexture, raster->nametables, 512 * 4);
+    }
+    if (raster->changedViews & VIEW_HEATMAP) {
+        uploadTexture(heatmapTexture, raster->heatmap, 256 * 4);
+    }
+    raster->changedViews = 0;
 
     // TODO: fix CPU based format conversion overhead for these two textures
     uploadTexture(backgroundMaskTexture, raster->backgroundMask, 256);
@@ -331,9 +374,9 @@ void GUI::renderDebugViews() {// store internal buffers as a texture
     SDL_SetRenderDrawColor(ppuDebugRenderer, 10, 10, 10, 255);
     SDL_RenderClear(ppuDebugRenderer);
 
-    // draw textures
-    renderTexture(ppuDebugRenderer, finalTexture, SDL_Rect{0, 0, 256, 256});
-    drawText(ppuDebugRenderer, "Render", 0, 0);
+    // draw textures, the 602 pixel wide NTSC output squeezed back into the same cell
+    renderTexture(ppuDebugRenderer, showNtscFilter ? ntscTexture : finalTexture, SDL_Rect{0, 0, 256, 240});
+    drawText(ppuDebugRenderer, showNtscFilter ? "Render (NTSC)" : "Render", 0, 0);
 
     renderTexture(ppuDebugRenderer, patternTexture, SDL_Rect{266, 0, 256, 512});
     drawText(ppuDebugRenderer, "Pattern Table", 266, 0);
@@ -356,10 +399,68 @@ void GUI::renderDebugViews() {// store internal buffers as a texture
     renderTexture(ppuDebugRenderer, spriteMaskTexture, SDL_Rect{1054, 266, 256, 256});
     drawText(ppuDebugRenderer, "Sprite Mask", 1054, 256);
 
+    // nothing counts accesses without the heatmap compiled in
+    if (Heatmap::IsEnabled) {
+        renderTexture(ppuDebugRenderer, heatmapTexture, SDL_Rect{1320, 0, 256, 256});
+        drawText(ppuDebugRenderer, MemoryHeatmap::ViewBus == HEATMAP_BUS_CPU ? "Heatmap CPU" : "Heatmap PPU", 1320, 0);
+    }
+
     // flip to screen
     SDL_RenderPresent(ppuDebugRenderer);
 }
 
+/**
+ * The frame through the CPU upscaler into its own window. The scaler writes into the streaming texture's
+ * memory, so there is no upload copy. No vsync here, the debugger windows already wait for it.
+ */
+void GUI::renderScaledOutput() {
+    int width = 256 * scaleFactor, height = 240 * scaleFactor;
+
+    if (pixelScaler == nullptr) {
+        createFilterPool();
+        pixelScaler = new PixelScaler(filterPool);
+
+        scaledWindow = SDL_CreateWindow("NES - Scaled", 0, 0, width, height, SDL_WINDOW_ALLOW_HIGHDPI);
+        if (scaledWindow == nullptr) {
+            PrintError("SDL_CreateWindow failed: %s", SDL_GetError());
+            throw std::runtime_error("SDL_CreateWindow failed");
+        }
+
+        scaledRenderer = SDL_CreateRenderer(scaledWindow, -1, 0);
+        if (scaledRenderer == nullptr) {
+            PrintError("SDL_CreateRenderer failed: %s", SDL_GetError());
+            throw std::runtime_error("SDL_CreateRenderer failed");
+        }
+        SDL_RenderSetLogicalSize(scaledRenderer, width, height);
+
+        scaledTexture = SDL_CreateTexture(scaledRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                          width, height);
+    }
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(scaledTexture, nullptr, &pixels, &pitch) < 0) {
+        PrintError("Failed to SDL_LockTexture(): %s", SDL_GetError());
+        return;
+    }
+    pixelScaler->scale(scaleFilter, scaleFactor, raster->screenBuffer, raster->emphasis, (tCPU::dword *) pixels,
+                       pitch);
+    SDL_UnlockTexture(scaledTexture);
+
+    renderTexture(scaledRenderer, scaledTexture, SDL_Rect{0, 0, width, height});
+    SDL_RenderPresent(scaledRenderer);
+}
+
+/**
+ * Threads for the CPU output filters, one per core with the GUI thread taking the first band
+ */
+void GUI::createFilterPool() {
+    if (filterPool == nullptr) {
+        int cores = std::thread::hardware_concurrency();
+        filterPool = new BandPool(cores > 1 ? cores - 1 : 0);
+    }
+}
+
 /**
  * Draws static text on the screen. Caches aggressively.
  */
@@ -401,18 +502,43 @@ GUI::~GUI() {
     }
     if (showDebuggerPPU) {
         SDL_DestroyWindow(ppuDebugWindow);
+        delete[] expandedScreen;
+    }
+    delete ntscFilter;
+    delete[] ntscScreen;
+    delete pixelScaler;
+    if (scaledWindow != nullptr) {
+        SDL_DestroyWindow(scaledWindow);
     }
+    delete filterPool;
     SDL_Quit();
 }
 
 void GUI::createQuad() {
+    // the frame arrives as NES color indices, the g-buffer shader looks up colors itself
     glGenTextures(1, &rt);
     glBindTexture(GL_TEXTURE_2D, rt);
     glCheckError();
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, 256, 240, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
     glCheckError();
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    // one row, emphasis bits of each scanline
+    glGenTextures(1, &emphasisTexture);
+    glBindTexture(GL_TEXTURE_2D, emphasisTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, 240, 1, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    // 65 colors (the last one is the clear color) by 8 emphasis rows, never changes
+    glGenTextures(1, &colorTableTexture);
+    glBindTexture(GL_TEXTURE_2D, colorTableTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PaletteExpander::NUM_COLORS, PaletteExpander::NUM_EMPHASIS, 0,
+                 GL_BGRA, GL_UNSIGNED_BYTE, PaletteExpander::table());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glCheckError();
     glBindTexture(GL_TEXTURE_2D, 0);
 
     // Create Vertex Array Object
@@ -609,13 +735,22 @@ void GUI::renderPostProcessing() {
         exit(1);
     }
 
+    // a quarter of the bytes a BGRA frame would take, rows of 240 and 256 bytes need no unpack alignment
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, rt);
 //    auto now = std::chrono::high_resolution_clock::now();
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_BGRA, GL_UNSIGNED_BYTE, raster->screenBuffer);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 240, GL_RED_INTEGER, GL_UNSIGNED_BYTE, raster->screenBuffer);
 //    glFlush();
 //    auto span = std::chrono::high_resolution_clock::now() - now;
 //    PrintInfo("glTexImage2D() took %d msec", std::chrono::duration_cast<std::chrono::milliseconds>(span));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, emphasisTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 240, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, raster->emphasis);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, colorTableTexture);
+    glUniform1i(glGetUniformLocation(createGBufferShader, "indexSampler"), 0);
+    glUniform1i(glGetUniformLocation(createGBufferShader, "emphasisSampler"), 1);
+    glUniform1i(glGetUniformLocation(createGBufferShader, "colorTableSampler"), 2);
     glCheckError();
 
     glBindVertexArray(vao);
@@ -5,6 +5,9 @@
 #include <GL/glew.h>
 #include "Platform.h"
 #include "PPU.h"
+#include "BandPool.h"
+#include "NtscFilter.h"
+#include "PixelScaler.h"
 #include <map>
 
 class GUI {
@@ -17,6 +20,13 @@ public:
     bool showDebuggerPPU;
     bool showDebuggerAPU;
 
+    // debugger's render view through the CPU NTSC composite filter
+    bool showNtscFilter;
+
+    // window with the frame upscaled on the CPU, closed while scaleFactor is 0
+    ScaleFilter scaleFilter;
+    int scaleFactor;
+
 protected:
     Raster *raster;
 
@@ -31,10 +41,30 @@ protected:
     SDL_Renderer *ppuDebugRenderer;
     SDL_Texture *finalTexture;
 
+    // the indexed frame expanded to BGRA for finalTexture
+    tCPU::dword *expandedScreen = nullptr;
+
+    // CPU output filters split their rows across these threads
+    BandPool *filterPool = nullptr;
+
+    // NTSC filtered frame, created when first shown; the subcarrier phase moves every frame
+    NtscFilter *ntscFilter = nullptr;
+    tCPU::dword *ntscScreen = nullptr;
+    SDL_Texture *ntscTexture = nullptr;
+    int burstPhase = 0;
+
+    // upscaled output, created when first shown; frames are scaled straight into the locked texture
+    PixelScaler *pixelScaler = nullptr;
+    SDL_Window *scaledWindow = nullptr;
+    SDL_Renderer *scaledRenderer = nullptr;
+    SDL_Texture *scaledTexture = nullptr;
+
     // opengl
     SDL_GLContext glContext;
     SDL_Window *glWindow;
     uint32_t vao, vbo, ebo, rt;
+    // per-scanline emphasis bits and the emphasis x color table rt indexes into
+    uint32_t emphasisTexture, colorTableTexture;
     uint32_t renderTargets[4], fbo;
     uint32_t passThruShader, createGBufferShader, blurShader, composeShader;
     TTF_Font *font;
@@ -44,6 +74,7 @@ protected:
     SDL_Texture *nametableTexture;
     SDL_Texture *backgroundMaskTexture;
     SDL_Texture *spriteMaskTexture;
+    SDL_Texture *heatmapTexture;
 
     std::map<size_t, SDL_Texture*> labelCache;
 
@@ -61,6 +92,10 @@ protected:
 
     void renderDebugViews();
 
+    void renderScaledOutput();
+
+    void createFilterPool();
+
     SDL_Texture *generateTextureLabel(const char *message, SDL_Renderer *renderer);
 };
 
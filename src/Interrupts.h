@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+ * Interrupt lines wired into the CPU.
+ * Devices pull a line by setting its bit and the main loop tests the whole byte once per instruction,
+ * so NMI and IRQ together cost the single check NMI alone used to.
+ */
+struct InterruptLines {
+    // edge triggered, released by the CPU once serviced
+    static const tCPU::byte NMI = 1 << 0;
+    // level triggered, held until the mapper acknowledges it ($E000 on MMC3)
+    static const tCPU::byte IRQ_MAPPER = 1 << 1;
+
+    static tCPU::byte Asserted;
+};
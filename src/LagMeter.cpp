@@ -0,0 +1,28 @@
+#include "LagMeter.h"
+
+void
+LagMeter::poll(bool late) {
+    if (!polled) {
+        polled = true;
+        polledLate = late;
+    }
+}
+
+void
+LagMeter::endFrame() {
+    frames++;
+    if (!polled) {
+        lagFrames++;
+    } else if (polledLate) {
+        eliminatedLagFrames++;
+    }
+
+    polled = false;
+    polledLate = false;
+}
+
+void
+LagMeter::reset() {
+    polled = polledLate = false;
+    frames = lagFrames = eliminatedLagFrames = 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+ * Counts lag frames: vblank to vblank intervals in which the game never read the controller,
+ * its frame logic having overrun into the next frame.
+ *
+ * With extra scanlines (see PPU::setExtraScanlines) a frame whose first controller read came later
+ * after vblank than a stock frame lasts would have lagged without them; those count as eliminated.
+ */
+class LagMeter {
+public:
+    // controller read, late when past the length of a stock frame
+    void poll(bool late);
+
+    // vblank started, closes the current frame
+    void endFrame();
+
+    // start counting over, e.g. after the number of extra scanlines changed
+    void reset();
+
+    uint64_t getFrames() {
+        return frames;
+    }
+
+    uint64_t getLagFrames() {
+        return lagFrames;
+    }
+
+    uint64_t getEliminatedLagFrames() {
+        return eliminatedLagFrames;
+    }
+
+private:
+    bool polled = false;
+    bool polledLate = false;
+
+    uint64_t frames = 0;
+    uint64_t lagFrames = 0;
+    uint64_t eliminatedLagFrames = 0;
+};
@@ -1,6 +1,7 @@
 #include "Platform.h"
 #include "Logging.h"
 #include "Memory.h"
+#include "MemoryHeatmap.h"
 
 /**
  * Calculate real memory address, accounting for memory mirroring.
@@ -32,6 +33,14 @@ tCPU::byte
 Memory::readByte(tCPU::word originalAddress) {
     tCPU::word address = getRealMemoryAddress(originalAddress);
 
+    Heatmap::cpu(address, HEATMAP_READ);
+
+    if (watchedPages[address >> 8] & WATCH_READ) {
+        tCPU::byte value = readByteDirectly(address);
+        watchpoints->check(WATCH_BUS_CPU, WATCH_READ, address, value);
+        return value;
+    }
+
     return readByteDirectly(address);
 }
 
@@ -87,6 +96,12 @@ bool
 Memory::writeByte(tCPU::word originalAddress, tCPU::byte value) {
     tCPU::word address = getRealMemoryAddress(originalAddress);
 
+    Heatmap::cpu(address, HEATMAP_WRITE);
+
+    if (watchedPages[address >> 8] & WATCH_WRITE) {
+        watchpoints->check(WATCH_BUS_CPU, WATCH_WRITE, address, value);
+    }
+
     // $4020-$FFFF belongs to the cartridge (prg rom/ram and mapper registers)
     if(address >= 0x4020) {
         // bank switching on mapper 3
@@ -159,7 +174,36 @@ Memory::getByteArray() {
     return memory;
 }
 
+/**
+ * Direct pointer to a 256-byte page of plain memory for bulk DMA transfers.
+ * Returns nullptr for pages holding I/O ports, or watched for reads, which need per-byte access.
+ */
+const tCPU::byte*
+Memory::getPagePointer(tCPU::byte page) {
+    tCPU::word address = getRealMemoryAddress(page << 8);
+
+    if (watchedPages[address >> 8] & WATCH_READ) {
+        return nullptr;
+    }
+
+    // $2000-$2007 (and mirrors), $4000-$401F
+    if (address >= 0x2000 && address <= 0x40FF) {
+        return nullptr;
+    }
+
+    if (address >= 0x8000 && mapper != nullptr) {
+        return mapper->getPrgPointer(address);
+    }
+
+    return memory + address;
+}
+
 void Memory::useMemoryMapper(MemoryMapper *mapper) {
     this->mapper = mapper;
 
 }
+
+void Memory::useWatchpoints(Watchpoints *watchpoints) {
+    this->watchpoints = watchpoints;
+    this->watchedPages = watchpoints->getPageTable(WATCH_BUS_CPU);
+}
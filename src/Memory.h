@@ -3,6 +3,7 @@
 #include "Platform.h"
 #include "Logging.h"
 #include "MemoryIO.h"
+#include "Watchpoints.h"
 
 enum AddressMode {
     ADDR_MODE_NONE = 0, ADDR_MODE_ABSOLUTE, ADDR_MODE_IMMEDIATE, ADDR_MODE_ZEROPAGE,
@@ -49,11 +50,19 @@ public:
 
     tCPU::byte* getByteArray();
 
+    const tCPU::byte* getPagePointer(tCPU::byte page);
+
     void useMemoryMapper(MemoryMapper *mapper);
 
+    void useWatchpoints(Watchpoints *watchpoints);
+
 protected:
     MemoryIO* MMIO = nullptr;
     tCPU::byte* memory = nullptr;
     MemoryMapper *mapper = nullptr;
+
+    // watch types per 256-byte page; all zero unless watchpoints are attached
+    const tCPU::byte *watchedPages = Watchpoints::Unwatched;
+    Watchpoints *watchpoints = nullptr;
 };
 
@@ -0,0 +1,96 @@
+#include "MemoryHeatmap.h"
+#include <emmintrin.h>
+
+bool MemoryHeatmap::Counting = true;
+HeatmapBus MemoryHeatmap::ViewBus = HEATMAP_BUS_CPU;
+
+alignas(16) uint16_t MemoryHeatmap::cpuCounters[3][0x10000];
+alignas(16) uint16_t MemoryHeatmap::ppuCounters[3][0x4000];
+
+/**
+ * counter -= counter / 8 + 1, saturating at zero so idle addresses go fully dark
+ */
+static void decayCounters(uint16_t *counters, int count) {
+    const __m128i one = _mm_set1_epi16(1);
+
+    for (int i = 0; i < count; i += 8) {
+        __m128i value = _mm_load_si128((__m128i *) (counters + i));
+        __m128i fade = _mm_add_epi16(_mm_srli_epi16(value, 3), one);
+        _mm_store_si128((__m128i *) (counters + i), _mm_subs_epu16(value, fade));
+    }
+}
+
+void
+MemoryHeatmap::decay() {
+    decayCounters(&cpuCounters[0][0], 3 * 0x10000);
+    decayCounters(&ppuCounters[0][0], 3 * 0x4000);
+}
+
+/**
+ * Scale 8 counters to roughly min(counter * 8, 255) in 16-bit lanes, ready for unsigned pack
+ * (halve first so saturated counters stay positive for the signed min)
+ */
+static inline __m128i brightness(const uint16_t *counters) {
+    __m128i value = _mm_srli_epi16(_mm_load_si128((__m128i *) counters), 1);
+    value = _mm_min_epi16(value, _mm_set1_epi16(255));
+    return _mm_slli_epi16(value, 4);
+}
+
+/**
+ * Convert 16 consecutive addresses into 16 BGRA pixels
+ */
+static inline void shade(const uint16_t *reads, const uint16_t *writes, const uint16_t *executes, __m128i pixels[4]) {
+    const __m128i alpha = _mm_set1_epi8((char) 0xFF);
+
+    __m128i b = _mm_packus_epi16(brightness(executes), brightness(executes + 8));
+    __m128i g = _mm_packus_epi16(brightness(reads), brightness(reads + 8));
+    __m128i r = _mm_packus_epi16(brightness(writes), brightness(writes + 8));
+
+    __m128i bgLow = _mm_unpacklo_epi8(b, g);
+    __m128i bgHigh = _mm_unpackhi_epi8(b, g);
+    __m128i raLow = _mm_unpacklo_epi8(r, alpha);
+    __m128i raHigh = _mm_unpackhi_epi8(r, alpha);
+
+    pixels[0] = _mm_unpacklo_epi16(bgLow, raLow);
+    pixels[1] = _mm_unpackhi_epi16(bgLow, raLow);
+    pixels[2] = _mm_unpacklo_epi16(bgHigh, raHigh);
+    pixels[3] = _mm_unpackhi_epi16(bgHigh, raHigh);
+}
+
+void
+MemoryHeatmap::rasterize(tCPU::byte *target) {
+    __m128i pixels[4];
+
+    if (ViewBus == HEATMAP_BUS_CPU) {
+        // one pixel per address, one row per 256-byte page
+        for (int address = 0; address < 0x10000; address += 16) {
+            shade(&cpuCounters[HEATMAP_READ][address], &cpuCounters[HEATMAP_WRITE][address],
+                  &cpuCounters[HEATMAP_EXECUTE][address], pixels);
+
+            __m128i *out = (__m128i *) (target + address * 4);
+            for (int i = 0; i < 4; i++) {
+                _mm_storeu_si128(out + i, pixels[i]);
+            }
+        }
+    } else {
+        // 16KiB of PPU space as 2x2 pixel blocks, 128 addresses per row pair
+        for (int address = 0; address < 0x4000; address += 16) {
+            shade(&ppuCounters[HEATMAP_READ][address], &ppuCounters[HEATMAP_WRITE][address],
+                  &ppuCounters[HEATMAP_EXECUTE][address], pixels);
+
+            int y = (address >> 7) * 2;
+            int x = (address & 0x7F) * 2;
+            __m128i *row0 = (__m128i *) (target + (y * 256 + x) * 4);
+            __m128i *row1 = (__m128i *) (target + ((y + 1) * 256 + x) * 4);
+
+            for (int i = 0; i < 4; i++) {
+                __m128i left = _mm_unpacklo_epi32(pixels[i], pixels[i]);
+                __m128i right = _mm_unpackhi_epi32(pixels[i], pixels[i]);
+                _mm_storeu_si128(row0 + i * 2, left);
+                _mm_storeu_si128(row0 + i * 2 + 1, right);
+                _mm_storeu_si128(row1 + i * 2, left);
+                _mm_storeu_si128(row1 + i * 2 + 1, right);
+            }
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Platform.h"
+
+// compile-time policy; normal builds leave this off and every hook compiles to nothing
+#ifndef HEATMAP_ENABLED
+#define HEATMAP_ENABLED false
+#endif
+
+enum HeatmapAccess {
+    HEATMAP_READ = 0,
+    HEATMAP_WRITE = 1,
+    HEATMAP_EXECUTE = 2
+};
+
+enum HeatmapBus {
+    HEATMAP_BUS_CPU = 0,
+    HEATMAP_BUS_PPU = 1
+};
+
+/**
+ * Per-address read/write/execute counters for CPU ($0000-$FFFF) and PPU ($0000-$3FFF) space.
+ * Counters saturate at 0xFFFF and decay every frame, the debug view shows them as a 256x256 heatmap.
+ */
+class MemoryHeatmap {
+public:
+    // runtime switch, toggled from the keyboard
+    static bool Counting;
+    // which address space the debug view shows
+    static HeatmapBus ViewBus;
+
+    static inline void countCPU(tCPU::word address, HeatmapAccess access) {
+        if (Counting) {
+            increment(cpuCounters[access][address]);
+        }
+    }
+
+    static inline void countPPU(tCPU::word address, HeatmapAccess access) {
+        if (Counting) {
+            increment(ppuCounters[access][address & 0x3FFF]);
+        }
+    }
+
+    // fade all counters, run once per frame
+    static void decay();
+
+    // 256x256 BGRA: red = writes, green = reads, blue = execute
+    static void rasterize(tCPU::byte *target);
+
+private:
+    static inline void increment(uint16_t &counter) {
+        counter += counter != 0xFFFF;
+    }
+
+    alignas(16) static uint16_t cpuCounters[3][0x10000];
+    alignas(16) static uint16_t ppuCounters[3][0x4000];
+};
+
+/**
+ * Hooks called from the CPU and PPU access paths
+ */
+template<bool Enabled>
+struct HeatmapPolicy {
+    static const bool IsEnabled = false;
+
+    static inline void cpu(tCPU::word address, HeatmapAccess access) {}
+
+    static inline void ppu(tCPU::word address, HeatmapAccess access) {}
+};
+
+template<>
+struct HeatmapPolicy<true> {
+    static const bool IsEnabled = true;
+
+    static inline void cpu(tCPU::word address, HeatmapAccess access) {
+        MemoryHeatmap::countCPU(address, access);
+    }
+
+    static inline void ppu(tCPU::word address, HeatmapAccess access) {
+        MemoryHeatmap::countPPU(address, access);
+    }
+};
+
+typedef HeatmapPolicy<HEATMAP_ENABLED> Heatmap;
@@ -1,6 +1,7 @@
 #include "MemoryIO.h"
 #include "Exceptions.h"
 #include "Joypad.h"
+#include "DMA.h"
 #include <functional>
 
 template<>
@@ -236,11 +237,9 @@ struct MemoryIOHandler<0x4015> {
 
 template<>
 struct MemoryIOHandler<0x4014> {
-    static void write(PPU *ppu, Memory *memory, tCPU::byte value) {
-        PrintPpu("Writing 0x%02X to port $2006 - VRAM Sprite DMA Xfer", (int) value);
-        ppu->StartSpriteXferDMA(memory, value);
-
-        MemoryIO::cpuCyclesPenalty += 513;
+    static void write(DMA *dma, tCPU::byte value) {
+        PrintPpu("Writing 0x%02X to port $4014 - VRAM Sprite DMA Xfer", (int) value);
+        dma->transferOAM(value);
     }
 };
 
@@ -276,8 +275,6 @@ public:
             : ExceptionBase(str) {}
 };
 
-int MemoryIO::cpuCyclesPenalty = 0;
-
 bool
 MemoryIO::write(tCPU::word address, tCPU::byte value) {
     switch (address) {
@@ -383,7 +380,7 @@ MemoryIO::write(tCPU::word address, tCPU::byte value) {
             break;
 
         case 0x4014:
-            MemoryIOHandler<0x4014>::write(ppu, memory, value);
+            MemoryIOHandler<0x4014>::write(dma, value);
             break;
 
         case 0x4015:
@@ -426,6 +423,9 @@ MemoryIO::read(tCPU::word address) {
             return MemoryIOHandler<0x4015>::read(apu);
 
         case 0x4016:
+            if (lagMeter != nullptr) {
+                lagMeter->poll(ppu->isPastStockFrame());
+            }
             return MemoryIOHandler<0x4016>::read(joypad);
 
         case 0x4017:
@@ -447,3 +447,13 @@ void
 MemoryIO::setMemory(Memory *memory) {
     this->memory = memory;
 }
+
+void
+MemoryIO::useDMA(DMA *dma) {
+    this->dma = dma;
+}
+
+void
+MemoryIO::useLagMeter(LagMeter *lagMeter) {
+    this->lagMeter = lagMeter;
+}
@@ -6,6 +6,9 @@
 #include "PPU.h"
 #include "Joypad.h"
 #include "Audio.h"
+#include "LagMeter.h"
+
+class DMA;
 
 template<tCPU::word Address>
 struct MemoryIOHandler {
@@ -33,10 +36,15 @@ struct MemoryIO {
 
     void setMemory(Memory *memory);
 
-    static int cpuCyclesPenalty;
+    void useDMA(DMA *dma);
+
+    // controller reads close out lag frame counting
+    void useLagMeter(LagMeter *lagMeter);
 
 protected:
     PPU* ppu;
+    DMA* dma = nullptr;
+    LagMeter* lagMeter = nullptr;
     Audio* apu;
     Memory* memory;
     Joypad* joypad;
@@ -1,10 +1,15 @@
 #include "PPU.h"
 #include "Logging.h"
+#include "Interrupts.h"
+#include "Registers.h"
+#include <algorithm>
 
 MemoryMapper::MemoryMapper(unsigned char *ppuRam, unsigned char *cpuRam) {
     this->PPU_RAM = ppuRam;
     this->CPU_RAM = cpuRam;
-    this->PRG_BANKS = new unsigned char[0x20000]; // 128KiB (ie megaman1)
+    this->PRG_BANKS = new unsigned char[PRG_ROM_PAGE_SIZE * MAX_PRG_ROM_PAGES]; // 512KiB (ie MMC3 boards)
+    this->CHR_BANKS = new unsigned char[CHR_ROM_PAGE_SIZE * MAX_CHR_ROM_PAGES]; // 256KiB
+    memoryMapperId = MEMORY_MAPPER_NROM;
     chrBank = 0;
     prgBank = 0;
 }
@@ -14,8 +19,12 @@ MemoryMapper::loadRom(Cartridge &rom) {
     PrintInfo("Initializing Memory Mapper #%d", rom.info.memoryMapperId);
 
     for (uint8_t i = 0; i < rom.header.numChrPages; i++) {
-        PrintInfo("  Writing chr page %d to CPU @ 0x%X", i, 0x8000 + CHR_ROM_PAGE_SIZE * i);
-        memcpy(PPU_RAM + 0x8000 + CHR_ROM_PAGE_SIZE * i, rom.characterDataPages[i].buffer, CHR_ROM_PAGE_SIZE);
+        // only the first four pages fit above the pattern tables in PPU_RAM (CNROM)
+        if (0x8000 + CHR_ROM_PAGE_SIZE * (i + 1) <= 0x10000) {
+            PrintInfo("  Writing chr page %d to CPU @ 0x%X", i, 0x8000 + CHR_ROM_PAGE_SIZE * i);
+            memcpy(PPU_RAM + 0x8000 + CHR_ROM_PAGE_SIZE * i, rom.characterDataPages[i].buffer, CHR_ROM_PAGE_SIZE);
+        }
+        memcpy(CHR_BANKS + CHR_ROM_PAGE_SIZE * i, rom.characterDataPages[i].buffer, CHR_ROM_PAGE_SIZE);
     }
 
     for (uint8_t i = 0; i < rom.header.numPrgPages; i++) {
@@ -25,6 +34,17 @@ MemoryMapper::loadRom(Cartridge &rom) {
     }
 
     memoryMapperId = rom.info.memoryMapperId;
+    numChrRomPages = rom.header.numChrPages;
+
+    // shadows were patched from the previous rom
+    shadowWindows.clear();
+
+    // default PRG layout: first 16KiB page at $8000, last page at $C000 (NROM-128 mirrors its only page)
+    tCPU::dword lastPage = (tCPU::dword) std::max(rom.header.numPrgPages - 1, 0) * PRG_ROM_PAGE_SIZE;
+    mapPrgWindow(0, 0);
+    mapPrgWindow(1, 0x2000);
+    mapPrgWindow(2, lastPage);
+    mapPrgWindow(3, lastPage + 0x2000);
 
     switch(memoryMapperId) {
         case MEMORY_MAPPER_UNROM: {
@@ -36,6 +56,8 @@ MemoryMapper::loadRom(Cartridge &rom) {
             // use first 2 bits for switching between 4 pages
             // use first 3 bits for switching between 7 pages (eg: Metal Gear)
             prgBankMask = rom.header.numPrgPages > 4 ? 0x7 : 0x3;
+            mapPrgWindow(0, prgBank * PRG_ROM_PAGE_SIZE);
+            mapPrgWindow(1, prgBank * PRG_ROM_PAGE_SIZE + 0x2000);
         } break;
 
         case MEMORY_MAPPER_CNROM: {
@@ -45,11 +67,103 @@ MemoryMapper::loadRom(Cartridge &rom) {
             chrBank = 0;
         } break;
 
+        case MEMORY_MAPPER_MMC3: {
+            // PRG is switched in 8KiB windows, CHR in 1KiB windows
+            numPrgBanks8k = rom.header.numPrgPages * 2;
+            numChrBanks1k = rom.header.numChrPages * 8; // zero when the board carries CHR-RAM
+            fourScreenVRAM = rom.info.fourScreenVRAM;
+            bankSelect = 0;
+            irqLatch = irqCounter = 0;
+            irqReload = irqEnabled = false;
+            // force every CHR window to be copied in
+            for (auto &offset : chrBankOffsets) {
+                offset = 0xFFFFFFFF;
+            }
+            updateBanksMMC3();
+        } break;
 
         default: {
             PrintInfo("Unsupported memory mapper %d", memoryMapperId);
         } break;
     }
+
+    // pattern tables were rewritten underneath any decoded tiles, and may decode differently
+    if (ppu != nullptr) {
+        ppu->updateAddressWindows();
+        ppu->invalidateTiles(0x0000, 0x2000);
+    }
+}
+
+/**
+ * Recompute MMC3 PRG/CHR windows from the bank select and bank data registers.
+ * PRG windows point straight into PRG_BANKS (or a cheat shadow),
+ * CHR windows are copied into the PPU_RAM pattern tables only when they change.
+ */
+void
+MemoryMapper::updateBanksMMC3() {
+    if (numPrgBanks8k > 0) {
+        tCPU::dword secondLast = (tCPU::dword) (numPrgBanks8k - 2) * 0x2000;
+        tCPU::dword last = (tCPU::dword) (numPrgBanks8k - 1) * 0x2000;
+        tCPU::dword r6 = (tCPU::dword) ((bankRegisters[6] & 0x3F) % numPrgBanks8k) * 0x2000;
+        tCPU::dword r7 = (tCPU::dword) ((bankRegisters[7] & 0x3F) % numPrgBanks8k) * 0x2000;
+
+        if (Bit<6>::IsSet(bankSelect)) {
+            // $8000 fixed to second-last bank, R6 at $C000
+            mapPrgWindow(0, secondLast);
+            mapPrgWindow(2, r6);
+        } else {
+            // R6 at $8000, $C000 fixed to second-last bank
+            mapPrgWindow(0, r6);
+            mapPrgWindow(2, secondLast);
+        }
+        mapPrgWindow(1, r7);
+        mapPrgWindow(3, last);
+    }
+
+    if (numChrBanks1k == 0) {
+        // CHR-RAM, pattern tables are written directly by the PPU
+        return;
+    }
+
+    // R0 and R1 select 2KiB banks (low bit ignored), R2-R5 select 1KiB banks
+    tCPU::dword windows[8] = {
+            (tCPU::dword) (bankRegisters[0] & 0xFE), (tCPU::dword) (bankRegisters[0] | 0x01),
+            (tCPU::dword) (bankRegisters[1] & 0xFE), (tCPU::dword) (bankRegisters[1] | 0x01),
+            bankRegisters[2], bankRegisters[3], bankRegisters[4], bankRegisters[5]
+    };
+
+    // CHR A12 inversion swaps the 2KiB and 1KiB halves of the pattern tables
+    int inversion = Bit<7>::IsSet(bankSelect) ? 4 : 0;
+
+    for (int i = 0; i < 8; i++) {
+        tCPU::dword offset = (windows[i] % numChrBanks1k) * 0x400;
+        int window = i ^ inversion;
+        if (chrBankOffsets[window] != offset) {
+            chrBankOffsets[window] = offset;
+            memcpy(PPU_RAM + window * 0x400, CHR_BANKS + offset, 0x400);
+            if (ppu != nullptr) {
+                ppu->invalidateTiles(window * 0x400, 0x400);
+            }
+        }
+    }
+}
+
+/**
+ * MMC3 scanline counter, clocked by the PPU on each A12 rising edge.
+ * Asserts the mapper IRQ line when the counter reaches zero with interrupts enabled.
+ */
+void
+MemoryMapper::clockScanlineCounter() {
+    if (irqCounter == 0 || irqReload) {
+        irqCounter = irqLatch;
+        irqReload = false;
+    } else {
+        irqCounter--;
+    }
+
+    if (irqCounter == 0 && irqEnabled) {
+        InterruptLines::Asserted |= InterruptLines::IRQ_MAPPER;
+    }
 }
 
 /**
@@ -71,6 +185,10 @@ MemoryMapper::getEffectivePPUAddress(tCPU::word address) {
             address = address + 0x8000 + chrBank * CHR_ROM_PAGE_SIZE;
         } break;
 
+        case MEMORY_MAPPER_MMC3: {
+            // address is unchanged, active 1KiB windows live in the pattern tables
+        } break;
+
         default: {
             PrintInfo("Unsupported memory mapper %d", memoryMapperId);
         } break;
@@ -122,6 +240,8 @@ MemoryMapper::writeByteCPUMemory(tCPU::word address, tCPU::byte value) {
 //                    PrintInfo("switching to PRG bank = %d", newBank);
                 }
                 prgBank = newBank;
+                mapPrgWindow(0, prgBank * PRG_ROM_PAGE_SIZE);
+                mapPrgWindow(1, prgBank * PRG_ROM_PAGE_SIZE + 0x2000);
             } else {
                 CPU_RAM[address] = value;
             }
@@ -130,46 +250,174 @@ MemoryMapper::writeByteCPUMemory(tCPU::word address, tCPU::byte value) {
         case MEMORY_MAPPER_CNROM: {
             if(address >= 0x8000 && address <= 0xFFFF) {
                 auto newBank = value & 0x3; // only lower 2 bits
-                if(newBank != chrBank) {
+                bool switched = newBank != chrBank;
+                if(switched) {
 //                    PrintInfo("switching to CHR bank = %d", newBank);
                 }
                 chrBank = newBank;
+                if (switched && ppu != nullptr) {
+                    // pattern tables decode into another bank now
+                    ppu->updateAddressWindows();
+                    ppu->invalidateTiles(0x0000, 0x2000);
+                }
             } else {
                 CPU_RAM[address] = value;
             }
         } break;
 
+        case MEMORY_MAPPER_MMC3: {
+            if (address < 0x8000) {
+                // PRG-RAM at $6000-$7FFF
+                CPU_RAM[address] = value;
+                break;
+            }
+
+            // registers are selected by address range and A0
+            bool odd = (address & 1) != 0;
+            switch (address & 0xE000) {
+                case 0x8000:
+                    if (odd) {
+                        bankRegisters[bankSelect & 0x7] = value;
+                    } else {
+                        bankSelect = value;
+                    }
+                    updateBanksMMC3();
+                    break;
+
+                case 0xA000:
+                    if (!odd && !fourScreenVRAM && ppu != nullptr) {
+                        ppu->setMirroring(value & 1 ? HORIZONTAL_MIRRORING : VERTICAL_MIRRORING);
+                    }
+                    // odd: PRG-RAM protect, ignored
+                    break;
+
+                case 0xC000:
+                    if (odd) {
+                        irqCounter = 0;
+                        irqReload = true;
+                    } else {
+                        irqLatch = value;
+                    }
+                    break;
+
+                case 0xE000:
+                    if (odd) {
+                        irqEnabled = true;
+                    } else {
+                        // disable and acknowledge any pending interrupt
+                        irqEnabled = false;
+                        InterruptLines::Asserted &= ~InterruptLines::IRQ_MAPPER;
+                    }
+                    break;
+            }
+        } break;
+
         default: {
             PrintInfo("Unsupported memory mapper %d", memoryMapperId);
         } break;
     }
 }
 
+/**
+ * PRG ROM reads go through the window table, so bank switching and cheats cost nothing per read
+ */
 tCPU::byte
 MemoryMapper::readByteCPUMemory(tCPU::word address) {
-    switch(memoryMapperId) {
-        case MEMORY_MAPPER_NROM:
-            // address is unchanged
-            break;
+    // address must be in range [$8000-$FFFF]
+    return prgWindows[(address >> 13) & 0x3][address & 0x1FFF];
+}
 
-        case MEMORY_MAPPER_UNROM: {
-            // switch between four 16KiB PRG banks for the first ROM bank
-            if(address < 0xC000) {
-                auto relative = address - 0x8000;
-                auto adjusted = relative + 0x10000 + prgBank * PRG_ROM_PAGE_SIZE;
-                auto value = CPU_RAM[adjusted];
-                return value;
+/**
+ * Map an 8KiB PRG bank (offset into PRG_BANKS) into one of the four CPU windows at $8000-$FFFF.
+ * Windows without cheats are a plain pointer update.
+ */
+void
+MemoryMapper::mapPrgWindow(int window, tCPU::dword offset) {
+    prgWindowOffsets[window] = offset;
+
+    if (cheatWindows & (1 << window)) {
+        prgWindows[window] = getShadowWindow(window, offset);
+    } else {
+        prgWindows[window] = PRG_BANKS + offset;
+    }
+}
+
+/**
+ * Patched copy of a PRG bank as seen through a window, built the first time the pair is mapped.
+ * Compare values are tested against the original ROM here, not on reads.
+ */
+tCPU::byte *
+MemoryMapper::getShadowWindow(int window, tCPU::dword offset) {
+    // offsets are 8KiB aligned, leaving the low bits for the window
+    tCPU::dword key = offset | window;
+
+    auto existing = shadowWindows.find(key);
+    if (existing == shadowWindows.end()) {
+        std::vector<tCPU::byte> shadow;
+
+        for (auto &active : cheats) {
+            const Cheat &cheat = active.second;
+            if (((cheat.address >> 13) & 0x3) != window) {
+                continue;
             }
-        } break;
 
-        case MEMORY_MAPPER_CNROM: {
-            // address is unchanged
-        } break;
+            tCPU::word relative = cheat.address & 0x1FFF;
+            if (cheat.hasCompare && PRG_BANKS[offset + relative] != cheat.compare) {
+                continue;
+            }
 
-        default: {
-            PrintInfo("Unsupported memory mapper %d", memoryMapperId);
-        } break;
+            if (shadow.empty()) {
+                shadow.assign(PRG_BANKS + offset, PRG_BANKS + offset + 0x2000);
+            }
+            shadow[relative] = cheat.value;
+        }
+
+        // an empty shadow records that no cheat applies to this bank
+        existing = shadowWindows.emplace(key, std::move(shadow)).first;
+    }
+
+    return existing->second.empty() ? PRG_BANKS + offset : existing->second.data();
+}
+
+int
+MemoryMapper::addCheat(const Cheat &cheat) {
+    int id = nextCheatId++;
+    cheats.emplace_back(id, cheat);
+
+    PrintInfo("Cheat #%d: $%04X = 0x%02X%s", id, cheat.address, cheat.value, cheat.hasCompare ? " (compare)" : "");
+
+    rebuildCheats();
+    return id;
+}
+
+void
+MemoryMapper::removeCheat(int id) {
+    cheats.erase(std::remove_if(cheats.begin(), cheats.end(), [id](const std::pair<int, Cheat> &active) {
+        return active.first == id;
+    }), cheats.end());
+
+    rebuildCheats();
+}
+
+void
+MemoryMapper::clearCheats() {
+    cheats.clear();
+    rebuildCheats();
+}
+
+/**
+ * Drop all shadows and remap the current windows; only the four live banks are re-patched
+ */
+void
+MemoryMapper::rebuildCheats() {
+    shadowWindows.clear();
+
+    cheatWindows = 0;
+    for (auto &active : cheats) {
+        cheatWindows |= 1 << ((active.second.address >> 13) & 0x3);
     }
 
-    return CPU_RAM[address];
+    for (int window = 0; window < 4; window++) {
+        mapPrgWindow(window, prgWindowOffsets[window]);
+    }
 }
@@ -2,6 +2,18 @@
 
 #include "Platform.h"
 #include "Cartridge.h"
+#include "Cheats.h"
+#include <map>
+#include <vector>
+
+class PPU;
+
+enum MemoryMappers {
+    MEMORY_MAPPER_NROM = 0,
+    MEMORY_MAPPER_UNROM = 2,
+    MEMORY_MAPPER_CNROM = 3,
+    MEMORY_MAPPER_MMC3 = 4,
+};
 
 class MemoryMapper {
 public:
@@ -9,18 +21,98 @@ public:
 
     void loadRom(Cartridge &rom);
 
+    void setPPU(PPU *ppu) {
+        this->ppu = ppu;
+    }
+
     unsigned short getEffectivePPUAddress(unsigned short address);
 
     void writeByteCPUMemory(unsigned short address, unsigned char value);
 
     unsigned char readByteCPUMemory(unsigned short address);
 
+    /**
+     * Mapper watches PPU A12 and wants a clock for every rising edge (MMC3)
+     */
+    bool countsScanlines() {
+        return memoryMapperId == MEMORY_MAPPER_MMC3;
+    }
+
+    void clockScanlineCounter();
+
+    // direct pointer into the PRG window mapped at CPU address [$8000-$FFFF], valid until the next bank switch
+    const tCPU::byte *getPrgPointer(tCPU::word address) {
+        return prgWindows[(address >> 13) & 0x3] + (address & 0x1FFF);
+    }
+
+    // offset into PRG ROM of the byte currently visible at CPU address [$8000-$FFFF]
+    tCPU::dword getPrgRomOffset(tCPU::word address) {
+        return prgWindowOffsets[(address >> 13) & 0x3] + (address & 0x1FFF);
+    }
+
+    // offset into CHR ROM of the byte currently visible at PPU address, or -1 for CHR-RAM/nametables
+    int getChrRomOffset(tCPU::word address) {
+        if (address >= 0x2000 || numChrRomPages == 0) {
+            return -1;
+        }
+
+        switch (memoryMapperId) {
+            case MEMORY_MAPPER_CNROM:
+                return chrBank * CHR_ROM_PAGE_SIZE + address;
+            case MEMORY_MAPPER_MMC3:
+                return chrBankOffsets[address >> 10] + (address & 0x3FF);
+            default:
+                return address;
+        }
+    }
+
+    // PRG ROM cheats, returns an id for removeCheat()
+    int addCheat(const Cheat &cheat);
+
+    void removeCheat(int id);
+
+    void clearCheats();
+
 private:
     unsigned char *PPU_RAM;
     unsigned char *CPU_RAM;
     unsigned char *PRG_BANKS;
+    unsigned char *CHR_BANKS;
+    PPU *ppu = nullptr;
     int memoryMapperId;
     int chrBank;
     int prgBank;
     int prgBankMask;
+    int numChrRomPages = 0;
+
+    // CPU $8000-$FFFF as four 8KiB windows into PRG_BANKS or a cheat shadow of the mapped bank
+    void mapPrgWindow(int window, tCPU::dword offset);
+    tCPU::byte *prgWindows[4] = {nullptr, nullptr, nullptr, nullptr};
+    tCPU::dword prgWindowOffsets[4] = {0, 0, 0, 0};
+
+    // cheats
+    tCPU::byte *getShadowWindow(int window, tCPU::dword offset);
+    void rebuildCheats();
+
+    std::vector<std::pair<int, Cheat>> cheats;
+    int nextCheatId = 1;
+    // bit per window that has at least one cheat
+    tCPU::byte cheatWindows = 0;
+    // patched banks keyed by PRG_BANKS offset | window, empty when no cheat applies
+    std::map<tCPU::dword, std::vector<tCPU::byte>> shadowWindows;
+
+    // MMC3 state
+    void updateBanksMMC3();
+
+    int numPrgBanks8k = 0;
+    int numChrBanks1k = 0;
+    bool fourScreenVRAM = false;
+    tCPU::byte bankSelect = 0;
+    tCPU::byte bankRegisters[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+    // offsets into CHR_BANKS for the 1KiB pattern table windows currently copied into PPU_RAM
+    tCPU::dword chrBankOffsets[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    tCPU::byte irqLatch = 0;
+    tCPU::byte irqCounter = 0;
+    bool irqReload = false;
+    bool irqEnabled = false;
 };
@@ -1,18 +1,29 @@
 #pragma once
 
 #include "MemoryLookup.h"
+#include "CodeDataLogger.h"
 
 /**
  * perform basic memory ops on effective memory address
  */
 template<int MemoryMode>
 struct MemoryOperation : MemoryAddressResolve<MemoryMode> {
+    // data reached through a pointer in zeropage is flagged as indirect in the code/data log
+    static const tCPU::byte DataLogFlags = (MemoryMode == ADDR_MODE_INDEXED_INDIRECT ||
+                                            MemoryMode == ADDR_MODE_INDIRECT_INDEXED)
+                                           ? CDL_PRG_DATA | CDL_PRG_INDIRECT_DATA : CDL_PRG_DATA;
+
     static tCPU::byte readByte(InstructionContext *ctx) {
-        return ctx->mem->readByte(MemoryAddressResolve<MemoryMode>::GetEffectiveAddress(ctx));
+        tCPU::word address = MemoryAddressResolve<MemoryMode>::GetEffectiveAddress(ctx);
+        CodeDataLog::prg(address, DataLogFlags);
+        return ctx->mem->readByte(address);
     }
 
     static tCPU::word readWord(InstructionContext *ctx) {
-        return ctx->mem->readWord(MemoryAddressResolve<MemoryMode>::GetEffectiveAddress(ctx));
+        tCPU::word address = MemoryAddressResolve<MemoryMode>::GetEffectiveAddress(ctx);
+        CodeDataLog::prg(address, DataLogFlags);
+        CodeDataLog::prg(address + 1, DataLogFlags);
+        return ctx->mem->readWord(address);
     }
 
     static bool writeByte(InstructionContext *ctx, tCPU::byte value) {
@@ -0,0 +1,130 @@
+#include "NametableCache.h"
+#include <cstring>
+
+NametableCache::NametableCache() {
+    memset(pixels, 0, sizeof(pixels));
+    invalidateAll();
+}
+
+void
+NametableCache::invalidateAll() {
+    staleAll = true;
+    layoutGeneration++;
+}
+
+void
+NametableCache::invalidateNametable(int nametable, int offset, int length) {
+    if (length >= 0x400) {
+        memset(staleCell[nametable], 1, sizeof(staleCell[nametable]));
+        staleCells = true;
+        return;
+    }
+
+    for (int byte = offset; byte < offset + length && byte < 0x400; byte++) {
+        if (byte < 960) {
+            staleCell[nametable][byte] = true;
+            continue;
+        }
+
+        // an attribute byte colors 4x4 tiles, the last row of them is off the bottom
+        int attribute = byte - 0x3C0;
+        int tileX = (attribute % 8) * 4, tileY = (attribute / 8) * 4;
+        for (int y = tileY; y < tileY + 4 && y < 30; y++) {
+            for (int x = tileX; x < tileX + 4; x++) {
+                staleCell[nametable][y * 32 + x] = true;
+            }
+        }
+    }
+    staleCells = true;
+}
+
+void
+NametableCache::invalidatePatterns(tCPU::word address, int length) {
+    // tiles outside the drawn table are not in the image, switching tables redraws everything anyway
+    int first = address >> 4, last = (address + length - 1) >> 4;
+    int tableFirst = drawnPatternTable >> 4, tableLast = tableFirst + 255;
+    if (drawnPatternTable == 0xFFFF || last < tableFirst || first > tableLast) {
+        return;
+    }
+
+    for (int tile = first > tableFirst ? first : tableFirst; tile <= last && tile <= tableLast; tile++) {
+        staleTile[tile] = true;
+    }
+    staleTiles = true;
+    layoutGeneration++;
+}
+
+void
+NametableCache::update(const tCPU::byte *const nametables[4], tCPU::word patternTable, const TileCache &tiles) {
+    if (staleAll || patternTable != drawnPatternTable) {
+        memset(staleCell, 1, sizeof(staleCell));
+        staleCells = true;
+        staleTiles = false;
+        memset(staleTile, 0, sizeof(staleTile));
+        staleAll = false;
+        drawnPatternTable = patternTable;
+    }
+
+    if (staleTiles) {
+        int firstTile = patternTable >> 4;
+        for (int nametable = 0; nametable < 4; nametable++) {
+            for (int cell = 0; cell < 960; cell++) {
+                if (staleTile[firstTile + nametables[nametable][cell]]) {
+                    staleCell[nametable][cell] = true;
+                }
+            }
+        }
+        memset(staleTile, 0, sizeof(staleTile));
+        staleTiles = false;
+        staleCells = true;
+    }
+
+    if (!staleCells) {
+        return;
+    }
+
+    for (int nametable = 0; nametable < 4; nametable++) {
+        for (int cell = 0; cell < 960; cell++) {
+            if (staleCell[nametable][cell]) {
+                drawCell(nametable, cell, nametables[nametable], patternTable, tiles);
+                staleCell[nametable][cell] = false;
+            }
+        }
+    }
+    staleCells = false;
+}
+
+/**
+ * 8x8 pixels of one tile with its 2 attribute bits, matching what PPU::renderScanline decodes
+ */
+void
+NametableCache::drawCell(int nametable, int cell, const tCPU::byte *names, tCPU::word patternTable,
+                         const TileCache &tiles) {
+    int tileX = cell % 32, tileY = cell / 32;
+
+    // each attribute byte covers 4x4 tiles, 2 bits per 2x2 quadrant
+    tCPU::byte attribute = names[0x3C0 + (tileY / 4) * 8 + tileX / 4];
+    int quadrant = ((tileY / 2) % 2) * 2 + (tileX / 2) % 2;
+    uint64_t upperBits = (attribute >> (quadrant * 2)) & 3;
+
+    const uint64_t lanes = 0x0101010101010101ULL;
+    tCPU::word patternAddress = patternTable + names[cell] * 16;
+    tCPU::byte *destination = pixels + ((nametable >> 1) * 240 + tileY * 8) * WIDTH + (nametable & 1) * 256 + tileX * 8;
+
+    for (int row = 0; row < 8; row++) {
+        uint64_t patternRow = tiles.row(patternAddress + row, false);
+        uint64_t opaque = ((patternRow | patternRow >> 1) & lanes) * 0xFF;
+        uint64_t indices = patternRow | (opaque & (lanes * (upperBits << 2)));
+        memcpy(destination + row * WIDTH, &indices, 8);
+    }
+}
+
+void
+NametableCache::copyRow(int x, int y, tCPU::byte *output, int length) const {
+    const tCPU::byte *row = pixels + y * WIDTH;
+    x %= WIDTH;
+
+    int first = WIDTH - x < length ? WIDTH - x : length;
+    memcpy(output, row + x, first);
+    memcpy(output + first, row, length - first);
+}
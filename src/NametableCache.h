@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Platform.h"
+#include "TileCache.h"
+
+/**
+ * The four nametables as one 512x480 image of background palette indices (attribute bits over the
+ * 2-bit pattern value, 0 where transparent), laid out as in PPU::updateAddressWindows.
+ *
+ * Kept up to date cell by cell: nametable and attribute writes mark the tiles they cover, pattern
+ * changes mark every tile showing that pattern, layout changes (mirroring, pattern table) mark
+ * everything. A background scanline is then a copy out of the image at the scroll position.
+ */
+class NametableCache {
+public:
+    static const int WIDTH = 512;
+    static const int HEIGHT = 480;
+
+    NametableCache();
+
+    // mirroring or every pattern changed
+    void invalidateAll();
+
+    // bytes [offset, offset + length) of logical nametable 0-3 changed, tiles or attributes
+    void invalidateNametable(int nametable, int offset, int length);
+
+    // pattern memory [address, address + length) of $0000-$1FFF changed
+    void invalidatePatterns(tCPU::word address, int length);
+
+    // nothing to redraw for this pattern table
+    bool isCurrent(tCPU::word patternTable) const {
+        return !staleCells && !staleTiles && patternTable == drawnPatternTable;
+    }
+
+    // bumped whenever more than nametable bytes changed: patterns in the drawn table or the layout
+    tCPU::dword getLayoutGeneration() const {
+        return layoutGeneration;
+    }
+
+    /**
+     * Redraw stale tiles. nametables[n] is the 1KiB behind logical nametable n, tiles has to hold
+     * every tile of the pattern table decoded.
+     */
+    void update(const tCPU::byte *const nametables[4], tCPU::word patternTable, const TileCache &tiles);
+
+    // length pixels of row y from column x on, wrapping around at 512
+    void copyRow(int x, int y, tCPU::byte *output, int length) const;
+
+    const tCPU::byte *getPixels() const {
+        return pixels;
+    }
+
+private:
+    tCPU::byte pixels[WIDTH * HEIGHT];
+
+    // pattern table the pixels were drawn from, 0xFFFF before the first update
+    tCPU::word drawnPatternTable = 0xFFFF;
+    tCPU::dword layoutGeneration = 0;
+
+    bool staleCell[4][960];
+    bool staleTile[TileCache::NUM_TILES];
+    bool staleCells = true, staleTiles = false, staleAll = true;
+
+    void drawCell(int nametable, int cell, const tCPU::byte *names, tCPU::word patternTable, const TileCache &tiles);
+};
@@ -0,0 +1,222 @@
+#include "NtscFilter.h"
+#include "PaletteExpander.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NTSC_FILTER_AVX2
+#include <immintrin.h>
+#endif
+
+// blocks of 3 input pixels per row: 258 pixels, the last two are black
+static const int NUM_BLOCKS = 86;
+static const int NUM_ROWS = 240;
+
+/*
+ * PPU composite output, relative to sync: low and high level of the square wave per luma level
+ */
+static const float BLACK = .518f, WHITE = 1.962f, ATTENUATION = .746f;
+static const float LEVELS[8] = {.350f, .518f, .962f, 1.550f, 1.094f, 1.506f, 1.962f, 1.962f};
+
+// decoded hues turned onto those of the RGB master palette, demodulated chroma is at half amplitude
+static const float HUE_DEGREES = 115.0f;
+static const float CHROMA_GAIN = 2.0f;
+
+// the clear color goes out as the NES gray nearest to it
+static const int CLEAR_SIGNAL_COLOR = 0x2D;
+
+// black, what the padding around each row sends
+static const tCPU::byte PADDING_COLOR = 0x0F;
+
+// fixed point of the table, 5 fraction bits on top of 8-bit channels
+static const int FRACTION_BITS = 5;
+
+/**
+ * One sample of the square wave for a 6-bit color at subcarrier phase 0-11, 0 at black and 1 at white
+ */
+static float compositeSample(int color, int emphasis, int phase) {
+    int hue = color & 0x0F;
+    int level = hue > 13 ? 1 : (color >> 4) & 3;
+
+    float low = LEVELS[level];
+    float high = LEVELS[4 + level];
+    if (hue == 0) {
+        low = high;
+    }
+    if (hue > 12) {
+        high = low;
+    }
+
+    auto inColorPhase = [phase](int hue) { return (hue + phase) % 12 < 6; };
+    float signal = inColorPhase(hue) ? high : low;
+
+    // each emphasis bit attenuates a third of the cycle
+    if (((emphasis & 1) && inColorPhase(0)) || ((emphasis & 2) && inColorPhase(4))
+        || ((emphasis & 4) && inColorPhase(8))) {
+        signal *= ATTENUATION;
+    }
+
+    return (signal - BLACK) / (WHITE - BLACK);
+}
+
+NtscFilter::NtscFilter(BandPool *pool) : pool(pool) {
+    buildKernels();
+}
+
+/**
+ * For an input pixel at each position of its block: the output pixels of its own block and both
+ * neighbours whose 12-sample demodulation window covers any of its 8 samples, demodulated to RGB
+ */
+void
+NtscFilter::buildKernels() {
+    const float pi = 3.14159265f;
+    const float scale = 255.0f * (1 << FRACTION_BITS);
+    kernels.assign(3 * 8 * PaletteExpander::NUM_COLORS * ENTRIES_PER_COLOR * ENTRY_SIZE, 0);
+
+    for (int linePhase = 0; linePhase < 3; linePhase++) {
+        for (int emphasis = 0; emphasis < 8; emphasis++) {
+            for (int color = 0; color < PaletteExpander::NUM_COLORS; color++) {
+                int signalColor = color == COLOR_INDEX_CLEARED ? CLEAR_SIGNAL_COLOR : color;
+
+                for (int position = 0; position < BLOCK_INPUT; position++) {
+                    for (int distance = 0; distance < 3; distance++) {
+                        int16_t *entry = &kernels[((((linePhase * 8 + emphasis) * PaletteExpander::NUM_COLORS + color)
+                                                    * BLOCK_INPUT + position) * 3 + distance) * ENTRY_SIZE];
+
+                        for (int x = 0; x < BLOCK_OUTPUT; x++) {
+                            // samples relative to the start of the input pixel's block, 24 per block
+                            int center = (distance - 1) * 24 + (24 * x + 12) / BLOCK_OUTPUT;
+                            int first = center - 6 > position * 8 ? center - 6 : position * 8;
+                            int last = center + 6 < position * 8 + 8 ? center + 6 : position * 8 + 8;
+
+                            float y = 0, i = 0, q = 0;
+                            for (int sample = first; sample < last; sample++) {
+                                int phase = ((linePhase * 4 + sample) % 12 + 12) % 12;
+                                float level = compositeSample(signalColor, emphasis, phase) / 12;
+                                float angle = pi * phase / 6 + HUE_DEGREES * pi / 180;
+                                y += level;
+                                i += level * cosf(angle) * CHROMA_GAIN;
+                                q += level * sinf(angle) * CHROMA_GAIN;
+                            }
+
+                            float r = y + 0.946882f * i + 0.623557f * q;
+                            float g = y - 0.274788f * i - 0.635691f * q;
+                            float b = y - 1.108545f * i + 1.709007f * q;
+
+                            entry[x * 4 + 0] = (int16_t) lrintf(b * scale);
+                            entry[x * 4 + 1] = (int16_t) lrintf(g * scale);
+                            entry[x * 4 + 2] = (int16_t) lrintf(r * scale);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void
+NtscFilter::filter(const tCPU::byte *indices, const tCPU::byte *emphasis, tCPU::dword *output, int burstPhase) {
+    auto filterRows = [&](int first, int last) {
+        for (int row = first; row < last; row++) {
+            filterRow(indices, emphasis, output, burstPhase, row);
+        }
+    };
+
+    if (pool == nullptr) {
+        filterRows(0, NUM_ROWS);
+    } else {
+        pool->run(NUM_ROWS, filterRows);
+    }
+}
+
+/**
+ * Output block b sums the entries of input blocks b-1, b and b+1.
+ * line holds one padding block either side, input block n starts at line[(n + 1) * 3].
+ */
+static void filterRowScalar(const tCPU::byte *line, const int16_t *table, tCPU::dword *output) {
+    for (int block = 0; block < NUM_BLOCKS; block++) {
+        int sums[32];
+        for (auto &sum : sums) {
+            sum = 1 << (FRACTION_BITS - 1);
+        }
+
+        for (int distance = 0; distance < 3; distance++) {
+            const tCPU::byte *input = line + (block + 2 - distance) * 3;
+            for (int position = 0; position < 3; position++) {
+                const int16_t *entry = table + ((input[position] * 3 + position) * 3 + distance) * 32;
+                for (int i = 0; i < 32; i++) {
+                    sums[i] += entry[i];
+                }
+            }
+        }
+
+        for (int x = 0; x < 7; x++) {
+            tCPU::dword pixel = 0xFF000000;
+            for (int channel = 0; channel < 3; channel++) {
+                int value = sums[x * 4 + channel] >> FRACTION_BITS;
+                value = value < 0 ? 0 : value > 255 ? 255 : value;
+                pixel |= value << (channel * 8);
+            }
+            output[block * 7 + x] = pixel;
+        }
+    }
+}
+
+#ifdef NTSC_FILTER_AVX2
+/**
+ * Same sums 16 channels at a time, pixels 0-3 in low and 4-7 in high, packed back to 8 BGRA pixels.
+ * Each block stores 8 pixels, the 8th is overwritten by the next block.
+ */
+__attribute__((target("avx2")))
+static void filterRowAvx2(const tCPU::byte *line, const int16_t *table, tCPU::dword *output) {
+    const __m256i rounding = _mm256_set1_epi16(1 << (FRACTION_BITS - 1));
+    const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+
+    for (int block = 0; block < NUM_BLOCKS; block++) {
+        __m256i low = rounding, high = rounding;
+
+        for (int distance = 0; distance < 3; distance++) {
+            const tCPU::byte *input = line + (block + 2 - distance) * 3;
+            for (int position = 0; position < 3; position++) {
+                const int16_t *entry = table + ((input[position] * 3 + position) * 3 + distance) * 32;
+                low = _mm256_add_epi16(low, _mm256_loadu_si256((const __m256i *) entry));
+                high = _mm256_add_epi16(high, _mm256_loadu_si256((const __m256i *) (entry + 16)));
+            }
+        }
+
+        low = _mm256_srai_epi16(low, FRACTION_BITS);
+        high = _mm256_srai_epi16(high, FRACTION_BITS);
+
+        // packus interleaves 128-bit lanes: pixels 0-1, 4-5, 2-3, 6-7
+        __m256i pixels = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+        _mm256_storeu_si256((__m256i *) (output + block * 7), _mm256_or_si256(pixels, alpha));
+    }
+}
+#endif
+
+void
+NtscFilter::filterRow(const tCPU::byte *indices, const tCPU::byte *emphasis, tCPU::dword *output, int burstPhase,
+                      int row) {
+    tCPU::byte line[(NUM_BLOCKS + 2) * 3];
+    memset(line, PADDING_COLOR, sizeof(line));
+    memcpy(line + 3, indices + row * 256, 256);
+
+    int linePhase = (burstPhase + row) % 3;
+    const int16_t *table = &kernels[(linePhase * 8 + (emphasis[row] & 7))
+                                    * PaletteExpander::NUM_COLORS * ENTRIES_PER_COLOR * ENTRY_SIZE];
+
+    // one spare pixel for the last block's 8th
+    tCPU::dword pixels[NUM_BLOCKS * 7 + 1];
+
+#ifdef NTSC_FILTER_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        filterRowAvx2(line, table, pixels);
+        memcpy(output + row * OUTPUT_WIDTH, pixels, OUTPUT_WIDTH * sizeof(tCPU::dword));
+        return;
+    }
+#endif
+
+    filterRowScalar(line, table, pixels);
+    memcpy(output + row * OUTPUT_WIDTH, pixels, OUTPUT_WIDTH * sizeof(tCPU::dword));
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Platform.h"
+#include "BandPool.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ * NTSC composite video artifacts on the CPU, for output without a GPU.
+ *
+ * Every NES pixel becomes 8 samples of the PPU's square-wave composite signal (12 samples per color
+ * subcarrier cycle), which is decoded back to RGB with a 12-sample YIQ demodulator. Both steps are
+ * linear, so they are folded into a table: what an input pixel of a given color, emphasis, subcarrier
+ * phase and position adds to the output pixels around it. 3 input pixels span exactly two subcarrier
+ * cycles and map onto 7 output pixels, 256 pixels come out 602 wide.
+ *
+ * Filtering is then a sum of table entries per block of 7 output pixels, 8 pixels of 16-bit BGRA per
+ * entry, with AVX2 where the CPU has it. Row bands can be split across a BandPool.
+ */
+class NtscFilter {
+public:
+    static const int OUTPUT_WIDTH = 602;
+
+    // rows are filtered on the calling thread when there is no pool
+    NtscFilter(BandPool *pool = nullptr);
+
+    /**
+     * 256x240 NES color indices with each scanline's emphasis bits (see Raster) into OUTPUT_WIDTH x 240 BGRA.
+     * burstPhase (0-2) is the subcarrier phase of the first scanline; real frames move it by one every frame,
+     * which keeps the dot crawl from standing still.
+     */
+    void filter(const tCPU::byte *indices, const tCPU::byte *emphasis, tCPU::dword *output, int burstPhase);
+
+private:
+    // input pixels per block, the output pixels they map to, and table entries per (phase, emphasis, color)
+    static const int BLOCK_INPUT = 3;
+    static const int BLOCK_OUTPUT = 7;
+    static const int ENTRIES_PER_COLOR = BLOCK_INPUT * 3;
+
+    // 16-bit BGRA per entry: 8 output pixels (the 8th is zero) times 4 channels
+    static const int ENTRY_SIZE = 32;
+
+    // [subcarrier phase 0-2][emphasis][color 0-64][input position][block distance] -> entry
+    std::vector<int16_t> kernels;
+
+    BandPool *pool;
+
+    void buildKernels();
+
+    void filterRow(const tCPU::byte *indices, const tCPU::byte *emphasis, tCPU::dword *output, int burstPhase, int row);
+};
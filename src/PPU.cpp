@@ -3,91 +3,16 @@
 #include "Logging.h"
 #include "Memory.h"
 #include "Cartridge.h"
+#include "Interrupts.h"
+#include "CodeDataLogger.h"
+#include "MemoryHeatmap.h"
+#include "ScanlineCompositor.h"
+#include "RenderPipeline.h"
+#include "DebugViews.h"
+#include "PaletteExpander.h"
 #include <math.h>
 #include <bitset>
 
-struct tPaletteEntry {
-    union {
-        struct {
-            uint8_t B, G, R, A;
-        };
-
-        uint32_t ColorValue;
-    };
-
-
-};
-
-tPaletteEntry colorPalette[64] = {
-        {0x80, 0x80, 0x80, 0xFF},
-        {0xBB, 0x00, 0x00, 0xFF},
-        {0xBF, 0x00, 0x37, 0xFF},
-        {0xA6, 0x00, 0x84, 0xFF},
-        {0x6A, 0x00, 0xBB, 0xFF},
-        {0x1E, 0x00, 0xB7, 0xFF},
-        {0x00, 0x00, 0xB3, 0xFF},
-        {0x00, 0x26, 0x91, 0xFF},
-        {0x00, 0x2B, 0x7B, 0xFF},
-        {0x00, 0x3E, 0x00, 0xFF},
-        {0x0D, 0x48, 0x00, 0xFF},
-        {0x22, 0x3C, 0x00, 0xFF},
-        {0x66, 0x2F, 0x00, 0xFF},
-        {0x00, 0x00, 0x00, 0xFF},
-        {0x05, 0x05, 0x05, 0xFF},
-        {0x05, 0x05, 0x05, 0xFF},
-
-        {0xC8, 0xC8, 0xC8, 0xFF},
-        {0xFF, 0x59, 0x00, 0xFF},
-        {0xFF, 0x3C, 0x44, 0xFF},
-        {0xCC, 0x33, 0xB7, 0xFF},
-        {0xAA, 0x33, 0xFF, 0xFF},
-        {0x5E, 0x37, 0xFF, 0xFF},
-        {0x1A, 0x37, 0xFF, 0xFF},
-        {0x00, 0x4B, 0xD5, 0xFF},
-        {0x00, 0x62, 0xC4, 0xFF},
-        {0x00, 0x7B, 0x3C, 0xFF},
-        {0x15, 0x84, 0x1E, 0xFF},
-        {0x66, 0x95, 0x00, 0xFF},
-        {0xC4, 0x84, 0x00, 0xFF},
-        {0x11, 0x11, 0x11, 0xFF},
-        {0x09, 0x09, 0x09, 0xFF},
-        {0x09, 0x09, 0x09, 0xFF},
-
-        {0xFF, 0xFF, 0xFF, 0xFF},
-        {0xFF, 0x95, 0x00, 0xFF},
-        {0xFF, 0x84, 0x6F, 0xFF},
-        {0xFF, 0x6F, 0xD5, 0xFF},
-        {0xCC, 0x77, 0xFF, 0xFF},
-        {0x99, 0x6F, 0xFF, 0xFF},
-        {0x59, 0x7B, 0xFF, 0xFF},
-        {0x5F, 0x91, 0xFF, 0xFF},
-        {0x33, 0xA2, 0xFF, 0xFF},
-        {0x00, 0xBF, 0xA6, 0xFF},
-        {0x6A, 0xD9, 0x51, 0xFF},
-        {0xAE, 0xD5, 0x4D, 0xFF},
-        {0xFF, 0xD9, 0x00, 0xFF},
-        {0x66, 0x66, 0x66, 0xFF},
-        {0x0D, 0x0D, 0x0D, 0xFF},
-        {0x0D, 0x0D, 0x0D, 0xFF},
-
-        {0xFF, 0xFF, 0xFF, 0xFF},
-        {0xFF, 0xBF, 0x84, 0xFF},
-        {0xFF, 0xBB, 0xBB, 0xFF},
-        {0xFF, 0xBB, 0xD0, 0xFF},
-        {0xEA, 0xBF, 0xFF, 0xFF},
-        {0xCC, 0xBF, 0xFF, 0xFF},
-        {0xB7, 0xC4, 0xFF, 0xFF},
-        {0xAE, 0xCC, 0xFF, 0xFF},
-        {0xA2, 0xD9, 0xFF, 0xFF},
-        {0x99, 0xE1, 0xCC, 0xFF},
-        {0xB7, 0xEE, 0xAE, 0xFF},
-        {0xEE, 0xF7, 0xAA, 0xFF},
-        {0xFF, 0xEE, 0xB3, 0xFF},
-        {0xDD, 0xDD, 0xDD, 0xFF},
-        {0x11, 0x11, 0x11, 0xFF},
-        {0x11, 0x11, 0x11, 0xFF}
-};
-
 tCPU::byte screenAttributes[16][16];
 
 PPU::PPU(Raster *raster) : raster(raster) {
@@ -101,6 +26,8 @@ PPU::PPU(Raster *raster) : raster(raster) {
     // clear memory
     memset(SPR_RAM, 248, 256);
     memset(PPU_RAM, 0, 0x10000);
+    updateAddressWindows();
+    refreshPalette();
 }
 
 /**
@@ -109,6 +36,7 @@ PPU::PPU(Raster *raster) : raster(raster) {
 tCPU::byte
 PPU::getStatusRegister() {
     tCPU::byte returnValue = statusRegister;
+    logLineEvent(0x2002, 0);
 
     if (Loggy::Enabled == Loggy::DEBUG) {
         PrintInfo("PPU; Status register: %s", std::bitset<8>(statusRegister).to_string().c_str());
@@ -142,33 +70,58 @@ PPU::execute(int numCycles) {
      *     261 = pre-rendering
      */
 
-    for (int i = 0; i < numCycles; i++) {
+    // only a few dots do real work, everything between them is skipped in one step
+    while (numCycles > 0) {
         if (currentScanline < 240) {
             // [0,239]
-            // process scanline
-            advanceRenderableScanline();
-        } else if (currentScanline < 241) {
-            // [240]
-            advanceBlankScanline();
+            // next dot with work: hblank (257), mapper A12 clock, end of line (340)
+            int event;
+            if (scanlinePixel <= 257) {
+                event = 257;
+            } else if (scanlinePixel <= a12RisingEdgeDot && a12RisingEdgeDot < 340) {
+                event = a12RisingEdgeDot;
+            } else {
+                event = std::max(scanlinePixel, 340);
+            }
+
+            int dots = std::min(event - scanlinePixel, numCycles);
+            if (dots > 0) {
+                scanlinePixel += dots;
+                numCycles -= dots;
+                // drawing dots are [0,256], hblank dots are [258,339]
+                inHBlank = scanlinePixel - 1 > 257;
+            }
+
+            if (numCycles > 0) {
+                advanceRenderableScanline();
+                numCycles--;
+            }
         } else if (currentScanline < 261) {
-            // [241,260]
+            // [240,260]
+            // post-render line and vertical blanking, vblank starts on dot 1 of line 241
             if (currentScanline == 241 && scanlinePixel == 1) {
                 setVerticalBlank();
             }
-//            if (currentScanline == 261 && scanlinePixel == 280) {
-//                // copy all horizontal scrolling information from temp to vram addy
-//                if (settings.BackgroundVisible && settings.SpriteVisible) {
-//                    vramAddress14bit &= ~0x041F; // zero out position bits
-//                    vramAddress14bit |= (tempVRAMAddress & 0x041F); // copy over just the position bits
-//                    vramAddress14bit &= 0x7FFF; // ensure 15th bit is zero
-//
-//                    PrintInfo("Scanline %d Pixel %d; vramAddress14bit = 0x%X; tempVRAMAddress = %s",
-//                              currentScanline, scanlinePixel,
-//                              vramAddress14bit, std::bitset<16>(vramAddress14bit).to_string().c_str());
-//                }
-//            }
 
-            advanceBlankScanline();
+            int end = (currentScanline == 241 && scanlinePixel < 1) ? 1 : 341;
+            int dots = std::min(end - scanlinePixel, numCycles);
+            scanlinePixel += dots;
+            numCycles -= dots;
+
+            if (scanlinePixel == 341) {
+                currentScanline++;
+                scanlinePixel = 0;
+            }
+        } else if (currentScanline < 261 + frameExtraScanlines) {
+            // overclocking: whole idle lines, nothing changes until the pre-render line
+            int dots = std::min(341 - scanlinePixel, numCycles);
+            scanlinePixel += dots;
+            numCycles -= dots;
+
+            if (scanlinePixel == 341) {
+                currentScanline++;
+                scanlinePixel = 0;
+            }
         } else {
             // end of vblank
             currentScanline = 0;
@@ -186,8 +139,25 @@ PPU::execute(int numCycles) {
             sprite0HitInThisFrame = false;
             sprite0HitInThisScanline = false;
 
+            // with a pipeline the renderers reuse scanlines, the frame before was finished at vblank
+            if (pipeline != nullptr) {
+                reusedScanlines += pipeline->takeReusedScanlines();
+            }
+            reusedScanlinesLastFrame = reusedScanlines;
+            reusedScanlines = 0;
+
+            // rendering can only be switched on or off for whole frames
+            renderingFrame = renderNextFrame;
+
+            // pre-render line fetches also clock the mapper scanline counter
+            if (getA12RisingEdgeDot() >= 0) {
+                mapper->clockScanlineCounter();
+            }
+
             // reset nametable
             settings.NameTableAddress = 0x2000;
+
+            numCycles--;
         }
     }
 }
@@ -200,26 +170,28 @@ PPU::setVerticalBlank() {
     statusRegister |= 1 << 7; // set vblank bit
     inVBlank = true;
 
-//    PrintInfo("GenerateInterruptOnVBlank = %d / vblankNmiAwaiting = %d",
-//              settings.GenerateInterruptOnVBlank, vblankNmiAwaiting);
+//    PrintInfo("GenerateInterruptOnVBlank = %d", settings.GenerateInterruptOnVBlank);
+
+    frameExtraScanlines = extraScanlines;
 
     // generate nmi trigger if we have one pending
     if (settings.GenerateInterruptOnVBlank) {
-        vblankNmiAwaiting = true;
+        InterruptLines::Asserted |= InterruptLines::NMI;
         settings.GenerateInterruptOnVBlank = false;
     }
 }
 
-/**
- * Advance VBlank/HBlank scanline
- */
-void
-PPU::advanceBlankScanline() {
-    // process hblank until we reset to the start of the next scanline
-    if (++scanlinePixel == 341) {
-        currentScanline++;
-        scanlinePixel = 0;
+bool
+PPU::isPastStockFrame() {
+    // vblank starts on line 241, the extra scanlines follow line 260 and the pre-render line takes one dot here
+    const int stockFrame = 261 * 341 + 1;
+    int dots;
+    if (currentScanline >= 241) {
+        dots = (currentScanline - 241) * 341 + scanlinePixel;
+    } else {
+        dots = (20 + frameExtraScanlines) * 341 + 1 + currentScanline * 341 + scanlinePixel;
     }
+    return dots > stockFrame;
 }
 
 /**
@@ -241,6 +213,11 @@ PPU::advanceRenderableScanline() {
         // [258, 340]
         // in hblank
         inHBlank = true;
+
+        // sprite or next-line background fetches from $1000 clock the mapper
+        if (scanlinePixel == a12RisingEdgeDot) {
+            mapper->clockScanlineCounter();
+        }
     } else {
         // [340]
         // last pixel of
@@ -253,6 +230,39 @@ PPU::advanceRenderableScanline() {
     scanlinePixel++;
 }
 
+/**
+ * Dot at which PPU address line A12 rises on a rendering scanline, derived from the pattern table setup
+ * rather than tracking every fetch. Sprite fetches (dots 257-320) read from the sprite table
+ * and the next line's first tiles (dots 321-336) from the background table.
+ * 8x16 sprites are assumed to fetch from $1000, which is where unused sprite slots ($FF) land.
+ * Returns -1 when nothing is counting or rendering is off.
+ */
+int
+PPU::getA12RisingEdgeDot() {
+    if (mapper == nullptr || !mapper->countsScanlines()) {
+        return -1;
+    }
+
+    if (!settings.BackgroundVisible && !settings.SpriteVisible) {
+        return -1;
+    }
+
+    bool spritesHigh = settings.SpriteSize == SPRITE_SIZE_8x16 || settings.SpritePatternTableAddress == 0x1000;
+    bool backgroundHigh = settings.BackgroundPatternTableAddress == 0x1000;
+
+    if (spritesHigh) {
+        // first sprite pattern fetch after the nametable garbage fetch
+        return 260;
+    }
+
+    if (backgroundHigh) {
+        // first background pattern fetch for the next scanline
+        return 324;
+    }
+
+    return -1;
+}
+
 void PPU::onEnterHBlank() {
     // copy all horizontal scrolling information from temp to vram addy
     if (settings.BackgroundVisible && settings.SpriteVisible) {
@@ -270,6 +280,18 @@ void PPU::onEnterHBlank() {
 
     renderScanline(currentScanline);
 
+    if (currentScanline < 240 && renderingFrame) {
+        if (lineEvents.count > 0) {
+            scanlinePaths.dot++;
+        } else {
+            scanlinePaths.fast++;
+        }
+    }
+    lineEvents.count = 0;
+
+    // resolve once per scanline where A12 will rise during the upcoming fetches
+    a12RisingEdgeDot = getA12RisingEdgeDot();
+
     // scanline somewhere within sprite 0
     if (sprite0HitInThisFrame) {
         // if we already matched a sprite0 hit this frame
@@ -301,11 +323,103 @@ void PPU::onEnterHBlank() {
 //    }
 }
 
+/**
+ * 0x01 in every byte lane of a decoded tile row whose pixel is opaque
+ */
+static inline uint64_t opaqueLanes(uint64_t row) {
+    return (row | (row >> 1)) & 0x0101010101010101ULL;
+}
+
+/**
+ * Pattern address of the row shown by background tile column i (0-32, fine scroll spills into the 33rd)
+ */
+tCPU::word
+PPU::backgroundRowAddress(const tCPU::word Y, int i) {
+    tCPU::word nametable = settings.NameTableAddress;
+    int column = i + (vramAddress14bit & 0x1F);
+
+    if (column >= 32) {
+        // read from nametable on the right when doing horizontal scrolling, $2400 wraps to $2000
+        nametable ^= 0x400;
+    }
+
+    auto tileIdx = ReadByteFromPPU(nametable + (Y / 8) * 32 + column % 32);
+    return settings.BackgroundPatternTableAddress + tileIdx * 16 + Y % 8;
+}
+
+/**
+ * Pattern address of the row the sprite at OAM offset i shows on scanline Y
+ */
+tCPU::word
+PPU::spriteRowAddress(int i, const tCPU::word Y) {
+    auto spriteY = SPR_RAM[i] + 1;
+    auto tileIdx = SPR_RAM[i + 1];
+    auto attributes = SPR_RAM[i + 2];
+
+    bool renderLargeSprites = settings.SpriteSize == SPRITE_SIZE_8x16;
+    int spriteHeight = renderLargeSprites ? 16 : 8;
+
+    int spriteRow = (Y - spriteY) % spriteHeight;
+    bool verticalFlip = Bit<7>::IsSet(attributes);
+    int patternY = verticalFlip ? (spriteHeight - 1 - spriteRow) : spriteRow;
+
+    if (!renderLargeSprites) {
+        return settings.SpritePatternTableAddress + tileIdx * 16 + patternY;
+    }
+
+    // 8x16 sprites: lsb of tile index selects the pattern table, the even tile is the top half
+    // and the one after it the bottom half
+    tCPU::word patternTable = (tileIdx & 1) * 0x1000;
+    return patternTable + ((tileIdx & 0xFE) + (patternY >> 3)) * 16 + (patternY & 7);
+}
+
+/**
+ * Sprite-0 hit without drawing: compare sprite 0's opacity against the one or two
+ * background tiles under it. Matches what the compositor finds on a rendered scanline.
+ */
+void
+PPU::detectSprite0Hit(const tCPU::word Y, const SpriteLine &line, int numSprites) {
+    if (sprite0HitInThisFrame || !settings.BackgroundVisible || !settings.SpriteVisible) {
+        return;
+    }
+
+    // sprite lists are in OAM order, sprite 0 can only be first
+    if (numSprites == 0 || line.sprites[0] != 0) {
+        return;
+    }
+
+    bool horizontalFlip = Bit<6>::IsSet(SPR_RAM[2]);
+    uint64_t sprite = fetchTileRow(spriteRowAddress(0, Y), horizontalFlip);
+
+    if (lineEvents.count > 0) {
+        renderBackgroundDots(Y);
+
+        uint64_t background;
+        memcpy(&background, layers.background + SPR_RAM[3], 8);
+        if (opaqueLanes(sprite) & opaqueLanes(background)) {
+            sprite0HitInThisScanline = true;
+        }
+        return;
+    }
+
+    // background pixel under screen x lives at fineX + x of the 33-tile line
+    int start = horizontalScrollOrigin % 8 + SPR_RAM[3];
+    int tile = start / 8;
+    int shift = (start % 8) * 8;
+
+    uint64_t background = fetchTileRow(backgroundRowAddress(Y, tile), false) >> shift;
+    if (shift) {
+        background |= fetchTileRow(backgroundRowAddress(Y, tile + 1), false) << (64 - shift);
+    }
+
+    if (opaqueLanes(sprite) & opaqueLanes(background)) {
+        sprite0HitInThisScanline = true;
+    }
+}
+
 void PPU::renderScanline(const tCPU::word Y) {
     // tiles are 8x8 pixel in size.
     unsigned short int tileSizePixels = 8;
-    // row number within tile
-    unsigned short int tileRow = Y % tileSizePixels;
     // tile horizontal position within frame
     unsigned short int tileY = floor(Y / tileSizePixels);
 
@@ -324,29 +438,95 @@ void PPU::renderScanline(const tCPU::word Y) {
 
     attributeScroll = 0; // ignoring attribute scroll from vram, using tile instead
 
-    int *backgroundRender = (int *) raster->screenBuffer + Y * 256;
-    tCPU::byte *backgroundMask = raster->backgroundMask + Y * 256;
+    if (spriteLinesDirty) {
+        evaluateSprites();
+    }
+
+    const SpriteLine &line = spriteLines[Y < 240 ? Y : 239];
+    int numSprites = line.count;
+    if (limitSpritesPerScanline && numSprites > 8) {
+        numSprites = 8;
+    }
+
+    if (settings.SpriteVisible && Y < 240 && line.count > 8) {
+        //PrintPpu("sprite overflow!" );
+        statusRegister |= Bit<5>::Set(true);
+    }
+
+    if (!renderingFrame) {
+        // the raster keeps whatever was drawn before, it can not be reused from here on
+        scanlineHistory[Y < 240 ? Y : 239].valid = false;
+        detectSprite0Hit(Y, line, numSprites);
+        return;
+    }
+
+    if (pipeline != nullptr) {
+        // the renderer thread draws from a snapshot, only the hit is needed right away
+        detectSprite0Hit(Y, line, numSprites);
+
+        ScanlineSnapshot snapshot = {};
+        snapshot.scanline = Y;
+        snapshot.vramAddress = vramAddress14bit;
+        snapshot.fineX = horizontalScrollOrigin;
+        snapshot.limitSprites = limitSpritesPerScanline;
+        snapshot.reuseScanlines = reuseScanlines;
+        snapshot.settings = settings;
+        if (lineEvents.count > 0) {
+            pipeline->logLineEvents(lineEvents);
+        }
+        pipeline->logScanline(snapshot);
+        return;
+    }
+
+    // same inputs as last frame: the pixels and masks from then are still in the raster
+    ScanlineHistory &history = scanlineHistory[Y < 240 ? Y : 239];
+    uint64_t signature = 0;
+    bool dots = lineEvents.count > 0;
+    if (reuseScanlines && Y < 240 && !dots) {
+        signature = scanlineSignature(Y, line, numSprites);
+        if (history.valid && history.signature == signature) {
+            reusedScanlines++;
+            if (history.sprite0Hit && !sprite0HitInThisFrame) {
+                sprite0HitInThisScanline = true;
+            }
+            return;
+        }
+    }
 
     /**
-     * Render background tiles.
-     * 32 tiles per scanline
+     * Pass 1: background palette indices.
+     * 33 tiles per scanline, fine scrolling picks where the visible 256 pixels start.
      */
+    layers.backgroundVisible = settings.BackgroundVisible;
+    layers.fineX = horizontalScrollOrigin % 8;
 
     unsigned short int numTiles = 32; // 32 tiles per scanline
     unsigned short int numAttributes = 8; // 8 attributes per scanline (4 per tile)
 
-    if (settings.BackgroundVisible)
+    if (dots) {
+        renderBackgroundDots(Y);
+    } else if (prepareNametableCache(Y)) {
+        // the same 33 tiles as one run of the 512x480 image, see updateAddressWindows
+        int x = (nametableAddy & 0x400 ? 256 : 0) + tileScroll * 8;
+        int y = (nametableAddy & 0x800 ? 240 : 0) + Y;
+        nametableCache.copyRow(x, y, layers.background, (numTiles + 1) * 8);
+
+        for (int i = 0; i <= numTiles; i++) {
+            uint64_t indices;
+            memcpy(&indices, layers.background + i * 8, 8);
+            uint64_t opaque = opaqueLanes(indices) * 0xFF;
+            memcpy(layers.backgroundOpaque + i * 8, &opaque, 8);
+        }
+    } else if (settings.BackgroundVisible)
         for (unsigned short int i = 0; i <= numTiles; i++) {
-            auto nametable = nametableAddy;
             auto nametableAttributeOffset = nametableAddy + 0x3C0;
 
             if (i + tileScroll >= 32) {
                 // read from nametable on the right when doing horizontal scrolling
-                nametable += 0x400;
-                nametableAttributeOffset += 0x400;
+                nametableAttributeOffset ^= 0x400;
             }
 
-            auto tileIdx = ReadByteFromPPU(nametable + tileY * numTiles + (i + tileScroll) % 32);
+            tCPU::word patternAddress = backgroundRowAddress(Y, i);
 
             // each attribute block is 32x32 pixels
             // there are 8 attribute blocks per scanline
@@ -378,196 +558,364 @@ void PPU::renderScanline(const tCPU::word Y) {
                 upperBits = lowerRight;
 
             // render single row within the 8x8 pixel tile
-            // each pattern block is 16 bytes long: two sections of 8 bytes each
-            // each byte corresponds to 8 pixels. total: 2 bits per pixel
-            unsigned short int patternBytes = 16;
-            unsigned short int patternSize = 8;
-            unsigned short int patternOffset = settings.BackgroundPatternTableAddress + tileIdx * patternBytes;
-            auto patternByte0 = ReadByteFromPPU(patternOffset + tileRow);
-            auto patternByte1 = ReadByteFromPPU(patternOffset + tileRow + patternSize);
-
-            int startX = 0;
-            int endX = 8;
-
-            // fine scrolling works by trimming [0,7] pixels from the first tile
-            // ie only render last 3 pixels from tile 1 means succeeding tiles will be rendered at an offset
-            if (i == 0)
-                startX = horizontalScrollOrigin % 8;
-//        if (i == 31)
-//            endX = horizontalScrollOrigin % 8;
-
-            // no more inner loop branches! -20k cycles per scanline
-//        for (auto column = startX; column < endX; column++) {
-            for (int column = startX; column < endX; column++) {
-                auto xOffset = 7 - column;
+            uint64_t patternRow = fetchTileRow(patternAddress, false);
+            CodeDataLog::chr(patternAddress, CDL_CHR_RENDERED);
+            CodeDataLog::chr(patternAddress + 8, CDL_CHR_RENDERED);
+
+            // opaque pixels get the attribute bits on top of their 2-bit pattern value
+            const uint64_t lanes = 0x0101010101010101ULL;
+            uint64_t opaque = opaqueLanes(patternRow) * 0xFF;
+            uint64_t indices = patternRow | (opaque & (lanes * (upperBits << 2)));
+            memcpy(layers.background + i * 8, &indices, 8);
+            memcpy(layers.backgroundOpaque + i * 8, &opaque, 8);
+        }
 
-                // this pixel has two color bits from the pattern table available
-                tCPU::byte pixelBit0 = (patternByte0 >> xOffset) & 1;
-                tCPU::byte pixelBit1 = (patternByte1 >> xOffset) & 1;
+    /**
+     * Pass 2: sprite palette indices and the pixels where sprites win priority.
+     */
+    layers.clearSprites();
 
-                tCPU::byte lowerBits = pixelBit0 | (pixelBit1 << 1);
+    // iterate through the sprites found on this scanline during evaluation
+    if (settings.SpriteVisible && Y < 240)
+        for (auto n = 0; n < numSprites; n++) {
+            auto i = line.sprites[n] * 4;
+            auto attributes = SPR_RAM[i + 2];
+            auto spriteX = SPR_RAM[i + 3];
 
-                tCPU::byte paletteId = GetColorFromPalette(0, upperBits, lowerBits);
-                tPaletteEntry &color = colorPalette[paletteId];
+            bool horizontalFlip = Bit<6>::IsSet(attributes);
+            bool spriteBehindBG = Bit<5>::IsSet(attributes);
+            tCPU::byte colorUpperBits = Bits<0, 1>::Get(attributes);
 
-                // tile scroll debugging
-//            auto bgra = 0xFF << 24 | (Y) << 16 | (((i+tileScroll) % 32 * 8 + column)) << 8 | 0;
+            // render one row of the sprite
+            tCPU::word rowAddress = spriteRowAddress(i, Y);
+            uint64_t patternRow = fetchTileRow(rowAddress, horizontalFlip);
+            CodeDataLog::chr(rowAddress, CDL_CHR_RENDERED);
+            CodeDataLog::chr(rowAddress + 8, CDL_CHR_RENDERED);
 
-                // attribute scroll debug
-//            auto bgra = 0xFF << 24 | (attributeX * 32) << 16 | (attributeY * 32) << 8 | 0;
+            tCPU::byte pixels[8];
+            memcpy(pixels, &patternRow, sizeof(pixels));
 
-                // red = upper-bits
-                // green = lower-bits
-//            auto bgra = 0xFF << 24 | (upperBits * 64) << 16 | (lowerBits * 64) << 8 | 0;
+            for (int column = 0; column < 8; column++) {
+                // lower two bits
+                tCPU::byte colorLowerBits = pixels[column];
+                if (!colorLowerBits) {
+                    continue;
+                }
 
-//            auto bgra = 0xFF << 24 | (tileIdx) << 16;
+                // absolute position on output screen
+                auto screenX = spriteX + column;
 
-                // update final color output
-                *(backgroundRender++) = color.ColorValue;
+                if (i == 0) {
+                    layers.sprite0Opaque[screenX] = 0xFF;
+                }
 
-                // update mask
-                *(backgroundMask++) = lowerBits * 64;
+                // later sprites draw over earlier ones; behind-background sprites only show
+                // through visible transparent background not already covered by a sprite
+                bool hidden = spriteBehindBG && (!layers.backgroundVisible
+                                                 || layers.background[layers.fineX + screenX] == PALETTE_INDEX_CLEARED
+                                                 || layers.backgroundOpaque[layers.fineX + screenX]
+                                                 || layers.spriteOpaque[screenX]);
+                if (!hidden) {
+                    layers.sprite[screenX] = 0x10 | colorUpperBits << 2 | colorLowerBits;
+                    layers.spriteOpaque[screenX] = 0xFF;
+                }
             }
         }
 
-    // now we have to jump around memory to fetch the palette ids
-    // its 1.5x faster doing it here than in the loop above :>
+    /**
+     * Pass 3: blend, look up colors, sprite-0 hit.
+     */
+    tCPU::byte *backgroundMask = raster->backgroundMask != nullptr ? raster->backgroundMask + Y * 256 : nullptr;
+    tCPU::byte *spriteMask = raster->spriteMask != nullptr ? raster->spriteMask + Y * 256 : nullptr;
+    bool sprite0Hit = ScanlineCompositor::composite(layers, paletteIndices, raster->screenBuffer + Y * 256,
+                                                    backgroundMask, spriteMask);
+    raster->emphasis[Y] = settings.ColorEmphasis;
+    if (sprite0Hit && !sprite0HitInThisFrame) {
+        sprite0HitInThisScanline = true;
+    }
 
-    // do it backwards to make bitblts more native
+    history.signature = signature;
+    history.valid = reuseScanlines && Y < 240 && !dots;
+    history.sprite0Hit = sprite0Hit;
+}
 
-    //tCPU::byte* spriteRamStream = SPR_RAM;
-//    tCPU::dword *spriteRamStream32bit = (tCPU::dword *) SPR_RAM;
+/**
+ * FNV-1a over everything renderScanline reads: registers, the nametable and attribute rows,
+ * the palette, the sprites on the line and the CHR generation (bumped on CHR-RAM writes and bank switches)
+ */
+static inline uint64_t hashBytes(uint64_t hash, const void *data, size_t length) {
+    const tCPU::byte *bytes = (const tCPU::byte *) data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
 
-    // 64 possible sprites, can only draw 8 of them per scanline
-    int numSpritesDrawn = 0;
+uint64_t
+PPU::scanlineSignature(const tCPU::word Y, const SpriteLine &line, int numSprites) {
+    struct {
+        tCPU::word nameTable, backgroundPatterns, spritePatterns;
+        tCPU::byte tileScroll, fineX, spriteSize, mirroring, emphasis;
+        bool backgroundVisible, spriteVisible;
+        tCPU::dword chrGeneration;
+    } registers;
+
+    // padding is hashed too
+    memset(&registers, 0, sizeof(registers));
+
+    registers.nameTable = settings.NameTableAddress;
+    registers.backgroundPatterns = settings.BackgroundPatternTableAddress;
+    registers.spritePatterns = settings.SpritePatternTableAddress;
+    registers.tileScroll = vramAddress14bit & 0x1F;
+    registers.fineX = horizontalScrollOrigin % 8;
+    registers.spriteSize = settings.SpriteSize;
+    registers.mirroring = settings.mirroring;
+    registers.emphasis = settings.ColorEmphasis;
+    registers.backgroundVisible = settings.BackgroundVisible;
+    registers.spriteVisible = settings.SpriteVisible;
+    registers.chrGeneration = tileCache.getGeneration();
+
+    uint64_t hash = hashBytes(0xCBF29CE484222325ULL, &registers, sizeof(registers));
+    hash = hashBytes(hash, paletteIndices, sizeof(paletteIndices));
+
+    if (settings.BackgroundVisible) {
+        // the scanline reads one tile row and one attribute row from this nametable and its right neighbour;
+        // mirroring maps whole 1KiB pages, so each row is contiguous in PPU_RAM
+        int tileY = Y / 8;
+        for (int page = 0; page < 2; page++) {
+            tCPU::word nametable = settings.NameTableAddress ^ (page * 0x400);
+            hash = hashBytes(hash, PPU_RAM + GetEffectiveAddress(nametable + tileY * 32), 32);
+            hash = hashBytes(hash, PPU_RAM + GetEffectiveAddress(nametable + 0x3C0 + (tileY / 4) * 8), 8);
+        }
+    }
 
-    // iterate through all sprites and find ones that need to be rendered on this scanline
-    if (settings.SpriteVisible)
-        for (auto i = 0; i < 256; i += 4) {
-            auto spriteY = SPR_RAM[i] + 1;
+    if (settings.SpriteVisible) {
+        for (int n = 0; n < numSprites; n++) {
+            tCPU::byte index = line.sprites[n];
+            hash = hashBytes(hash, &index, 1);
+            hash = hashBytes(hash, SPR_RAM + index * 4, 4);
+        }
+    }
 
-            if (spriteY == 249) {    // sprite wants to be ignored
-                continue;
-            }
+    return hash;
+}
 
-            auto tileIdx = SPR_RAM[i + 1];
-            auto attributes = SPR_RAM[i + 2];
+/**
+ * Register writes between dots 1 and 256 change scroll or visibility part way through the pixels
+ * renderScanline draws at once at hblank. The registers are saved at the first one, so the dot renderer
+ * can start the line from where the hardware did. Logged on render-less frames too, sprite-0 hits
+ * depend on them.
+ *
+ * $2002 reads only reset the write toggles: one before the first write is already in the saved
+ * registers, later ones are logged so the writes after them replay right, and none of them alone
+ * sends a line down the dot path.
+ */
+void
+PPU::logLineEvent(tCPU::word port, tCPU::byte value) {
+    if (!dotRendering || currentScanline >= 240 || scanlinePixel < 1 || scanlinePixel > 256) {
+        return;
+    }
+    if (port == 0x2002 && lineEvents.count == 0) {
+        return;
+    }
 
-            auto spriteRow = (Y - spriteY) % 8;
+    if (lineEvents.count == 0) {
+        lineEvents.vramAddress = vramAddress14bit;
+        lineEvents.tempVRAMAddress = tempVRAMAddress;
+        lineEvents.fineX = horizontalScrollOrigin;
+        lineEvents.firstWrite2005 = firstWriteToSFF;
+        lineEvents.firstWrite2006 = firstWriteToSFF2;
+        lineEvents.nameTableAddress = settings.NameTableAddress;
+        lineEvents.backgroundPatterns = settings.BackgroundPatternTableAddress;
+        lineEvents.backgroundVisible = settings.BackgroundVisible;
+        lineEvents.spriteVisible = settings.SpriteVisible;
+    }
 
-            bool renderLargeSprites = settings.SpriteSize == SPRITE_SIZE_8x16;
+    if (lineEvents.count < LineEvents::MAX_EVENTS) {
+        lineEvents.events[lineEvents.count++] = {(tCPU::word) scanlinePixel, port, value};
+    }
+}
 
-            // handle 8x16 sprites
-            auto patternTable = settings.SpritePatternTableAddress;
-            if (renderLargeSprites) {
-                // 8x16 sprites
-                if (spriteY > Y || (spriteY + 16) <= Y) {    // current scanline does not overlap the sprite
-                    continue;
-                }
+/**
+ * Background of a scanline with logged register accesses, dot by dot.
+ *
+ * Loopy's v/t/x registers and the write toggles replay the accesses at their dots. A tile is fetched
+ * from v every 8 dots (the first two at the end of the previous line) and coarse X steps after each,
+ * pixels are picked through fine x as the shift registers would. v starts out on the row the scanline
+ * path draws, so only what the accesses change differs from it. Sprites are not affected.
+ * Leaves the 256 visible pixels in layers.background from fineX 0, PALETTE_INDEX_CLEARED on dots where
+ * the background was off.
+ */
+void
+PPU::renderBackgroundDots(const tCPU::word Y) {
+    const LineEvents &line = lineEvents;
+
+    tCPU::word v = (line.vramAddress & 0x001F) | (line.nameTableAddress & 0x0C00) | ((Y / 8) << 5) | ((Y % 8) << 12);
+    tCPU::word t = line.tempVRAMAddress;
+    tCPU::byte x = line.fineX;
+    bool firstWrite2005 = line.firstWrite2005, firstWrite2006 = line.firstWrite2006;
+    tCPU::word patternTable = line.backgroundPatterns;
+    bool backgroundVisible = line.backgroundVisible, spriteVisible = line.spriteVisible;
+
+    // tiles in fetch order, 8 palette indices each
+    const uint64_t lanes = 0x0101010101010101ULL;
+    uint64_t tiles[34];
+    auto fetch = [&](int slot) {
+        tCPU::word nametable = 0x2000 | (v & 0x0FFF);
+        tCPU::word attribute = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+        uint64_t upperBits = (ReadByteFromPPU(attribute) >> (((v >> 4) & 4) | (v & 2))) & 3;
+
+        tCPU::word patternAddress = patternTable + ReadByteFromPPU(nametable) * 16 + ((v >> 12) & 7);
+        uint64_t patternRow = fetchTileRow(patternAddress, false);
+        CodeDataLog::chr(patternAddress, CDL_CHR_RENDERED);
+        CodeDataLog::chr(patternAddress + 8, CDL_CHR_RENDERED);
+
+        uint64_t opaque = opaqueLanes(patternRow) * 0xFF;
+        tiles[slot] = patternRow | (opaque & (lanes * (upperBits << 2)));
+    };
+    auto incrementX = [&]() {
+        if ((v & 0x001F) == 31) {
+            v = (v & ~0x001F) ^ 0x0400;
+        } else {
+            v++;
+        }
+    };
 
-                // lsb of tile index determines which pattern table to use
-                if ((tileIdx & 1) == 0) {
-                    patternTable = settings.BackgroundPatternTableAddress;
+    // same register semantics as the port handlers, on the copies
+    auto apply = [&](const LineEvent &event) {
+        tCPU::byte value = event.value;
+        switch (event.port) {
+            case 0x2000:
+                t = (t & 0xF3FF) | (value & 0x03) << 10;
+                patternTable = value & 0x10 ? 0x1000 : 0x0000;
+                break;
+            case 0x2001:
+                backgroundVisible = value & 0x08;
+                spriteVisible = value & 0x10;
+                break;
+            case 0x2002:
+                firstWrite2005 = firstWrite2006 = true;
+                break;
+            case 0x2005:
+                if (firstWrite2005) {
+                    x = value & 0x07;
+                    t = (t & 0xFFE0) | value >> 3;
+                } else {
+                    t = (t & 0x8FFF) | (value & 0x07) << 12;
+                    t = (t & 0xFC1F) | (value & 0xF8) << 2;
                 }
-
-                // are we inside first 8x8 tile of the 8x16 sprite?
-                if ((spriteY + 8) > Y) {
-                    // adjust tile number
-                    tileIdx--;
+                firstWrite2005 = !firstWrite2005;
+                break;
+            case 0x2006:
+                if (firstWrite2006) {
+                    t = (t & 0x80FF) | (value & 0x3F) << 8;
+                } else {
+                    t = (t & 0xFF00) | value;
+                    v = t;
                 }
+                firstWrite2006 = !firstWrite2006;
+                break;
+        }
+    };
 
-            } else {
-                // 8x8 sprites
-                if (spriteY > Y || (spriteY + 8) <= Y) {    // current scanline does not overlap the sprite
-                    continue;
-                }
-            }
+    bool rendering = backgroundVisible || spriteVisible;
+    tiles[0] = tiles[1] = 0;
+    if (rendering) {
+        fetch(0);
+        incrementX();
+        fetch(1);
+        incrementX();
+    }
 
-            auto spriteX = SPR_RAM[i + 3];
+    layers.backgroundVisible = false;
+    int event = 0, slot = 2;
+    for (int dot = 1; dot <= 256; dot++) {
+        while (event < line.count && line.events[event].dot <= dot) {
+            apply(line.events[event++]);
+        }
+        rendering = backgroundVisible || spriteVisible;
 
-            if (spriteY > 238 || spriteX > 248) {
-                // not so properly ignored
-                continue;
+        // nametable fetch on the first dot of every 8, coarse X steps on the last
+        if (dot % 8 == 1) {
+            tiles[slot] = 0;
+            if (rendering) {
+                fetch(slot);
             }
+            slot++;
+        }
+        if (dot % 8 == 0 && rendering) {
+            incrementX();
+        }
 
-//        PrintInfo("Y=%d tile=0x%X SpriteX=%d and SpriteY=%d", Y, tileIdx, spriteX, spriteY);
-
-            numSpritesDrawn++;
-
-            bool verticalFlip = Bit<7>::IsSet(attributes);
-            bool horizontalFlip = Bit<6>::IsSet(attributes);
-            bool spriteBehindBG = Bit<5>::IsSet(attributes);
-            tCPU::byte colorUpperBits = Bits<0, 1>::Get(attributes);
-
-            // render one row of the sprite
+        // dots with the background off show the clear color, not the backdrop, even when it comes on later
+        int tap = dot - 1 + x;
+        tCPU::byte index = PALETTE_INDEX_CLEARED;
+        if (backgroundVisible) {
+            index = (tiles[tap / 8] >> (tap % 8 * 8)) & 0xFF;
+            layers.backgroundVisible = true;
+        }
+        layers.background[dot - 1] = index;
+        layers.backgroundOpaque[dot - 1] = index & 3 ? 0xFF : 0;
+    }
 
-            auto spriteHeight = renderLargeSprites ? 15 : 7;
-            auto patternY = verticalFlip ? (spriteHeight - spriteRow) : spriteRow;
+    layers.fineX = 0;
+    memset(layers.background + 256, 0, sizeof(layers.background) - 256);
+    memset(layers.backgroundOpaque + 256, 0, sizeof(layers.backgroundOpaque) - 256);
+}
 
-            int spriteOffset = patternTable + tileIdx * 16;
-            tCPU::byte patternByte0 = ReadByteFromPPU(spriteOffset + patternY);
-            tCPU::byte patternByte1 = ReadByteFromPPU(spriteOffset + patternY + 8);
+/**
+ * Sort every sprite into the visible scanlines it covers.
+ * Runs lazily before the next scanline after OAM or sprite size changed, instead of
+ * scanning all 64 OAM entries on each of the 240 scanlines.
+ */
+void
+PPU::evaluateSprites() {
+    for (auto &line : spriteLines) {
+        line.count = 0;
+    }
 
-            for (int column = 0; column < 8; column++) {
-                auto patternColumn = horizontalFlip ? (column) : (7 - column);
-                tCPU::byte pixelBit0 = (patternByte0 >> patternColumn) & 1;
-                tCPU::byte pixelBit1 = (patternByte1 >> patternColumn) & 1;
+    int spriteHeight = settings.SpriteSize == SPRITE_SIZE_8x16 ? 16 : 8;
 
-                // lower two bits
-                tCPU::byte colorLowerBits = pixelBit0 | (pixelBit1 << 1);
+    for (auto n = 0; n < 64; n++) {
+        auto spriteY = SPR_RAM[n * 4] + 1;
+        auto spriteX = SPR_RAM[n * 4 + 3];
 
-                tCPU::byte paletteId = GetColorFromPalette(1, colorUpperBits, colorLowerBits);
+        // y = 249 hides a sprite, the rest are not so properly ignored
+        if (spriteY == 249 || spriteY > 238 || spriteX > 248) {
+            continue;
+        }
 
-                // absolute position on output screen
-                auto screenX = spriteX + column;
+        for (auto y = spriteY; y < spriteY + spriteHeight && y < 240; y++) {
+            SpriteLine &line = spriteLines[y];
+            line.sprites[line.count++] = n;
+        }
+    }
 
-                if ((!spriteBehindBG || raster->backgroundMask[Y * 256 + screenX] == 0) && colorLowerBits) {
-                    tPaletteEntry &color = colorPalette[paletteId];
+    spriteLinesDirty = false;
+}
 
-                    // write final color output
-                    ((int *) raster->screenBuffer)[Y * 256 + screenX] = color.ColorValue;
-                    // write mask
-                    raster->spriteMask[Y * 256 + screenX] = colorLowerBits * 64;
-                    raster->backgroundMask[Y * 256 + screenX] += 0xf0;
-                }
+/**
+ * Resolve the 32 palette entries to NES color indices, and to final colors under the current emphasis.
+ * Transparent entries (lower bits zero) show the universal background color at $3F00.
+ */
+void
+PPU::refreshPalette() {
+    for (int i = 0; i < 32; i++) {
+        tCPU::byte paletteId = PPU_RAM[GetEffectiveAddress(0x3F00 | ((i & 3) ? i : 0))] & 0x3F;
 
-                // test sprite-0 hit detection against background mask
-                if (!sprite0HitInThisFrame && !sprite0HitInThisScanline && i == 0) {
-                    // if we got a sprite0 color pixel over a non-transparent background pixel
-                    // a transparent pixel has lower two bits = 0 (should do 'bg & 0x3')
-                    if ((raster->backgroundMask[Y * 256 + screenX]) != 0 && colorLowerBits != 0) {
-                        sprite0HitInThisScanline = true;
-//                    PrintInfo("Sprite-0 collision detected");
-                    }
-                }
-            }
+        // grayscale keeps only the brightness column of the master palette
+        if (settings.DisplayTypeMonochrome) {
+            paletteId &= 0x30;
         }
 
-    if (numSpritesDrawn >= 8) {
-        //PrintPpu("sprite overflow!" );
-        statusRegister |= Bit<5>::Set(true);
+        paletteIndices[i] = paletteId;
     }
-}
-
-// palettetype: 0 = background, 1 = sprites
-tCPU::byte
-PPU::GetColorFromPalette(int paletteType, int upperBits, int lowerBits) {
-    tCPU::byte Color = 0;
 
-    if (lowerBits == 0) {
-        // specifically for super mario brothers
-        return ReadByteFromPPU(0x3F00);
-    }
+    paletteIndices[PALETTE_INDEX_CLEARED] = COLOR_INDEX_CLEARED;
 
-    // address is 5 bits long
-    if (lowerBits <= 3) {
-        Color = ReadByteFromPPU(0x3F00 | paletteType << 4 | upperBits << 2 | lowerBits);
-    } else {
-        PrintError("PPU::GetColorFromPalette(%d, %d); Invalid Color Id", upperBits, lowerBits);
-        throw std::runtime_error("Unexpected error");
+    for (int i = 0; i <= PALETTE_INDEX_CLEARED; i++) {
+        resolvedPalette[i] = PaletteExpander::color(settings.ColorEmphasis, paletteIndices[i]);
     }
-
-    return Color;
 }
 
 tCPU::byte
@@ -577,6 +925,7 @@ PPU::getControlRegister1() {
 
 void
 PPU::setControlRegister1(tCPU::byte value) {
+    logLineEvent(0x2000, value);
     std::bitset<8> bits(value);
     controlRegister1 = value;
 
@@ -587,10 +936,16 @@ PPU::setControlRegister1(tCPU::byte value) {
 
     // increment vram address (on port $2007 activity) by 1 (horizontal) or 32 (vertical) bytes
     settings.DoVerticalWrites = bits.test(2);
-    settings.SpritePatternTableAddress = bits.test(3) ? 0x1000 : 0x0000;
+    tCPU::word spritePatternTable = bits.test(3) ? 0x1000 : 0x0000;
+    enumSpriteSize spriteSize = bits.test(5) ? SPRITE_SIZE_8x16 : SPRITE_SIZE_8x8;
+    if (spriteSize != settings.SpriteSize || spritePatternTable != settings.SpritePatternTableAddress) {
+        spriteLinesDirty = true;
+    }
+
+    settings.SpritePatternTableAddress = spritePatternTable;
     settings.BackgroundPatternTableAddress = bits.test(4) ? 0x1000 : 0x0000;
 
-    settings.SpriteSize = bits.test(5) ? SPRITE_SIZE_8x16 : SPRITE_SIZE_8x8;
+    settings.SpriteSize = spriteSize;
 
 //    PrintInfo("settings.SpriteSize = 8x16 = %d", settings.SpriteSize);
 
@@ -610,13 +965,23 @@ PPU::setControlRegister1(tCPU::byte value) {
 
 void
 PPU::setControlRegister2(tCPU::byte value) {
+    logLineEvent(0x2001, value);
     std::bitset<8> bits(value);
 
-    settings.DisplayTypeMonochrome = bits.test(0);
+    bool monochrome = bits.test(0);
+    tCPU::byte emphasis = value >> 5;
+    bool paletteChanged = monochrome != settings.DisplayTypeMonochrome || emphasis != settings.ColorEmphasis;
+
+    settings.DisplayTypeMonochrome = monochrome;
+    settings.ColorEmphasis = emphasis;
     settings.BackgroundClipping = bits.test(1);
     settings.SpriteClipping = bits.test(2);
     settings.BackgroundVisible = bits.test(3);
     settings.SpriteVisible = bits.test(4);
+
+    if (paletteChanged) {
+        refreshPalette();
+    }
 }
 
 /**
@@ -626,6 +991,7 @@ PPU::setControlRegister2(tCPU::byte value) {
  */
 void
 PPU::setVRamAddressRegister2(tCPU::byte value) {
+    logLineEvent(0x2006, value);
     if (firstWriteToSFF2) {
         // first write -- high byte
         latchedVRAMByte = value;
@@ -658,6 +1024,8 @@ tCPU::byte
 PPU::readFromVRam() {
     tCPU::byte value;
 
+    CodeDataLog::chr(vramAddress14bit & 0x3FFF, CDL_CHR_READ);
+
     if (vramAddress14bit % 0x4000 <= 0x3EFF) {    // latch value, return old
         value = latchedVRAMByte;
         latchedVRAMByte = ReadByteFromPPU(vramAddress14bit);
@@ -678,114 +1046,232 @@ PPU::writeToVRam(tCPU::byte value) {
     AutoIncrementVRAMAddress();
 }
 
-tCPU::word
-PPU::GetEffectiveAddress(tCPU::word address) {
-    if (address < 0x2000) {
-        // pattern table chr-rom page
+const tCPU::word PPU::PaletteAddress[32] = {
+        0x3F00, 0x3F01, 0x3F02, 0x3F03, 0x3F04, 0x3F05, 0x3F06, 0x3F07,
+        0x3F08, 0x3F09, 0x3F0A, 0x3F0B, 0x3F0C, 0x3F0D, 0x3F0E, 0x3F0F,
+        // 3F10h,3F14h,3F18h,3F1Ch mirror 3F00h,3F04h,3F08h,3F0Ch
+        0x3F00, 0x3F11, 0x3F12, 0x3F13, 0x3F04, 0x3F15, 0x3F16, 0x3F17,
+        0x3F08, 0x3F19, 0x3F1A, 0x3F1B, 0x3F0C, 0x3F1D, 0x3F1E, 0x3F1F
+};
 
-        // use a memory mapper if one is available
-        if (mapper != nullptr) {
-            address = mapper->getEffectivePPUAddress(address);
-        }
+/**
+ * Decode table for PPU address space, one entry per 1KiB window:
+ *
+ *   $0000-$1FFF  pattern tables, placed by the mapper (CNROM banks live above $8000 in PPU_RAM)
+ *   $2000-$2FFF  four nametable slots, pointed at the physical nametables by mirroring
+ *   $3000-$3EFF  mirror of the nametable slots
+ *   $3F00-$3FFF  palette, decoded separately through PaletteAddress
+ *
+ *        (0,0)     (256,0)     (511,0)
+ *          +-----------+-----------+
+ *          |           |           |
+ *          |   $2000   |   $2400   |
+ *          |     #0    |     #1    |
+ *          |           |           |
+ *   (0,240)+-----------+-----------+(511,240)
+ *          |           |           |
+ *          |   $2800   |   $2C00   |
+ *          |     #2    |     #3    |
+ *          |           |           |
+ *          +-----------+-----------+
+ *        (0,479)   (256,479)   (511,479)
+ */
+void
+PPU::updateAddressWindows() {
+    for (int window = 0; window < 8; window++) {
+        tCPU::word address = window * 0x400;
+        addressWindows[window] = mapper != nullptr ? mapper->getEffectivePPUAddress(address) : address;
+    }
 
-//        PrintInfo("Address is < 0x2000; Referencing CHR-ROM @ $%04X", address);
+    // physical nametable behind each slot
+    int slots[4];
+    switch (settings.mirroring) {
+        case VERTICAL_MIRRORING:
+            slots[0] = 0, slots[1] = 1, slots[2] = 0, slots[3] = 1;
+            break;
+        case HORIZONTAL_MIRRORING:
+            slots[0] = 0, slots[1] = 0, slots[2] = 2, slots[3] = 2;
+            break;
+        case SINGLE_SCREEN_LOWER:
+            slots[0] = slots[1] = slots[2] = slots[3] = 0;
+            break;
+        case SINGLE_SCREEN_UPPER:
+            slots[0] = slots[1] = slots[2] = slots[3] = 1;
+            break;
+        default:
+            // four-screen, the cartridge provides the other 2KiB
+            slots[0] = 0, slots[1] = 1, slots[2] = 2, slots[3] = 3;
+            break;
+    }
 
-        return address;
+    for (int slot = 0; slot < 4; slot++) {
+        tCPU::word nametable = 0x2000 + slots[slot] * 0x400;
+        if (addressWindows[8 + slot] != nametable) {
+            nametableCache.invalidateAll();
+        }
+        addressWindows[8 + slot] = nametable;
+        addressWindows[12 + slot] = nametable;
+    }
 
+    if (pipeline != nullptr) {
+        pipeline->logAddressWindows(addressWindows);
     }
+}
 
-    // PPU
-//    if (address >= 0x2008 && address <= 0x3FFF) {
-//        // mirror [$2000,$2007] on repeat
-//        auto mirrored = address - 0x2008 % 8;
-//        PrintInfo("Address in range: (0x2008-0x3FFF); Mirror of $%04X", mirrored);
-//    }
+tCPU::byte
+PPU::ReadByteFromPPU(tCPU::word Address) {
+    tCPU::word EffectiveAddress = GetEffectiveAddress(Address);
+    tCPU::byte Value = PPU_RAM[EffectiveAddress];
+    Heatmap::ppu(Address, HEATMAP_READ);
+    tCPU::word WatchAddress = getWatchAddress(Address);
+    if (watchedPages[WatchAddress >> 8] & WATCH_READ) {
+        watchpoints->check(WATCH_BUS_PPU, WATCH_READ, WatchAddress, Value);
+    }
+//    PrintPpu("Read 0x%02X from PPU RAM @ 0x%04X", (int) Value, (int) EffectiveAddress);
+    return Value;
+}
 
-    if (address >= 0x2000 && address < 0x3000) {
-        /*
-         *        (0,0)     (256,0)     (511,0)
-         *          +-----------+-----------+
-         *          |           |           |
-         *          |           |           |
-         *          |   $2000   |   $2400   |
-         *          |     #0    |     #1    |
-         *          |           |           |
-         *   (0,240)+-----------+-----------+(511,240)
-         *          |           |           |
-         *          |           |           |
-         *          |   $2800   |   $2C00   |
-         *          |     #2    |     #3    |
-         *          |           |           |
-         *          +-----------+-----------+
-         *        (0,479)   (256,479)   (511,479)
-         */
-        int nametableId = floor((address - 0x2000) / 0x400);
-        int offset = address % 0x400;
-
-        // nametables mirroring
-        if (settings.mirroring == VERTICAL_MIRRORING) {
-            if (nametableId == 2)
-                nametableId = 0;
-            if (nametableId == 3)
-                nametableId = 1;
+/**
+ * Pattern row fetch for the renderer: decode the whole tile through the mapper on a miss,
+ * afterwards it is a single lookup until CHR-RAM or the CHR banks change.
+ */
+uint64_t
+PPU::fetchTileRow(tCPU::word address, bool flipped) {
+    int tile = (address >> 4) & 0x1FF;
+
+    if (!tileCache.isValid(tile)) {
+        tCPU::byte planes[16];
+        for (int i = 0; i < 16; i++) {
+            planes[i] = PPU_RAM[GetEffectiveAddress(tile * 16 + i)];
         }
+        tileCache.decode(tile, planes);
+    }
 
-        if (settings.mirroring == HORIZONTAL_MIRRORING) {
-            if (nametableId == 1)
-                nametableId = 0;
-            if (nametableId == 3)
-                nametableId = 2;
-        }
+    Heatmap::ppu(address, HEATMAP_READ);
+    tCPU::word watchAddress = getWatchAddress(address);
+    if (watchedPages[watchAddress >> 8] & WATCH_READ) {
+        // a row is two reads, the low plane and the high plane 8 bytes on
+        watchpoints->check(WATCH_BUS_PPU, WATCH_READ, watchAddress, PPU_RAM[GetEffectiveAddress(address)]);
+        watchpoints->check(WATCH_BUS_PPU, WATCH_READ, watchAddress + 8, PPU_RAM[GetEffectiveAddress(address + 8)]);
+    }
 
-        address = nametableId * 0x400 + 0x2000 + offset;
+    return tileCache.row(address, flipped);
+}
 
-//        PrintInfo("Mirrored 0x%X to 0x%X (nametableId=%d)", address, mirrored, nametableId);
-//        address = mirrored;
+void
+PPU::patternsChanged(tCPU::word address, int length) {
+    tileCache.invalidate(address, length);
+    nametableCache.invalidatePatterns(address, length);
+}
+
+void
+PPU::nametablesChanged(tCPU::dword start, tCPU::dword end) {
+    for (int slot = 0; slot < 4; slot++) {
+        tCPU::dword base = addressWindows[8 + slot];
+        tCPU::dword from = start > base ? start : base;
+        tCPU::dword to = end < base + 0x400 ? end : base + 0x400;
+        if (from < to) {
+            nametableCache.invalidateNametable(slot, from - base, to - from);
+        }
     }
+}
 
-    if (address >= 0x3000 && address <= 0x3EFF) {
-        // mirror of 2000h-2EFFh
-        auto mirror = address - 0x1000;
-//        PrintInfo("Address in range: (0x3000-0x3EFF); Mirror of $%04X", mirror);
-        address = mirror;
+void
+PPU::refreshNametableCache() {
+    tCPU::word patternTable = settings.BackgroundPatternTableAddress;
+    if (nametableCache.isCurrent(patternTable)) {
+        return;
     }
 
-    if (address >= 0x3F20 && address <= 0x3FFF) {
-        // 7 mirrors of 3F00h-3F1Fh :(
-//        PrintInfo("Hit 7 Mirror Address: 0x%X", (int) address);
-        address -= ((address - 0x3F20) % 0x1F) * 0x1F;
-//        PrintInfo("-> Resolved it to: 0x%X", (int) address);
+    // redrawn cells read decoded rows directly, decode whatever of the table is missing first
+    for (int tile = patternTable >> 4; tile < (patternTable >> 4) + 256; tile++) {
+        if (!tileCache.isValid(tile)) {
+            tCPU::byte planes[16];
+            for (int i = 0; i < 16; i++) {
+                planes[i] = PPU_RAM[GetEffectiveAddress(tile * 16 + i)];
+            }
+            tileCache.decode(tile, planes);
+        }
     }
 
-    // mirrors 3F10h,3F14h,3F18h,3F1Ch -> 3F00h,3F04h,3F08h,3F0Ch
-    // FIXME: im not sure if these mirrors are ranges or just single byte entries
-    if (address == 0x3F10 || address == 0x3F14 || address == 0x3F18 || address == 0x3F1C)
-        address -= 0x10;
+    const tCPU::byte *nametables[4];
+    for (int slot = 0; slot < 4; slot++) {
+        nametables[slot] = PPU_RAM + addressWindows[8 + slot];
+    }
+    nametableCache.update(nametables, patternTable, tileCache);
+}
 
-    if (address >= 0x3F00 && address <= 0x3F1F) {
-//        PrintDbg("address $%04X is a BG/Sprite Palette!", address);
+/**
+ * Decides per frame whether backgrounds come out of the nametable cache. Heatmap, code/data log and PPU
+ * read watchpoints need every fetch, so they keep the tile path. A pattern or layout change after the
+ * first scanline is a raster effect (CHR bank split, mirroring switch): the rest of the frame and the
+ * next one fetch tiles, the cache would otherwise be redrawn mid-frame over and over.
+ * Nametable writes between scanlines only redraw their cells.
+ */
+bool
+PPU::prepareNametableCache(const tCPU::word Y) {
+    if (Y >= 240) {
+        return false;
     }
 
-    if (address >= 0x4000) {
-//        PrintInfo("Address in range: (0x4000-0x10000); Mirror of $%04X? (FIXME: writing through)", address % 0x4000);
-//        address = address % 0x4000;
+    if (Y <= lastCacheScanline) {
+        // first drawn scanline of a frame
+        bool watched = false;
+        for (int page = 0; page < 0x30; page++) {
+            watched |= (watchedPages[page] & WATCH_READ) != 0;
+        }
+
+        nametableCacheFrame = useNametableCache && !HEATMAP_ENABLED && !CDL_ENABLED && !watched && !rasterEffects;
+        rasterEffects = false;
+        frameLayoutGeneration = nametableCache.getLayoutGeneration();
+        framePatternTable = settings.BackgroundPatternTableAddress;
+    } else if (frameLayoutGeneration != nametableCache.getLayoutGeneration()
+               || framePatternTable != settings.BackgroundPatternTableAddress) {
+        rasterEffects = true;
+        nametableCacheFrame = false;
     }
+    lastCacheScanline = Y;
 
-    return address;
+    if (!nametableCacheFrame || !settings.BackgroundVisible) {
+        return false;
+    }
+    refreshNametableCache();
+    return true;
 }
 
-tCPU::byte
-PPU::ReadByteFromPPU(tCPU::word Address) {
-    tCPU::word EffectiveAddress = GetEffectiveAddress(Address);
-    tCPU::byte Value = PPU_RAM[EffectiveAddress];
-//    PrintPpu("Read 0x%02X from PPU RAM @ 0x%04X", (int) Value, (int) EffectiveAddress);
-    return Value;
+/**
+ * Pattern bytes behind [address, address + length) for the renderer thread, window by window
+ */
+void
+PPU::logPatternMemory(tCPU::word address, int length) {
+    for (int window = address >> 10; window < 8 && window * 0x400 < address + length; window++) {
+        tCPU::word from = window * 0x400 > address ? window * 0x400 : address;
+        tCPU::word to = (window + 1) * 0x400 < address + length ? (window + 1) * 0x400 : address + length;
+        tCPU::word offset = addressWindows[window] + (from & 0x3FF);
+        pipeline->logMemory(offset, PPU_RAM + offset, to - from);
+    }
 }
 
 bool
 PPU::WriteByteToPPU(tCPU::word Address, tCPU::byte Value) {
     tCPU::word EffectiveAddress = GetEffectiveAddress(Address);
     PPU_RAM[EffectiveAddress] = Value;
+    if (Address < 0x2000) {
+        // chr-ram write, decoded tile is stale
+        patternsChanged(Address, 1);
+    } else if (EffectiveAddress >= 0x2000 && EffectiveAddress < 0x3000) {
+        nametablesChanged(EffectiveAddress, EffectiveAddress + 1);
+    } else if (EffectiveAddress >= 0x3F00 && EffectiveAddress < 0x4000) {
+        refreshPalette();
+    }
+    if (pipeline != nullptr) {
+        pipeline->logMemory(EffectiveAddress, PPU_RAM + EffectiveAddress, 1);
+    }
+    Heatmap::ppu(Address, HEATMAP_WRITE);
+    tCPU::word WatchAddress = getWatchAddress(Address);
+    if (watchedPages[WatchAddress >> 8] & WATCH_WRITE) {
+        watchpoints->check(WATCH_BUS_PPU, WATCH_WRITE, WatchAddress, Value);
+    }
 
     if (Address >= 0x8000) {
         PrintInfo("Wrote 0x%02X to PPU RAM @ 0x%04X (0x%04X)", Value, EffectiveAddress, Address);
@@ -806,6 +1292,7 @@ PPU::AutoIncrementVRAMAddress() {
 // https://wiki.nesdev.com/w/index.php/PPU_scrolling
 void
 PPU::setVRamAddressRegister1(tCPU::byte value) {
+    logLineEvent(0x2005, value);
 //    PrintInfo("value = %d and scanline = %d hblank = %d", value, currentScanline, inHBlank);
 //    if (currentScanline < 240) {
 //        if (!inHBlank) {
@@ -859,6 +1346,10 @@ PPU::writeSpriteMemory(tCPU::byte value) {
     } else {
         PrintDbg("Write byte $%02X to Sprite RAM @ $%02X", (int) value, (int) spriteRamAddress);
         SPR_RAM[spriteRamAddress] = value;
+        spriteLinesDirty = true;
+        if (pipeline != nullptr) {
+            pipeline->logSpriteMemory(spriteRamAddress, SPR_RAM + spriteRamAddress, 1);
+        }
     }
 
     // address incremented after every write
@@ -871,562 +1362,87 @@ tCPU::byte PPU::readSpriteMemory() {
     return value;
 }
 
+/**
+ * Sprite DMA, page is gathered by the DMA unit
+ */
 void
-PPU::StartSpriteXferDMA(Memory *memory, tCPU::byte address) {
-    tCPU::word startAddress = address * 0x100;
-    PrintDbg("DMA Transfer from RAM @ $%04X to SPR-RAM (scanline: %d, pixel: %d)", (int) startAddress, currentScanline, scanlinePixel);
+PPU::StartSpriteXferDMA(const tCPU::byte *page) {
+    PrintDbg("DMA Transfer to SPR-RAM (scanline: %d, pixel: %d)", currentScanline, scanlinePixel);
 
-    for (tCPU::word i = 0; i < 256; i++) {
-        SPR_RAM[i] = memory->readByte(startAddress + i);
+    memcpy(SPR_RAM, page, 256);
+    spriteLinesDirty = true;
+    if (pipeline != nullptr) {
+        pipeline->logSpriteMemory(0, SPR_RAM, 256);
     }
 
 //    vramAddress14bit = 0;
 }
 
-#ifdef _WIN32
-void memset_pattern4(void* p_destination, const void* p_pattern, size_t p_count) {
-	for (size_t i = 0; i < (p_count / 4); i++) {
-		memcpy((( char*) p_destination) + (i * 4), p_pattern, 4);
-	}
-}
-#endif
-
-void PPU::clear() {
-    // clear final output (256x256@32bit)
-    uint32_t clearPattern = 0xff333333;
-    memset_pattern4(raster->screenBuffer, &clearPattern, 256 * 256 * 4);
-
-    // clear pattern table debug view (128x256@32bit)
-    memset_pattern4(raster->patternTable, &clearPattern, 128 * 256 * 4);
-
-    // clear palette table debug view (256x32@32bit)
-    memset_pattern4(raster->palette, &clearPattern, 256 * 32 * 4);
-
-    // clear sprite mask debug view (256x256@16bit)
-    memset(raster->spriteMask, 128, 256 * 256 * 2);
-
-    // clear background mask debug view (256x256@16bit)
-    memset(raster->backgroundMask, 128, 256 * 256 * 2);
-}
-
-void PPU::renderDebug() {
-    auto now = std::chrono::high_resolution_clock::now();
-//    RenderBackgroundTiles();
-//    RenderSpriteTiles();
-
-    RenderDebugNametables();
-    RenderDebugAttributes(settings.NameTableAddress);
-    RenderDebugPatternTables();
-    RenderDebugColorPalette();
-
-    auto span = std::chrono::high_resolution_clock::now() - now;
-    PrintDbg("Preparing Debug Data took %d msec", std::chrono::duration_cast<std::chrono::milliseconds>(span));
-}
-
-/**
- * Render sprites onto final output
- *
- * 64 sprites (4 bytes each)
- */
-void PPU::RenderSpriteTiles() {
-    for (auto i = 0; i < 64; i++) {
-        auto addr = i * 4;
-        auto y = SPR_RAM[addr] - 1;
-        auto tileNumber = SPR_RAM[addr + 1];
-        auto attributes = SPR_RAM[addr + 2];
-        auto x = SPR_RAM[addr + 3];
-
-        auto upperBits = Bits<1, 2>::Get(attributes);
-
-        // render 8x8 block
-
-        int offsetY = y * 256 * 4;
-        int offsetX = x * 4;
-
-        if (y >= 239 || y < 0) {
-            continue;
-        }
-
-//        PrintInfo("%d: x/y = %d,%d: flip bits horizontal=%x vertical=%x", i, x, y, Bit<6>::QuickIsSet(attributes), Bit<7>::QuickIsSet(attributes));
-
-        auto flipH = Bit<6>::QuickIsSet(attributes);
-
-        // TODO: handle 8x16 sprites
-        auto tileIdx = tileNumber;
-        auto patternTable = settings.SpritePatternTableAddress;
-        if (settings.SpriteSize == SPRITE_SIZE_8x16) {
-            if ((tileNumber & 1) == 0) {
-                patternTable = settings.BackgroundPatternTableAddress;
-            }
-
-            tileIdx--;
-        }
-
-        // row
-        for (auto k = 0; k < 8; k++) {
-            tCPU::byte PatternByte0 = PPU_RAM[patternTable + tileIdx * 16 + k];
-            tCPU::byte PatternByte1 = PPU_RAM[patternTable + tileIdx * 16 + k + 8];
-
-            // column
-            for (auto l = 0; l < 8; l++) {
-                int pixelBit0 = PatternByte0 & (1 << l) ? 255 : 0;
-                int pixelBit1 = PatternByte1 & (1 << l) ? 255 : 0;
-                tCPU::byte lowerBits = (pixelBit0 ? 1 : 0) + (pixelBit1 ? 2 : 0);
-                tCPU::byte paletteId = GetColorFromPalette(1, upperBits, lowerBits);
-
-                if (lowerBits == 0) {
-                    continue;
-                }
-
-                tPaletteEntry &color = colorPalette[paletteId];
-
-                int offsetBlockY = offsetY + offsetX + k * 256 * 4;
-                int offsetBytes = offsetBlockY + (flipH ? l : (7 - l)) * 4;
-
-                // write 4 bytes BGRA
-                raster->screenBuffer[offsetBytes + 0] = color.B; // b
-                raster->screenBuffer[offsetBytes + 1] = color.G; // g
-                raster->screenBuffer[offsetBytes + 2] = color.R; // r
-                raster->screenBuffer[offsetBytes + 3] = color.A; // alpha
-            }
-        }
-
-        if (settings.SpriteSize == SPRITE_SIZE_8x16) {
-            if ((tileNumber & 1) == 0) {
-                patternTable = settings.BackgroundPatternTableAddress;
-            } else {
-                patternTable = settings.SpritePatternTableAddress;
-            }
-            tileIdx++;
-
-            int offsetY = (y + 8) * 256 * 4;
-            for (auto k = 0; k < 8; k++) {
-                tCPU::byte PatternByte0 = PPU_RAM[patternTable + tileIdx * 16 + k];
-                tCPU::byte PatternByte1 = PPU_RAM[patternTable + tileIdx * 16 + k + 8];
-
-                // column
-                for (auto l = 0; l < 8; l++) {
-                    int pixelBit0 = PatternByte0 & (1 << l) ? 255 : 0;
-                    int pixelBit1 = PatternByte1 & (1 << l) ? 255 : 0;
-                    tCPU::byte lowerBits = (pixelBit0 ? 1 : 0) + (pixelBit1 ? 2 : 0);
-                    tCPU::byte paletteId = GetColorFromPalette(1, upperBits, lowerBits);
-
-                    if (lowerBits == 0) {
-                        continue;
-                    }
-
-                    tPaletteEntry &color = colorPalette[paletteId];
-
-                    int offsetBlockY = offsetY + offsetX + k * 256 * 4;
-                    int offsetBytes = offsetBlockY + (flipH ? l : (7 - l)) * 4;
-
-                    // write 4 bytes BGRA
-                    raster->screenBuffer[offsetBytes + 0] = color.B; // b
-                    raster->screenBuffer[offsetBytes + 1] = color.G; // g
-                    raster->screenBuffer[offsetBytes + 2] = color.R; // r
-                    raster->screenBuffer[offsetBytes + 3] = color.A; // alpha
-                }
-            }
-        }
-    }
-}
-
-/**
- * Render background tiles onto final output
- */
-void PPU::RenderBackgroundTiles() {
-    tCPU::word NametableAddress = settings.NameTableAddress;
-//    int NametableId = (NametableAddress - 0x2000) / 0x400;
-//
-//    if (horizontalScrollOrigin >= 255) {
-//        if (NametableId == 0)
-//            NametableAddress += 0x400;
-//        else
-//            NametableAddress -= 0x400;
-//
-//        NametableId = (NametableAddress - 0x2000) / 0x400;
-//    }
-//
-
-//    for (unsigned int i = 0; i < 32; i++) {
-//        PrintInfo("%d = %X", i, PPU_RAM[0x3F00 + i]);
-//    }
-
-    auto tileScrollOffset = 0;// vramAddress14bit & 0x0FFF;
-    auto attrScrollOffset = 0;//(vramAddress14bit & 0x0C00) | ((vramAddress14bit >> 4) & 0x38) | ((vramAddress14bit >> 2) & 0x07);
-
-    // rows (240 pixels vertically)
-    for (unsigned int i = 0; i < 30; i++) {
-        // columns (256 pixels horizontally)
-        for (unsigned int j = 0; j < 32; j++) {
-            // 8x8 tile number
-            // first 960 bytes contain tiles
-            tCPU::byte tileNumber = PPU_RAM[NametableAddress + tileScrollOffset + i * 32 + j];
-            int offsetY = i * 8 * 256 * 4;
-            int offsetX = j * 8 * 4;
-
-            auto AttrI = (int) floor(j / 4.0);
-            auto AttrJ = (int) floor(i / 4.0);
-
-            // after tiles, we have two scanlines for attributes
-            tCPU::byte attribute = PPU_RAM[NametableAddress + attrScrollOffset + 0x3C0 + AttrJ * 8 + AttrI];
-
-            int offsetI = (j / 2) % 2;
-            int offsetJ = (i / 2) % 2;
-
-            tCPU::byte upperLeft = Bits<0, 1>::Get(attribute);
-            tCPU::byte upperRight = Bits<2, 3>::Get(attribute);
-            tCPU::byte lowerLeft = Bits<4, 5>::Get(attribute);
-            tCPU::byte lowerRight = Bits<6, 7>::Get(attribute);
-
-            // grab attributes for the tile
-            tCPU::byte upperBits;
-
-            if (!offsetI && !offsetJ)
-                upperBits = upperLeft;
-            else if (offsetI && !offsetJ)
-                upperBits = upperRight;
-            else if (!offsetI && offsetJ)
-                upperBits = lowerLeft;
-            else
-                upperBits = lowerRight;
-
-            // render 8x8 block
-
-            // row
-            for (unsigned short k = 0; k < 8; k++) {
-                tCPU::byte PatternByte0 = PPU_RAM[settings.BackgroundPatternTableAddress + tileNumber * 16 + k];
-                tCPU::byte PatternByte1 = PPU_RAM[settings.BackgroundPatternTableAddress + tileNumber * 16 + k + 8];
-
-                // column
-                for (short l = 0; l < 8; l++) {
-                    int pixelBit0 = PatternByte0 & (1 << l) ? 255 : 0;
-                    int pixelBit1 = PatternByte1 & (1 << l) ? 255 : 0;
-                    tCPU::byte lowerBits = (pixelBit0 ? 1 : 0) + (pixelBit1 ? 2 : 0);
-                    tCPU::byte paletteId = GetColorFromPalette(0, upperBits, lowerBits);
-
-                    tPaletteEntry &color = colorPalette[paletteId];
-
-                    int offsetBlockY = offsetY + offsetX + k * 256 * 4;
-                    int offsetBytes = offsetBlockY + (7 - l) * 4;
-
-                    raster->backgroundMask[offsetBytes / 4] = lowerBits ? 0x90 : 0x00;
-
-                    // write 4 bytes BGRA
-                    raster->screenBuffer[offsetBytes + 0] = color.B; // b
-                    raster->screenBuffer[offsetBytes + 1] = color.G; // g
-                    raster->screenBuffer[offsetBytes + 2] = color.R; // r
-                    raster->screenBuffer[offsetBytes + 3] = 0xff; // alpha
-                }
-            }
-        }
+void
+PPU::loadRom(Cartridge &rom) {
+    for (uint8_t i = 0; i < rom.header.numChrPages; i++) {
+        writeChrPage(i, rom.characterDataPages[i].buffer);
     }
-}
 
-void PPU::RenderDebugPatternTables() {// render two pattern tables
-    // pattern table 0 = 0x0000 - 0x0FFF
-    // pattern table 1 = 0x1000 - 0x1FFF
-
-    // pattern table pitch
-    unsigned int srcPitch = 16;
-
-    // render target pitch
-    unsigned int dstPitch = 128;
-
-    // each pattern table:
-    // has 256 tiles, 16x16
-    // each tile is 8x8 pixels
-    // each pixel has two bits for four colors
-    // renders into 128x128 target
-
-    int base = 0x0000;
-
-    // rows
-    for (auto i = 0; i < 32; i++) {
-        // columns
-        for (auto j = 0; j < 16; j++) {
-            // draw as 8x8 blocks
-            auto src = (i * srcPitch + j) * 16;
-            auto dst = (i * dstPitch + j) * 8;
-
-            // rows
-            for (auto k = 0; k < 8; k++) {
-                // 16 bytes per 8x8 tile
-                // 8 rows, each row takes two bytes
-                // each pixel in the byte is a color bit for a column
-                auto rowSrc = src + k;
-                auto pattern1 = ReadByteFromPPU(base + rowSrc + 0);
-                auto pattern2 = ReadByteFromPPU(base + rowSrc + 8);
-
-                // columns
-                for (auto l = 0; l < 8; l++) {
-                    auto pixel1 = pattern1 >> (7 - l) & 1;
-                    auto pixel2 = pattern2 >> (7 - l) & 1;
-                    auto color = pixel1 | (pixel2 << 1);
-
-                    tCPU::byte paletteId = GetColorFromPalette(0, 0, color);
-                    tPaletteEntry &rgbColor = colorPalette[paletteId];
-
-                    auto pixelAddr = dst + k * dstPitch + l;
-                    raster->patternTable[pixelAddr * 4 + 0] = rgbColor.B; // b
-                    raster->patternTable[pixelAddr * 4 + 1] = rgbColor.G; // g
-                    raster->patternTable[pixelAddr * 4 + 2] = rgbColor.R; // r
-                    raster->patternTable[pixelAddr * 4 + 3] = 0xff; // alpha
-                }
-            }
-        }
-    }
+    settings.mirroring = rom.info.mirroring;
+    updateAddressWindows();
 }
 
-/*
- * Render attributes
- *
- * 64 bytes for attributes
- * 8x8 attributes table, 1 byte per attribute
- * each attribute covers 32x32 pixels
- * each attribute covers 2x2 super-tiles (16x16 pixels) with 2 color bits
- * each super-tile covers 2x2 set of tiles (8x8 pixels each)
- * thus each attribute tile is made up of 4x4 pattern tiles
+/**
+ * Write 8kB chr-rom pages to PPU memory
+ * Populates the pattern tables. MMC roms can bank switch from here.
  */
-void PPU::RenderDebugAttributes(tCPU::word NametableAddress) {
-    // clear attribute table debug view (128x128@32bit)
-    for (int x = 0; x < 128; x++) {
-        for (int y = 0; y < 128; y++) {
-            raster->attributeTable[y * 128 * 4 + x * 4 + 0] = 0x33; // b
-            raster->attributeTable[y * 128 * 4 + x * 4 + 1] = 0x33; // g
-            raster->attributeTable[y * 128 * 4 + x * 4 + 2] = 0x33; // r
-            raster->attributeTable[y * 128 * 4 + x * 4 + 3] = 0xff; // alpha
-        }
-    }
-
-    auto attrScrollOffset = 0;//(vramAddress14bit & 0x0C00) | ((vramAddress14bit >> 4) & 0x38) | ((vramAddress14bit >> 2) & 0x07);
-
-    // rows
-    for (int i = 0; i < 8; i++) {
-        // columns
-        for (int j = 0; j < 8; j++) {
-            // 32x32 tile attributes, 2 bits for each 16x16 sub-tile (which in effect is 4 pattern tiles)
-            tCPU::byte attribute = PPU_RAM[NametableAddress + attrScrollOffset + 0x3C0 + i * 8 + j];
-
-            tCPU::byte upperLeft = Bits<0, 1>::Get(attribute);
-            tCPU::byte upperRight = Bits<2, 3>::Get(attribute);
-            tCPU::byte lowerLeft = Bits<4, 5>::Get(attribute);
-            tCPU::byte lowerRight = Bits<6, 7>::Get(attribute);
-
-            // destination is a 256x256 grid
-            unsigned int dstAddr = (i * 256 + j) * 32;
-            tCPU::byte color = 0;
-
-            // render four 16x16 blocks
-            for (unsigned int b = 0; b < 2; b++) {
-                for (unsigned int c = 0; c < 2; c++) {
-                    unsigned int blockAddr = dstAddr + (b * 256 + c) * 16;
-
-                    if (!b && !c)
-                        color = upperLeft;
-                    else if (b && !c)
-                        color = upperRight;
-                    else if (!b && c)
-                        color = lowerLeft;
-                    else
-                        color = lowerRight;
-
-                    // row
-                    for (unsigned int k = 0; k < 16; k++) {
-                        // column
-                        for (unsigned int l = 0; l < 16; l++) {
-                            unsigned int pixelAddr = (blockAddr + k * 256 + l) * 4;
-
-                            raster->attributeTable[pixelAddr + 0] = color * 64; // b
-                            raster->attributeTable[pixelAddr + 1] = color * 64; // g
-                            raster->attributeTable[pixelAddr + 2] = color * 64; // r
-                            raster->attributeTable[pixelAddr + 3] = 0xff; // alpha
-                        }
-                    }
-
-                }
-            }
-        }
+void
+PPU::writeChrPage(uint16_t page, uint8_t buffer[]) {
+    memcpy(PPU_RAM, buffer, CHR_ROM_PAGE_SIZE);
+    patternsChanged(0, CHR_ROM_PAGE_SIZE);
+    if (pipeline != nullptr) {
+        pipeline->logMemory(0, PPU_RAM, CHR_ROM_PAGE_SIZE);
     }
 }
 
-void PPU::RenderDebugColorPalette() {// render color palette
-    // colors
-    for (auto nametableId = 0; nametableId < 4; nametableId++) {
-        for (auto p = 0; p < 32; p++) {
-
-            auto size = 8;
-            auto paletteType = 0; // 0 = background, 1 = sprite
-            auto paletteId = ReadByteFromPPU(0x3F00 + paletteType * 16 + p + nametableId * 4);
-            auto pitch = 256;
-            auto dst = nametableId * pitch * size + p * size;
-
-            tPaletteEntry &color = colorPalette[paletteId];
-
-            // draw as 8x8 blocks
-            // rows
-            for (auto y = 0; y < size; y++) {
-                // columns
-                for (auto x = 0; x < size; x++) {
-                    auto pixelAddr = dst + y * pitch + x;
-
-                    raster->palette[pixelAddr * 4 + 0] = color.B; // b
-                    raster->palette[pixelAddr * 4 + 1] = color.G; // g
-                    raster->palette[pixelAddr * 4 + 2] = color.R; // r
-                    raster->palette[pixelAddr * 4 + 3] = 0xff; // alpha
-                }
-            }
-        }
-    }
+void
+PPU::useMemoryMapper(MemoryMapper *mapper) {
+    this->mapper = mapper;
+    updateAddressWindows();
 }
 
 /**
- * Render all nametables for whole world view
- *
- * Four nametables (2x2) each one 1024 bytes:
- * 960 bytes for tile indices + 64 bytes for attributes
+ * Copy what the debug views draw from, see DebugViews
  */
-void PPU::RenderDebugNametables() {
-    // clear nametable debug view (512x512@32bit)
-    uint32_t clearPattern = 0xff333333;
-    memset_pattern4(raster->nametables, &clearPattern, 512 * 512 * 4);
-
-    uint32_t *nametables = (uint32_t *) raster->nametables;
-
-    // two rows of nametables
-    for (auto a = 0; a < 2; a++) {
-        // two columns of nametables
-        for (auto b = 0; b < 2; b++) {
-            // each nametable:
-
-            // rows (240 pixels vertically)
-            for (unsigned int i = 0; i < 30; i++) {
-                // columns (256 pixels horizontally)
-                for (unsigned int j = 0; j < 32; j++) {
-                    // 8x8 tile number
-                    // first 960 bytes contain tiles
-
-                    auto nametableAddress = 0x2000 + a * 2048 + b * 1024;
-
-                    tCPU::byte tileNumber = PPU_RAM[nametableAddress + i * 32 + j];
-
-                    auto AttrI = (int) floor(j / 4.0);
-                    auto AttrJ = (int) floor(i / 4.0);
-
-                    // after tiles, we have two scanlines for attributes
-                    tCPU::byte attribute = PPU_RAM[nametableAddress + 0x3C0 + AttrJ * 8 + AttrI];
-
-                    int offsetI = (j / 2) % 2;
-                    int offsetJ = (i / 2) % 2;
-
-                    tCPU::byte upperLeft = Bits<0, 1>::Get(attribute);
-                    tCPU::byte upperRight = Bits<2, 3>::Get(attribute);
-                    tCPU::byte lowerLeft = Bits<4, 5>::Get(attribute);
-                    tCPU::byte lowerRight = Bits<6, 7>::Get(attribute);
-
-                    // grab attributes for the tile
-                    tCPU::byte upperBits;
-
-                    if (!offsetI && !offsetJ)
-                        upperBits = upperLeft;
-                    else if (offsetI && !offsetJ)
-                        upperBits = upperRight;
-                    else if (!offsetI && offsetJ)
-                        upperBits = lowerLeft;
-                    else
-                        upperBits = lowerRight;
-
-                    // render 8x8 block
-                    int offsetY = (i * 8 * 512) + a * 8 * 512 * 32;
-                    int offsetX = (j * 8) + b * 8 * 32;
-
-                    // row
-                    for (unsigned short k = 0; k < 8; k++) {
-                        // lookup row byte pattern
-                        tCPU::byte PatternByte0 = ReadByteFromPPU(settings.BackgroundPatternTableAddress + tileNumber * 16 + k);
-                        tCPU::byte PatternByte1 = ReadByteFromPPU(settings.BackgroundPatternTableAddress + tileNumber * 16 + k + 8);
-
-                        // column
-                        for (short l = 0; l < 8; l++) {
-                            int pixelBit0 = PatternByte0 & (1 << l) ? 255 : 0;
-                            int pixelBit1 = PatternByte1 & (1 << l) ? 255 : 0;
-                            tCPU::byte lowerBits = (pixelBit0 ? 1 : 0) + (pixelBit1 ? 2 : 0);
-                            tCPU::byte paletteId = GetColorFromPalette(0, upperBits, lowerBits);
-
-                            tPaletteEntry &color = colorPalette[paletteId];
-
-                            auto offsetBlockY = offsetY + offsetX + k * 512;
-                            auto offsetWords = offsetBlockY + (7 - l);
-
-                            // write 4 bytes BGRA
-                            // offset into correct quadrant
-                            nametables[offsetWords] = color.ColorValue;
-                        }
-                    }
-                }
-            }
-        }
+void
+PPU::captureDebugSnapshot(DebugSnapshot &snapshot) {
+    for (int window = 0; window < 8; window++) {
+        memcpy(snapshot.patterns + window * 0x400, PPU_RAM + addressWindows[window], 0x400);
     }
+    memcpy(snapshot.nametables, PPU_RAM + 0x2000, 0x1000);
 
-    // render viewport scrolling
-    unsigned short int tileScroll = vramAddress14bit & 0x0FFF;
-    unsigned short int tileScrollPixels = tileScroll * 8;
-    unsigned short int nametableOffsetX = ((settings.NameTableAddress - 0x2000) / 0x400) * 256;
-    unsigned short int horizontalScrollPixels = nametableOffsetX + horizontalScrollOrigin + tileScrollPixels;
-
-    // rows
-    for (auto i = 0; i < 256; i++) {
-        // left vertical line
-        auto offsetBytes = (i * 512 + (horizontalScrollPixels) % 512) * 4;
-        raster->nametables[offsetBytes + 0] = 0xff; // b
-        raster->nametables[offsetBytes + 1] = 0xff; // g
-        raster->nametables[offsetBytes + 2] = 0xff; // r
-        raster->nametables[offsetBytes + 3] = 0xff; // alpha
-
-        // right vertical line
-        offsetBytes = (i * 512 + (horizontalScrollPixels + 255) % 512) * 4;
-        raster->nametables[offsetBytes + 0] = 0xff; // b
-        raster->nametables[offsetBytes + 1] = 0xff; // g
-        raster->nametables[offsetBytes + 2] = 0xff; // r
-        raster->nametables[offsetBytes + 3] = 0xff; // alpha
-
-        // top line
-        offsetBytes = ((i + horizontalScrollPixels) % 512) * 4;
-        raster->nametables[offsetBytes + 0] = 0xff; // b
-        raster->nametables[offsetBytes + 1] = 0xff; // g
-        raster->nametables[offsetBytes + 2] = 0xff; // r
-        raster->nametables[offsetBytes + 3] = 0xff; // alpha
-
-        // bottom line
-        offsetBytes = (255 * 512 + (i + horizontalScrollPixels) % 512) * 4;
-        raster->nametables[offsetBytes + 0] = 0xff; // b
-        raster->nametables[offsetBytes + 1] = 0xff; // g
-        raster->nametables[offsetBytes + 2] = 0xff; // r
-        raster->nametables[offsetBytes + 3] = 0xff; // alpha
-    }
-}
+    refreshNametableCache();
+    memcpy(snapshot.nametableImage, nametableCache.getPixels(), sizeof(snapshot.nametableImage));
 
-void
-PPU::loadRom(Cartridge &rom) {
-    for (uint8_t i = 0; i < rom.header.numChrPages; i++) {
-        writeChrPage(i, rom.characterDataPages[i].buffer);
+    for (int i = 0; i < 32; i++) {
+        snapshot.paletteColors[i] = PaletteExpander::color(0, PPU_RAM[PaletteAddress[i]] & 0x3F);
     }
+    memcpy(snapshot.colors, resolvedPalette, sizeof(resolvedPalette));
 
-    settings.mirroring = rom.info.mirroring;
+    snapshot.backgroundPatternTable = settings.BackgroundPatternTableAddress;
+    snapshot.nameTableAddress = settings.NameTableAddress;
+    snapshot.vramAddress = vramAddress14bit;
+    snapshot.fineX = horizontalScrollOrigin;
 }
 
-/**
- * Write 8kB chr-rom pages to PPU memory
- * Populates the pattern tables. MMC roms can bank switch from here.
- */
 void
-PPU::writeChrPage(uint16_t page, uint8_t buffer[]) {
-    memcpy(PPU_RAM, buffer, CHR_ROM_PAGE_SIZE);
+PPU::usePipeline(RenderPipeline *pipeline) {
+    this->pipeline = pipeline;
+
+    pipeline->logAddressWindows(addressWindows);
+    pipeline->logMemory(0, PPU_RAM, 0x10000);
+    pipeline->logSpriteMemory(0, SPR_RAM, 256);
 }
 
 void
-PPU::useMemoryMapper(MemoryMapper *mapper) {
-    this->mapper = mapper;
-
+PPU::useWatchpoints(Watchpoints *watchpoints) {
+    this->watchpoints = watchpoints;
+    this->watchedPages = watchpoints->getPageTable(WATCH_BUS_PPU);
 }
 
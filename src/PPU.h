@@ -3,8 +3,16 @@
 #include "Platform.h"
 #include "Cartridge.h"
 #include "MemoryMapper.h"
+#include "Watchpoints.h"
+#include "TileCache.h"
+#include "NametableCache.h"
+#include "ScanlineCompositor.h"
+#include "PaletteExpander.h"
+#include <cstring>
 
 class Memory;
+class RenderPipeline;
+struct DebugSnapshot;
 
 enum enumSpriteSize {
     SPRITE_SIZE_8x16 = 1, SPRITE_SIZE_8x8 = 0
@@ -35,27 +43,51 @@ struct PPU_Settings {
     /**
      * control register 2
      */
-    bool DisplayTypeMonochrome;
+    bool DisplayTypeMonochrome = false;
     // dont show left 8 pixels
     bool BackgroundClipping;
     // invisible in left 8 pixel column
     bool SpriteClipping;
     bool BackgroundVisible = false;
     bool SpriteVisible = false;
-    eMirroringType mirroring;
+    // bits 5-7 of control register 2: emphasize red, green, blue
+    tCPU::byte ColorEmphasis = 0;
+    eMirroringType mirroring = HORIZONTAL_MIRRORING;
 };
 
+// debug views in the raster, flagged in Raster::changedViews when redrawn
+enum RasterView {
+    VIEW_PATTERN_TABLE = 1, VIEW_ATTRIBUTES = 2, VIEW_PALETTE = 4, VIEW_NAMETABLES = 8, VIEW_HEATMAP = 16
+};
+
+/**
+ * Output frame plus the debug surfaces the viewers draw from.
+ * Debug surfaces stay nullptr until the window showing them is opened; producers skip them until then.
+ */
 class Raster {
 public:
     Raster() {
-        screenBuffer = new tCPU::byte[256 * 256 * 4];
+        screenBuffer = new tCPU::byte[256 * 240];
+        memset(screenBuffer, COLOR_INDEX_CLEARED, 256 * 240);
+    }
+
+    // PPU debugger: pattern, attribute, palette and nametable views, layer masks, heatmap
+    void createPpuDebugSurfaces() {
         palette = new tCPU::byte[256 * 32 * 4];
         patternTable = new tCPU::byte[128 * 256 * 4];
         attributeTable = new tCPU::byte[256 * 256 * 4];
+        nametables = new tCPU::byte[512 * 512 * 4];
+        heatmap = new tCPU::byte[256 * 256 * 4]();
+
+        // 256x256 NV12: the renderer writes luma rows 0-239, the rest stays neutral grey
         backgroundMask = new tCPU::byte[256 * 256 * 2];
         spriteMask = new tCPU::byte[256 * 256 * 2];
-        nametables = new tCPU::byte[512 * 512 * 4];
+        memset(backgroundMask, 128, 256 * 256 * 2);
+        memset(spriteMask, 128, 256 * 256 * 2);
+    }
 
+    // APU debugger: spectrum and waveform per channel
+    void createApuDebugSurfaces() {
         square1FFT = new tCPU::byte[512 * 64 * 4];
         square1Waveform = new tCPU::byte[1024 * 64 * 4];
 
@@ -69,27 +101,89 @@ public:
         noiseWaveform = new tCPU::byte[1024 * 64 * 4];
     }
 
+    // 256x240 NES color indices (0-63, COLOR_INDEX_CLEARED for the clear color), every visible pixel
+    // is written each rendered frame; PaletteExpander or the GUI's shader turns them into colors
     tCPU::byte *screenBuffer;
-    tCPU::byte *palette;
-    tCPU::byte *patternTable;
-    tCPU::byte *attributeTable;
-    tCPU::byte *backgroundMask;
-    tCPU::byte *spriteMask;
-    tCPU::byte *nametables;
-
-    tCPU::byte *square1FFT, *square1Waveform;
-    tCPU::byte *square2FFT, *square2Waveform;
-    tCPU::byte *triangleFFT, *triangleWaveform;
-    tCPU::byte *noiseFFT, *noiseWaveform;
+
+    // color emphasis bits (red, green, blue) each scanline was drawn with
+    tCPU::byte emphasis[240] = {};
+
+    tCPU::byte *palette = nullptr;
+    tCPU::byte *patternTable = nullptr;
+    tCPU::byte *attributeTable = nullptr;
+    tCPU::byte *backgroundMask = nullptr;
+    tCPU::byte *spriteMask = nullptr;
+    tCPU::byte *nametables = nullptr;
+    tCPU::byte *heatmap = nullptr;
+
+    // RasterView bits redrawn since the GUI last uploaded them
+    int changedViews = 0;
+
+    tCPU::byte *square1FFT = nullptr, *square1Waveform = nullptr;
+    tCPU::byte *square2FFT = nullptr, *square2Waveform = nullptr;
+    tCPU::byte *triangleFFT = nullptr, *triangleWaveform = nullptr;
+    tCPU::byte *noiseFFT = nullptr, *noiseWaveform = nullptr;
 };
 
-enum MemoryMappers {
-    MEMORY_MAPPER_NROM = 0,
-    MEMORY_MAPPER_UNROM = 2,
-    MEMORY_MAPPER_CNROM = 3,
+/**
+ * OAM indices of the sprites covering one visible scanline, in OAM order
+ */
+struct SpriteLine {
+    // every overlapping sprite, may exceed the hardware limit of 8
+    tCPU::byte count;
+    tCPU::byte sprites[64];
+};
+
+/**
+ * A register access inside the visible part of a scanline: $2000, $2001, $2005 and $2006 writes,
+ * and $2002 reads after the first of them
+ */
+struct LineEvent {
+    tCPU::word dot;
+    tCPU::word port;
+    tCPU::byte value;
+};
+
+/**
+ * Scroll registers as they were when a scanline's first visible write came in, and the accesses in order.
+ * Scanlines with any are drawn dot by dot, see PPU::renderBackgroundDots.
+ */
+struct LineEvents {
+    static const int MAX_EVENTS = 32;
+
+    tCPU::word vramAddress;
+    tCPU::word tempVRAMAddress;
+    tCPU::byte fineX;
+    bool firstWrite2005, firstWrite2006;
+    tCPU::word nameTableAddress;
+    tCPU::word backgroundPatterns;
+    bool backgroundVisible, spriteVisible;
+
+    int count;
+    LineEvent events[MAX_EVENTS];
+};
+
+/**
+ * Visible scanlines drawn by each renderer since power on
+ */
+struct ScanlinePaths {
+    uint64_t fast = 0;
+    uint64_t dot = 0;
+};
+
+/**
+ * What a visible scanline was last rendered from
+ */
+struct ScanlineHistory {
+    uint64_t signature;
+    bool valid;
+    bool sprite0Hit;
 };
 
 class PPU {
+    // replays logged state into the renderer thread's PPU
+    friend class RenderPipeline;
+
 public:
     PPU(Raster *);
 
@@ -97,13 +191,12 @@ public:
 
     void writeChrPage(uint16_t page, uint8_t buffer[]);
 
-    void clear();
-
     void execute(int numCycles);
 
     tCPU::byte getStatusRegister();
 
-    void renderDebug();
+    // debug view inputs: pattern tables, nametables, palette and scroll
+    void captureDebugSnapshot(DebugSnapshot &snapshot);
 
     bool enteredVBlank() {
 //        return currentScanline == 243 && scanlinePixel == 0;
@@ -112,15 +205,6 @@ public:
         return wasInVBlank;
     }
 
-    /**
-     * CPU pulls NMI line and resets it in the process.
-     */
-    bool pullNMI() {
-        bool nmi = vblankNmiAwaiting;
-        vblankNmiAwaiting = false;
-        return nmi;
-    }
-
     void setControlRegister1(tCPU::byte value);
 
     void setControlRegister2(tCPU::byte value);
@@ -133,8 +217,21 @@ public:
 
     tCPU::byte readFromVRam();
 
-    // calculate memory address in PPU ram, taking into account mirroring
-    tCPU::word GetEffectiveAddress(tCPU::word address);
+    // calculate memory address in PPU ram, taking into account mirroring and CHR banks
+    tCPU::word GetEffectiveAddress(tCPU::word address) {
+        address &= 0x3FFF;
+        if (address >= 0x3F00) {
+            return PaletteAddress[address & 0x1F];
+        }
+        return addressWindows[address >> 10] + (address & 0x3FF);
+    }
+
+    // address watchpoints match against: pattern tables as addressed, nametable and palette mirrors
+    // folded onto the memory they reach, like the CPU side folds its mirrors
+    tCPU::word getWatchAddress(tCPU::word address) {
+        address &= 0x3FFF;
+        return address < 0x2000 ? address : GetEffectiveAddress(address);
+    }
 
     tCPU::byte ReadByteFromPPU(tCPU::word Address);
 
@@ -150,7 +247,7 @@ public:
 
     tCPU::byte readSpriteMemory();
 
-    void StartSpriteXferDMA(Memory *memory, tCPU::byte address);
+    void StartSpriteXferDMA(const tCPU::byte *page);
 
     tCPU::byte *getPpuRam() {
         return PPU_RAM;
@@ -158,6 +255,96 @@ public:
 
     void useMemoryMapper(MemoryMapper *mapper);
 
+    void useWatchpoints(Watchpoints *watchpoints);
+
+    // mappers with mirroring control (MMC3) switch nametable layout at runtime
+    void setMirroring(eMirroringType mirroring) {
+        if (settings.mirroring != mirroring) {
+            settings.mirroring = mirroring;
+            updateAddressWindows();
+        }
+    }
+
+    // rebuild the 1KiB address decode table after mirroring or a CHR bank base changed
+    void updateAddressWindows();
+
+    // draw at most 8 sprites per scanline like the hardware (flickers), off by default
+    void setSpriteLimit(bool enabled) {
+        limitSpritesPerScanline = enabled;
+    }
+
+    /**
+     * Draw the next frame or only run it: timing, flags, VRAM/OAM and sprite-0 hit behave the same
+     * either way, so callers can draw e.g. every 4th frame. Takes effect at the next pre-render line.
+     */
+    void setFrameRendering(bool enabled) {
+        renderNextFrame = enabled;
+    }
+
+    // the frame that just finished was drawn into the raster
+    bool isFrameRendered() {
+        return renderingFrame;
+    }
+
+    // skip scanlines whose inputs match the previous frame, on by default
+    void setScanlineReuse(bool enabled) {
+        reuseScanlines = enabled;
+    }
+
+    // scanlines of the last completed frame that were reused instead of rendered
+    int getReusedScanlines() {
+        return reusedScanlinesLastFrame;
+    }
+
+    /**
+     * Overclocking: idle scanlines between vblank and the pre-render line. The CPU keeps running through
+     * them while the PPU holds still, so slow game logic gets more time per frame without the picture
+     * or its timing changing. 0 is stock timing, changes take effect from the next vblank.
+     */
+    void setExtraScanlines(int lines) {
+        extraScanlines = lines < 0 ? 0 : lines;
+    }
+
+    int getExtraScanlines() {
+        return extraScanlines;
+    }
+
+    // inside the extra scanlines; the APU should not advance either, or audio pitch rises
+    bool isOverclocking() {
+        return currentScanline >= 261 && currentScanline < 261 + frameExtraScanlines;
+    }
+
+    // later after the start of vblank than a frame without extra scanlines lasts
+    bool isPastStockFrame();
+
+    // draw scanlines with mid-line scroll or mask writes dot by dot, on by default
+    void setDotRendering(bool enabled) {
+        dotRendering = enabled;
+    }
+
+    ScanlinePaths getScanlinePaths() {
+        return scanlinePaths;
+    }
+
+    // draw background scanlines as copies out of the pre-rendered nametables, on by default
+    void setNametableCache(bool enabled) {
+        useNametableCache = enabled;
+    }
+
+    // pattern memory at [address, address + length) changed under the renderer (CHR bank switch)
+    void invalidateTiles(tCPU::word address, int length) {
+        patternsChanged(address, length);
+        if (pipeline != nullptr) {
+            logPatternMemory(address, length);
+        }
+    }
+
+    /**
+     * Hand visible scanlines to a renderer thread instead of drawing them here.
+     * Logs the current PPU memory, OAM and address windows first, changes follow as they happen.
+     */
+    void usePipeline(RenderPipeline *pipeline);
+
 protected:
     tCPU::byte statusRegister;
     tCPU::byte controlRegister1;
@@ -196,13 +383,45 @@ protected:
 
     void advanceRenderableScanline();
 
-    void advanceBlankScanline();
-
     void onEnterHBlank();
 
+    int getA12RisingEdgeDot();
+
     void renderScanline(const tCPU::word scanline);
 
-    tCPU::byte GetColorFromPalette(int paletteType, int upperBits, int lowerBits);
+    tCPU::word backgroundRowAddress(const tCPU::word Y, int i);
+
+    tCPU::word spriteRowAddress(int i, const tCPU::word Y);
+
+    void detectSprite0Hit(const tCPU::word Y, const SpriteLine &line, int numSprites);
+
+    uint64_t scanlineSignature(const tCPU::word Y, const SpriteLine &line, int numSprites);
+
+    // note a register access for the dot renderer when it lands inside the visible part of a scanline
+    void logLineEvent(tCPU::word port, tCPU::byte value);
+
+    // layers.background of a scanline with logged accesses, fetched and scrolled dot by dot
+    void renderBackgroundDots(const tCPU::word Y);
+
+    // re-resolve the palette after $3F00-$3F1F or the grayscale/emphasis bits changed
+    void refreshPalette();
+
+    // 8 decoded palette indices for the pattern row at address, see TileCache
+    uint64_t fetchTileRow(tCPU::word address, bool flipped);
+
+    void logPatternMemory(tCPU::word address, int length);
+
+    // decoded tiles and nametable cells showing pattern memory [address, address + length) are stale
+    void patternsChanged(tCPU::word address, int length);
+
+    // PPU_RAM [start, end) changed, mark the nametable cells of every slot mapped onto it
+    void nametablesChanged(tCPU::dword start, tCPU::dword end);
+
+    // bring the nametable cache up to date with the current pattern table
+    void refreshNametableCache();
+
+    // the background of scanline Y can be copied out of the nametable cache
+    bool prepareNametableCache(const tCPU::word Y);
     /*
      * PPU Settings
      */
@@ -210,20 +429,68 @@ protected:
     // port $2003, $2004
     tCPU::word spriteRamAddress = 0;
 
-    // activated when generateInterruptOnVBlank is true and vblank interval entered
-    bool vblankNmiAwaiting = false;
+    // dot of the current scanline where pattern fetches raise A12, or -1 when no mapper is counting
+    int a12RisingEdgeDot = -1;
 
-    void RenderDebugNametables();
+    MemoryMapper *mapper = nullptr;
 
-    void RenderDebugColorPalette();
+    // PPU_RAM offset of each 1KiB window of $0000-$3FFF: 8 pattern windows, 4 nametable slots and their mirror
+    tCPU::word addressWindows[16] = {};
 
-    void RenderDebugAttributes(tCPU::word NametableAddress);
+    // $3F00-$3F1F with sprite backdrop entries folded onto the background ones
+    static const tCPU::word PaletteAddress[32];
 
-    void RenderDebugPatternTables();
+    TileCache tileCache;
 
-    void RenderBackgroundTiles();
+    // background pixels of all four nametables; frames where patterns or the layout change mid-frame
+    // (raster effects) draw from tile fetches instead, and so does the frame after
+    NametableCache nametableCache;
+    bool useNametableCache = true;
+    bool nametableCacheFrame = false;
+    bool rasterEffects = false;
+    int lastCacheScanline = 240;
+    tCPU::dword frameLayoutGeneration = 0;
+    tCPU::word framePatternTable = 0;
 
-    void RenderSpriteTiles();
+    // sprite evaluation, rebuilt on OAM writes and sprite size changes
+    SpriteLine spriteLines[240];
+    bool spriteLinesDirty = true;
+    bool limitSpritesPerScanline = false;
 
-    MemoryMapper *mapper = nullptr;
+    void evaluateSprites();
+
+    // render-less frames still run timing, flags and sprite-0 hit
+    bool renderingFrame = true;
+    bool renderNextFrame = true;
+
+    // scanline dirty tracking
+    ScanlineHistory scanlineHistory[240] = {};
+    bool reuseScanlines = true;
+    int reusedScanlines = 0;
+    int reusedScanlinesLastFrame = 0;
+
+    // overclocking, the setting and what the current frame runs with
+    int extraScanlines = 0;
+    int frameExtraScanlines = 0;
+
+    // register accesses inside the visible part of the current scanline
+    LineEvents lineEvents = {};
+    bool dotRendering = true;
+    ScanlinePaths scanlinePaths;
+
+    // $3F00-$3F1F resolved to NES color indices written to the raster, COLOR_INDEX_CLEARED at PALETTE_INDEX_CLEARED
+    tCPU::byte paletteIndices[PALETTE_INDEX_CLEARED + 1];
+
+    // the same entries as final colors under the current emphasis, for the debug views
+    tCPU::dword resolvedPalette[PALETTE_INDEX_CLEARED + 1];
+
+    // per-scanline background/sprite layers fed to ScanlineCompositor
+    ScanlineLayers layers;
+
+    // renderer thread fed with deltas and scanline snapshots, nullptr when drawing inline
+    RenderPipeline *pipeline = nullptr;
+
+    // watch types per 256-byte page of PPU address space
+    const tCPU::byte *watchedPages = Watchpoints::Unwatched;
+    Watchpoints *watchpoints = nullptr;
 };
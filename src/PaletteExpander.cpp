@@ -0,0 +1,164 @@
+#include "PaletteExpander.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PALETTE_EXPANDER_AVX2
+#include <immintrin.h>
+#endif
+
+struct tPaletteEntry {
+    union {
+        struct {
+            uint8_t B, G, R, A;
+        };
+
+        uint32_t ColorValue;
+    };
+};
+
+// final output before the first scanline is rendered, and wherever background rendering is off
+static const tCPU::dword CLEAR_COLOR = 0xff333333;
+
+static const tPaletteEntry colorPalette[64] = {
+        {0x80, 0x80, 0x80, 0xFF},
+        {0xBB, 0x00, 0x00, 0xFF},
+        {0xBF, 0x00, 0x37, 0xFF},
+        {0xA6, 0x00, 0x84, 0xFF},
+        {0x6A, 0x00, 0xBB, 0xFF},
+        {0x1E, 0x00, 0xB7, 0xFF},
+        {0x00, 0x00, 0xB3, 0xFF},
+        {0x00, 0x26, 0x91, 0xFF},
+        {0x00, 0x2B, 0x7B, 0xFF},
+        {0x00, 0x3E, 0x00, 0xFF},
+        {0x0D, 0x48, 0x00, 0xFF},
+        {0x22, 0x3C, 0x00, 0xFF},
+        {0x66, 0x2F, 0x00, 0xFF},
+        {0x00, 0x00, 0x00, 0xFF},
+        {0x05, 0x05, 0x05, 0xFF},
+        {0x05, 0x05, 0x05, 0xFF},
+
+        {0xC8, 0xC8, 0xC8, 0xFF},
+        {0xFF, 0x59, 0x00, 0xFF},
+        {0xFF, 0x3C, 0x44, 0xFF},
+        {0xCC, 0x33, 0xB7, 0xFF},
+        {0xAA, 0x33, 0xFF, 0xFF},
+        {0x5E, 0x37, 0xFF, 0xFF},
+        {0x1A, 0x37, 0xFF, 0xFF},
+        {0x00, 0x4B, 0xD5, 0xFF},
+        {0x00, 0x62, 0xC4, 0xFF},
+        {0x00, 0x7B, 0x3C, 0xFF},
+        {0x15, 0x84, 0x1E, 0xFF},
+        {0x66, 0x95, 0x00, 0xFF},
+        {0xC4, 0x84, 0x00, 0xFF},
+        {0x11, 0x11, 0x11, 0xFF},
+        {0x09, 0x09, 0x09, 0xFF},
+        {0x09, 0x09, 0x09, 0xFF},
+
+        {0xFF, 0xFF, 0xFF, 0xFF},
+        {0xFF, 0x95, 0x00, 0xFF},
+        {0xFF, 0x84, 0x6F, 0xFF},
+        {0xFF, 0x6F, 0xD5, 0xFF},
+        {0xCC, 0x77, 0xFF, 0xFF},
+        {0x99, 0x6F, 0xFF, 0xFF},
+        {0x59, 0x7B, 0xFF, 0xFF},
+        {0x5F, 0x91, 0xFF, 0xFF},
+        {0x33, 0xA2, 0xFF, 0xFF},
+        {0x00, 0xBF, 0xA6, 0xFF},
+        {0x6A, 0xD9, 0x51, 0xFF},
+        {0xAE, 0xD5, 0x4D, 0xFF},
+        {0xFF, 0xD9, 0x00, 0xFF},
+        {0x66, 0x66, 0x66, 0xFF},
+        {0x0D, 0x0D, 0x0D, 0xFF},
+        {0x0D, 0x0D, 0x0D, 0xFF},
+
+        {0xFF, 0xFF, 0xFF, 0xFF},
+        {0xFF, 0xBF, 0x84, 0xFF},
+        {0xFF, 0xBB, 0xBB, 0xFF},
+        {0xFF, 0xBB, 0xD0, 0xFF},
+        {0xEA, 0xBF, 0xFF, 0xFF},
+        {0xCC, 0xBF, 0xFF, 0xFF},
+        {0xB7, 0xC4, 0xFF, 0xFF},
+        {0xAE, 0xCC, 0xFF, 0xFF},
+        {0xA2, 0xD9, 0xFF, 0xFF},
+        {0x99, 0xE1, 0xCC, 0xFF},
+        {0xB7, 0xEE, 0xAE, 0xFF},
+        {0xEE, 0xF7, 0xAA, 0xFF},
+        {0xFF, 0xEE, 0xB3, 0xFF},
+        {0xDD, 0xDD, 0xDD, 0xFF},
+        {0x11, 0x11, 0x11, 0xFF},
+        {0x11, 0x11, 0x11, 0xFF}
+};
+
+/**
+ * Master palette under each emphasis combination, emphasis darkens the channels that are not emphasized
+ */
+struct ColorTable {
+    tCPU::dword colors[PaletteExpander::NUM_EMPHASIS * PaletteExpander::NUM_COLORS];
+
+    ColorTable() {
+        for (int emphasis = 0; emphasis < PaletteExpander::NUM_EMPHASIS; emphasis++) {
+            tCPU::dword *row = colors + emphasis * PaletteExpander::NUM_COLORS;
+
+            for (int index = 0; index < 64; index++) {
+                tPaletteEntry color = colorPalette[index];
+                if (emphasis) {
+                    if (!(emphasis & 1)) color.R = color.R * 3 / 4;
+                    if (!(emphasis & 2)) color.G = color.G * 3 / 4;
+                    if (!(emphasis & 4)) color.B = color.B * 3 / 4;
+                }
+                row[index] = color.ColorValue;
+            }
+
+            row[COLOR_INDEX_CLEARED] = CLEAR_COLOR;
+        }
+    }
+};
+
+const tCPU::dword *
+PaletteExpander::table() {
+    static const ColorTable table;
+    return table.colors;
+}
+
+static void expandRowScalar(const tCPU::byte *indices, const tCPU::dword *colors, tCPU::dword *output, int width) {
+    for (int x = 0; x < width; x++) {
+        output[x] = colors[indices[x]];
+    }
+}
+
+#ifdef PALETTE_EXPANDER_AVX2
+/**
+ * 8 pixels per step: widen the indices to 32 bits and gather their colors from the emphasis row
+ */
+__attribute__((target("avx2")))
+static void expandRowAvx2(const tCPU::byte *indices, const tCPU::dword *colors, tCPU::dword *output, int width) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (indices + x)));
+        __m256i pixels = _mm256_i32gather_epi32((const int *) colors, lanes, 4);
+        _mm256_storeu_si256((__m256i *) (output + x), pixels);
+    }
+    expandRowScalar(indices + x, colors, output + x, width - x);
+}
+#endif
+
+void
+PaletteExpander::expandRow(const tCPU::byte *indices, int emphasis, tCPU::dword *output, int width) {
+    const tCPU::dword *colors = table() + (emphasis & 7) * NUM_COLORS;
+
+#ifdef PALETTE_EXPANDER_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        expandRowAvx2(indices, colors, output, width);
+        return;
+    }
+#endif
+
+    expandRowScalar(indices, colors, output, width);
+}
+
+void
+PaletteExpander::expand(const tCPU::byte *indices, const tCPU::byte *emphasis, tCPU::dword *output, int rows) {
+    for (int y = 0; y < rows; y++) {
+        expandRow(indices + y * 256, emphasis[y], output + y * 256, 256);
+    }
+}
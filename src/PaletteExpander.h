@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Platform.h"
+
+// NES color index for pixels left at the clear color, one past the 64 master palette colors
+static const tCPU::byte COLOR_INDEX_CLEARED = 64;
+
+/**
+ * Turns indexed frames (6-bit NES colors, emphasis bits per scanline) into BGRA.
+ *
+ * The color table has a row of 65 colors (64 NES colors, then the clear color) for each of the
+ * 8 emphasis combinations. The GUI uploads the same table as a palette texture and expands on the GPU;
+ * expand() is for everything else (debug window, headless output).
+ */
+class PaletteExpander {
+public:
+    static const int NUM_COLORS = COLOR_INDEX_CLEARED + 1;
+    static const int NUM_EMPHASIS = 8;
+
+    // BGRA of a color index with emphasis bits 0-2 (red, green, blue) applied
+    static tCPU::dword color(int emphasis, int index) {
+        return table()[emphasis * NUM_COLORS + index];
+    }
+
+    // NUM_EMPHASIS rows of NUM_COLORS BGRA colors
+    static const tCPU::dword *table();
+
+    // one row of any width under one emphasis value
+    static void expandRow(const tCPU::byte *indices, int emphasis, tCPU::dword *output, int width);
+
+    // rows of 256 color indices plus one emphasis value per row into 256 BGRA pixels per row
+    static void expand(const tCPU::byte *indices, const tCPU::byte *emphasis, tCPU::dword *output, int rows);
+};
@@ -0,0 +1,998 @@
+#include "PixelScaler.h"
+#include "PaletteExpander.h"
+#include "Logging.h"
+#include <emmintrin.h>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_SCALER_AVX2
+#include <immintrin.h>
+#endif
+
+// widest source row, the intermediate frame of 4x
+static const int MAX_WIDTH = 512;
+static const int MAX_HEIGHT = 480;
+
+// hq2x and xBR: edge pixels repeated this far around the color frames, xBR looks two pixels out
+static const int PADDING = 2;
+static const int MAX_STRIDE = MAX_WIDTH + 2 * PADDING;
+static const int MAX_PADDED_ROWS = MAX_HEIGHT + 2 * PADDING;
+
+// hq2x: 8 bits for the neighbours differing from the center, 4 for the edge neighbours differing from each other
+static const int NUM_CODES = 1 << 12;
+
+// xBR: a distance plane per offset, each distance stored at the pixel the offset starts from
+static const int NUM_PLANES = 8;
+static const int PLANE_OFFSETS[NUM_PLANES][2] = {{1, 0}, {0, 1}, {1, 1}, {1, -1}, {2, 1}, {2, -1}, {1, 2}, {1, -2}};
+
+/**
+ * Source rows y-1, y and y+1 with the edge pixels repeated one further on both sides,
+ * so neighbour loads never leave the row and out-of-frame neighbours equal the edge
+ */
+struct Neighbourhood {
+    tCPU::byte above[MAX_WIDTH + 32];
+    tCPU::byte current[MAX_WIDTH + 32];
+    tCPU::byte below[MAX_WIDTH + 32];
+
+    Neighbourhood(const tCPU::byte *source, int width, int height, int y) {
+        pad(above, source + (y > 0 ? y - 1 : 0) * width, width);
+        pad(current, source + y * width, width);
+        pad(below, source + (y < height - 1 ? y + 1 : y) * width, width);
+    }
+
+    static void pad(tCPU::byte *padded, const tCPU::byte *row, int width) {
+        padded[0] = row[0];
+        memcpy(padded + 1, row, width);
+        padded[width + 1] = row[width - 1];
+    }
+};
+
+/**
+ * hq2x output pixel: up to three neighbours (0-8, row by row, 4 is the center) and their weights,
+ * which add up to 1 << shift
+ */
+struct Hq2xRecipe {
+    tCPU::byte pixels[3];
+    tCPU::byte weights[3];
+    tCPU::byte shift;
+};
+
+static inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/**
+ * Scale2x of source row y into two rows of 2 * width:
+ *   B        E0 E1     E0 = D if D == B, E1 = F if B == F,
+ * D E F  ->  E2 E3     E2 = D if D == H, E3 = F if H == F, all of them E when B == H or D == F
+ *   H
+ */
+static void scale2xRowSse2(const Neighbourhood &rows, int width, tCPU::byte *top, tCPU::byte *bottom) {
+    const __m128i ones = _mm_set1_epi8((char) 0xFF);
+
+    for (int x = 0; x < width; x += 16) {
+        __m128i B = _mm_loadu_si128((const __m128i *) (rows.above + 1 + x));
+        __m128i H = _mm_loadu_si128((const __m128i *) (rows.below + 1 + x));
+        __m128i D = _mm_loadu_si128((const __m128i *) (rows.current + x));
+        __m128i E = _mm_loadu_si128((const __m128i *) (rows.current + 1 + x));
+        __m128i F = _mm_loadu_si128((const __m128i *) (rows.current + 2 + x));
+
+        __m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(B, H), _mm_cmpeq_epi8(D, F)), ones);
+        __m128i E0 = select(_mm_and_si128(edge, _mm_cmpeq_epi8(D, B)), D, E);
+        __m128i E1 = select(_mm_and_si128(edge, _mm_cmpeq_epi8(B, F)), F, E);
+        __m128i E2 = select(_mm_and_si128(edge, _mm_cmpeq_epi8(D, H)), D, E);
+        __m128i E3 = select(_mm_and_si128(edge, _mm_cmpeq_epi8(H, F)), F, E);
+
+        _mm_storeu_si128((__m128i *) (top + x * 2), _mm_unpacklo_epi8(E0, E1));
+        _mm_storeu_si128((__m128i *) (top + x * 2 + 16), _mm_unpackhi_epi8(E0, E1));
+        _mm_storeu_si128((__m128i *) (bottom + x * 2), _mm_unpacklo_epi8(E2, E3));
+        _mm_storeu_si128((__m128i *) (bottom + x * 2 + 16), _mm_unpackhi_epi8(E2, E3));
+    }
+}
+
+#ifdef PIXEL_SCALER_AVX2
+/**
+ * Same rules 32 pixels at a time. The unpacks interleave within 128-bit lanes (pixels 0-7 and 16-23 in
+ * the low half, 8-15 and 24-31 in the high half), the permutes put the output back in order.
+ */
+__attribute__((target("avx2")))
+static void scale2xRowAvx2(const Neighbourhood &rows, int width, tCPU::byte *top, tCPU::byte *bottom) {
+    const __m256i ones = _mm256_set1_epi8((char) 0xFF);
+
+    for (int x = 0; x < width; x += 32) {
+        __m256i B = _mm256_loadu_si256((const __m256i *) (rows.above + 1 + x));
+        __m256i H = _mm256_loadu_si256((const __m256i *) (rows.below + 1 + x));
+        __m256i D = _mm256_loadu_si256((const __m256i *) (rows.current + x));
+        __m256i E = _mm256_loadu_si256((const __m256i *) (rows.current + 1 + x));
+        __m256i F = _mm256_loadu_si256((const __m256i *) (rows.current + 2 + x));
+
+        __m256i edge = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(B, H), _mm256_cmpeq_epi8(D, F)), ones);
+        __m256i E0 = _mm256_blendv_epi8(E, D, _mm256_and_si256(edge, _mm256_cmpeq_epi8(D, B)));
+        __m256i E1 = _mm256_blendv_epi8(E, F, _mm256_and_si256(edge, _mm256_cmpeq_epi8(B, F)));
+        __m256i E2 = _mm256_blendv_epi8(E, D, _mm256_and_si256(edge, _mm256_cmpeq_epi8(D, H)));
+        __m256i E3 = _mm256_blendv_epi8(E, F, _mm256_and_si256(edge, _mm256_cmpeq_epi8(H, F)));
+
+        __m256i topLow = _mm256_unpacklo_epi8(E0, E1), topHigh = _mm256_unpackhi_epi8(E0, E1);
+        __m256i bottomLow = _mm256_unpacklo_epi8(E2, E3), bottomHigh = _mm256_unpackhi_epi8(E2, E3);
+        _mm256_storeu_si256((__m256i *) (top + x * 2), _mm256_permute2x128_si256(topLow, topHigh, 0x20));
+        _mm256_storeu_si256((__m256i *) (top + x * 2 + 32), _mm256_permute2x128_si256(topLow, topHigh, 0x31));
+        _mm256_storeu_si256((__m256i *) (bottom + x * 2), _mm256_permute2x128_si256(bottomLow, bottomHigh, 0x20));
+        _mm256_storeu_si256((__m256i *) (bottom + x * 2 + 32), _mm256_permute2x128_si256(bottomLow, bottomHigh, 0x31));
+    }
+}
+#endif
+
+static void scale2xRow(const tCPU::byte *source, int width, int height, int y, tCPU::byte *top, tCPU::byte *bottom) {
+    Neighbourhood rows(source, width, height, y);
+
+#ifdef PIXEL_SCALER_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        scale2xRowAvx2(rows, width, top, bottom);
+        return;
+    }
+#endif
+
+    scale2xRowSse2(rows, width, top, bottom);
+}
+
+/**
+ * Scale3x of source row y into three rows of 3 * width, A-I being the 3x3 neighbourhood of E:
+ *   E0 = D if D == B                          E1 = B if (D == B and E != C) or (B == F and E != A)
+ *   E2 = F if B == F                          E3 = D if (D == B and E != G) or (D == H and E != A)
+ *   E5 = F if (B == F and E != I) or (H == F and E != C)
+ *   E6 = D if D == H                          E7 = H if (D == H and E != I) or (H == F and E != G)
+ *   E8 = F if H == F                          all of them E when B == H or D == F
+ */
+static void scale3xRow(const tCPU::byte *source, int width, int height, int y, tCPU::byte *output[3]) {
+    Neighbourhood rows(source, width, height, y);
+    const __m128i ones = _mm_set1_epi8((char) 0xFF);
+    alignas(16) tCPU::byte pixels[9][16];
+
+    for (int x = 0; x < width; x += 16) {
+        __m128i A = _mm_loadu_si128((const __m128i *) (rows.above + x));
+        __m128i B = _mm_loadu_si128((const __m128i *) (rows.above + 1 + x));
+        __m128i C = _mm_loadu_si128((const __m128i *) (rows.above + 2 + x));
+        __m128i D = _mm_loadu_si128((const __m128i *) (rows.current + x));
+        __m128i E = _mm_loadu_si128((const __m128i *) (rows.current + 1 + x));
+        __m128i F = _mm_loadu_si128((const __m128i *) (rows.current + 2 + x));
+        __m128i G = _mm_loadu_si128((const __m128i *) (rows.below + x));
+        __m128i H = _mm_loadu_si128((const __m128i *) (rows.below + 1 + x));
+        __m128i I = _mm_loadu_si128((const __m128i *) (rows.below + 2 + x));
+
+        __m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(B, H), _mm_cmpeq_epi8(D, F)), ones);
+        __m128i DB = _mm_and_si128(edge, _mm_cmpeq_epi8(D, B));
+        __m128i BF = _mm_and_si128(edge, _mm_cmpeq_epi8(B, F));
+        __m128i DH = _mm_and_si128(edge, _mm_cmpeq_epi8(D, H));
+        __m128i HF = _mm_and_si128(edge, _mm_cmpeq_epi8(H, F));
+
+        // E differing from a corner
+        __m128i notA = _mm_andnot_si128(_mm_cmpeq_epi8(E, A), ones);
+        __m128i notC = _mm_andnot_si128(_mm_cmpeq_epi8(E, C), ones);
+        __m128i notG = _mm_andnot_si128(_mm_cmpeq_epi8(E, G), ones);
+        __m128i notI = _mm_andnot_si128(_mm_cmpeq_epi8(E, I), ones);
+
+        __m128i results[9] = {
+                select(DB, D, E),
+                select(_mm_or_si128(_mm_and_si128(DB, notC), _mm_and_si128(BF, notA)), B, E),
+                select(BF, F, E),
+                select(_mm_or_si128(_mm_and_si128(DB, notG), _mm_and_si128(DH, notA)), D, E),
+                E,
+                select(_mm_or_si128(_mm_and_si128(BF, notI), _mm_and_si128(HF, notC)), F, E),
+                select(DH, D, E),
+                select(_mm_or_si128(_mm_and_si128(DH, notI), _mm_and_si128(HF, notG)), H, E),
+                select(HF, F, E)
+        };
+        for (int i = 0; i < 9; i++) {
+            _mm_store_si128((__m128i *) pixels[i], results[i]);
+        }
+
+        // SSE2 has no 3-way byte interleave
+        for (int row = 0; row < 3; row++) {
+            tCPU::byte *out = output[row] + x * 3;
+            for (int i = 0; i < 16; i++) {
+                out[i * 3 + 0] = pixels[row * 3 + 0][i];
+                out[i * 3 + 1] = pixels[row * 3 + 1][i];
+                out[i * 3 + 2] = pixels[row * 3 + 2][i];
+            }
+        }
+    }
+}
+
+/*
+ * Colors for hq2x and xBR
+ *
+ * YUV is packed like the colors, Y << 16 | U << 8 | V, so SIMD code measures three channels of four or
+ * eight pixels with byte-wise absolute differences. BT.601 weights in 8-bit fixed point, U and V offset by 128.
+ */
+static inline tCPU::dword toYuv(tCPU::dword color) {
+    int blue = color & 0xFF, green = color >> 8 & 0xFF, red = color >> 16 & 0xFF;
+    int y = (29 * blue + 77 * red + 150 * green) >> 8;
+    int u = ((128 * blue - 43 * red - 85 * green) >> 8) + 128;
+    int v = ((-21 * blue + 128 * red - 107 * green) >> 8) + 128;
+    return (tCPU::dword) (y << 16 | u << 8 | v);
+}
+
+// hq2x's test: Y more than 48 apart, U more than 7 or V more than 6
+static const tCPU::dword HQ_THRESHOLDS = 48 << 16 | 7 << 8 | 6;
+
+static inline bool yuvDiffers(tCPU::dword a, tCPU::dword b) {
+    return abs((int) (a >> 16) - (int) (b >> 16)) > 48
+           || abs((int) (a >> 8 & 0xFF) - (int) (b >> 8 & 0xFF)) > 7
+           || abs((int) (a & 0xFF) - (int) (b & 0xFF)) > 6;
+}
+
+// xBR's distance: the channel differences added up
+static inline int yuvDistance(tCPU::dword a, tCPU::dword b) {
+    return abs((int) (a >> 16) - (int) (b >> 16))
+           + abs((int) (a >> 8 & 0xFF) - (int) (b >> 8 & 0xFF))
+           + abs((int) (a & 0xFF) - (int) (b & 0xFF));
+}
+
+// (a * weightA + b * weightB + c * weightC) >> shift on each channel, the weights adding up to at most 16
+static inline tCPU::dword mix(tCPU::dword a, tCPU::dword b, tCPU::dword c, int weightA, int weightB, int weightC,
+                              int shift) {
+    tCPU::dword blueRed = ((a & 0x00FF00FF) * weightA + (b & 0x00FF00FF) * weightB
+                           + (c & 0x00FF00FF) * weightC) >> shift;
+    tCPU::dword greenAlpha = ((a >> 8 & 0x00FF00FF) * weightA + (b >> 8 & 0x00FF00FF) * weightB
+                              + (c >> 8 & 0x00FF00FF) * weightC) >> shift;
+    return (blueRed & 0x00FF00FF) | (greenAlpha & 0x00FF00FF) << 8;
+}
+
+// two 16-bit multipliers for _mm_madd_epi16 in each 32-bit lane
+static inline int multipliers(int low, int high) {
+    return (int) ((tCPU::dword) (uint16_t) high << 16 | (uint16_t) low);
+}
+
+/**
+ * toYuv() 4 pixels at a time: blue and red in the 16-bit halves of one lane, green (and alpha) in another,
+ * one madd each per channel
+ */
+static void yuvRowSse2(const tCPU::dword *colors, tCPU::dword *yuv, int count) {
+    const __m128i halves = _mm_set1_epi32(0x00FF00FF);
+    const __m128i yBlueRed = _mm_set1_epi32(multipliers(29, 77)), yGreen = _mm_set1_epi32(multipliers(150, 0));
+    const __m128i uBlueRed = _mm_set1_epi32(multipliers(128, -43)), uGreen = _mm_set1_epi32(multipliers(-85, 0));
+    const __m128i vBlueRed = _mm_set1_epi32(multipliers(-21, 128)), vGreen = _mm_set1_epi32(multipliers(-107, 0));
+    const __m128i offset = _mm_set1_epi32(128);
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *) (colors + x));
+        __m128i blueRed = _mm_and_si128(pixels, halves);
+        __m128i green = _mm_and_si128(_mm_srli_epi32(pixels, 8), halves);
+
+        __m128i y = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(blueRed, yBlueRed), _mm_madd_epi16(green, yGreen)), 8);
+        __m128i u = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(blueRed, uBlueRed), _mm_madd_epi16(green, uGreen)), 8);
+        __m128i v = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(blueRed, vBlueRed), _mm_madd_epi16(green, vGreen)), 8);
+        u = _mm_add_epi32(u, offset);
+        v = _mm_add_epi32(v, offset);
+
+        _mm_storeu_si128((__m128i *) (yuv + x),
+                         _mm_or_si128(_mm_slli_epi32(y, 16), _mm_or_si128(_mm_slli_epi32(u, 8), v)));
+    }
+    for (; x < count; x++) {
+        yuv[x] = toYuv(colors[x]);
+    }
+}
+
+// all ones in the lanes where a and b differ by more than thresholds in any byte
+static inline __m128i differsSse2(__m128i a, __m128i b, __m128i thresholds) {
+    __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    __m128i within = _mm_cmpeq_epi32(_mm_subs_epu8(difference, thresholds), _mm_setzero_si128());
+    return _mm_andnot_si128(within, _mm_set1_epi32(-1));
+}
+
+// channel differences of a and b added up, in each lane
+static inline __m128i distanceSse2(__m128i a, __m128i b) {
+    const __m128i low = _mm_set1_epi32(0xFF);
+    __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    return _mm_add_epi32(_mm_add_epi32(_mm_and_si128(difference, low),
+                                       _mm_and_si128(_mm_srli_epi32(difference, 8), low)),
+                         _mm_srli_epi32(difference, 16));
+}
+
+/**
+ * hq2x neighbourhood code of each pixel: bits 0-7 for the neighbours 0-3 and 5-8 differing from the center,
+ * bits 8-11 for the edge neighbours above/left, above/right, below/left and below/right differing from each other
+ */
+static inline int hqCode(const tCPU::dword *above, const tCPU::dword *current, const tCPU::dword *below) {
+    const tCPU::dword w[9] = {above[-1], above[0], above[1], current[-1], current[0], current[1],
+                              below[-1], below[0], below[1]};
+    static const int NEIGHBOURS[8] = {0, 1, 2, 3, 5, 6, 7, 8};
+
+    int code = 0;
+    for (int bit = 0; bit < 8; bit++) {
+        code |= yuvDiffers(w[4], w[NEIGHBOURS[bit]]) << bit;
+    }
+    code |= yuvDiffers(w[1], w[3]) << 8;
+    code |= yuvDiffers(w[1], w[5]) << 9;
+    code |= yuvDiffers(w[7], w[3]) << 10;
+    code |= yuvDiffers(w[7], w[5]) << 11;
+    return code;
+}
+
+static void hqCodesRowSse2(const tCPU::dword *above, const tCPU::dword *current, const tCPU::dword *below,
+                           uint32_t *codes, int count) {
+    const __m128i thresholds = _mm_set1_epi32(HQ_THRESHOLDS);
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i w[9];
+        for (int column = 0; column < 3; column++) {
+            w[column] = _mm_loadu_si128((const __m128i *) (above + x + column - 1));
+            w[3 + column] = _mm_loadu_si128((const __m128i *) (current + x + column - 1));
+            w[6 + column] = _mm_loadu_si128((const __m128i *) (below + x + column - 1));
+        }
+
+        __m128i code = _mm_setzero_si128();
+        for (int neighbour = 0, bit = 0; neighbour < 9; neighbour++) {
+            if (neighbour != 4) {
+                code = _mm_or_si128(code, _mm_and_si128(differsSse2(w[4], w[neighbour], thresholds),
+                                                        _mm_set1_epi32(1 << bit++)));
+            }
+        }
+        code = _mm_or_si128(code, _mm_and_si128(differsSse2(w[1], w[3], thresholds), _mm_set1_epi32(1 << 8)));
+        code = _mm_or_si128(code, _mm_and_si128(differsSse2(w[1], w[5], thresholds), _mm_set1_epi32(1 << 9)));
+        code = _mm_or_si128(code, _mm_and_si128(differsSse2(w[7], w[3], thresholds), _mm_set1_epi32(1 << 10)));
+        code = _mm_or_si128(code, _mm_and_si128(differsSse2(w[7], w[5], thresholds), _mm_set1_epi32(1 << 11)));
+        _mm_storeu_si128((__m128i *) (codes + x), code);
+    }
+    for (; x < count; x++) {
+        codes[x] = hqCode(above + x, current + x, below + x);
+    }
+}
+
+// distances[x] = yuvDistance(row[x], other[x])
+static void distanceRowSse2(const tCPU::dword *row, const tCPU::dword *other, uint16_t *distances, int count) {
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m128i low = distanceSse2(_mm_loadu_si128((const __m128i *) (row + x)),
+                                   _mm_loadu_si128((const __m128i *) (other + x)));
+        __m128i high = distanceSse2(_mm_loadu_si128((const __m128i *) (row + x + 4)),
+                                    _mm_loadu_si128((const __m128i *) (other + x + 4)));
+        _mm_storeu_si128((__m128i *) (distances + x), _mm_packs_epi32(low, high));
+    }
+    for (; x < count; x++) {
+        distances[x] = (uint16_t) yuvDistance(row[x], other[x]);
+    }
+}
+
+#ifdef PIXEL_SCALER_AVX2
+__attribute__((target("avx2")))
+static void yuvRowAvx2(const tCPU::dword *colors, tCPU::dword *yuv, int count) {
+    const __m256i halves = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i yBlueRed = _mm256_set1_epi32(multipliers(29, 77)), yGreen = _mm256_set1_epi32(multipliers(150, 0));
+    const __m256i uBlueRed = _mm256_set1_epi32(multipliers(128, -43)), uGreen = _mm256_set1_epi32(multipliers(-85, 0));
+    const __m256i vBlueRed = _mm256_set1_epi32(multipliers(-21, 128)), vGreen = _mm256_set1_epi32(multipliers(-107, 0));
+    const __m256i offset = _mm256_set1_epi32(128);
+
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i *) (colors + x));
+        __m256i blueRed = _mm256_and_si256(pixels, halves);
+        __m256i green = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), halves);
+
+        __m256i y = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(blueRed, yBlueRed),
+                                                       _mm256_madd_epi16(green, yGreen)), 8);
+        __m256i u = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(blueRed, uBlueRed),
+                                                       _mm256_madd_epi16(green, uGreen)), 8);
+        __m256i v = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(blueRed, vBlueRed),
+                                                       _mm256_madd_epi16(green, vGreen)), 8);
+        u = _mm256_add_epi32(u, offset);
+        v = _mm256_add_epi32(v, offset);
+
+        _mm256_storeu_si256((__m256i *) (yuv + x),
+                            _mm256_or_si256(_mm256_slli_epi32(y, 16), _mm256_or_si256(_mm256_slli_epi32(u, 8), v)));
+    }
+    for (; x < count; x++) {
+        yuv[x] = toYuv(colors[x]);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i differsAvx2(__m256i a, __m256i b, __m256i thresholds) {
+    __m256i difference = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+    __m256i within = _mm256_cmpeq_epi32(_mm256_subs_epu8(difference, thresholds), _mm256_setzero_si256());
+    return _mm256_andnot_si256(within, _mm256_set1_epi32(-1));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i distanceAvx2(__m256i a, __m256i b) {
+    const __m256i low = _mm256_set1_epi32(0xFF);
+    __m256i difference = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+    return _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(difference, low),
+                                             _mm256_and_si256(_mm256_srli_epi32(difference, 8), low)),
+                            _mm256_srli_epi32(difference, 16));
+}
+
+__attribute__((target("avx2")))
+static void hqCodesRowAvx2(const tCPU::dword *above, const tCPU::dword *current, const tCPU::dword *below,
+                           uint32_t *codes, int count) {
+    const __m256i thresholds = _mm256_set1_epi32(HQ_THRESHOLDS);
+
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256i w[9];
+        for (int column = 0; column < 3; column++) {
+            w[column] = _mm256_loadu_si256((const __m256i *) (above + x + column - 1));
+            w[3 + column] = _mm256_loadu_si256((const __m256i *) (current + x + column - 1));
+            w[6 + column] = _mm256_loadu_si256((const __m256i *) (below + x + column - 1));
+        }
+
+        __m256i code = _mm256_setzero_si256();
+        for (int neighbour = 0, bit = 0; neighbour < 9; neighbour++) {
+            if (neighbour != 4) {
+                code = _mm256_or_si256(code, _mm256_and_si256(differsAvx2(w[4], w[neighbour], thresholds),
+                                                              _mm256_set1_epi32(1 << bit++)));
+            }
+        }
+        code = _mm256_or_si256(code, _mm256_and_si256(differsAvx2(w[1], w[3], thresholds),
+                                                      _mm256_set1_epi32(1 << 8)));
+        code = _mm256_or_si256(code, _mm256_and_si256(differsAvx2(w[1], w[5], thresholds),
+                                                      _mm256_set1_epi32(1 << 9)));
+        code = _mm256_or_si256(code, _mm256_and_si256(differsAvx2(w[7], w[3], thresholds),
+                                                      _mm256_set1_epi32(1 << 10)));
+        code = _mm256_or_si256(code, _mm256_and_si256(differsAvx2(w[7], w[5], thresholds),
+                                                      _mm256_set1_epi32(1 << 11)));
+        _mm256_storeu_si256((__m256i *) (codes + x), code);
+    }
+    for (; x < count; x++) {
+        codes[x] = hqCode(above + x, current + x, below + x);
+    }
+}
+
+// packs interleaves 128-bit lanes: distances 0-3, 8-11, 4-7, 12-15
+__attribute__((target("avx2")))
+static void distanceRowAvx2(const tCPU::dword *row, const tCPU::dword *other, uint16_t *distances, int count) {
+    int x = 0;
+    for (; x + 16 <= count; x += 16) {
+        __m256i low = distanceAvx2(_mm256_loadu_si256((const __m256i *) (row + x)),
+                                   _mm256_loadu_si256((const __m256i *) (other + x)));
+        __m256i high = distanceAvx2(_mm256_loadu_si256((const __m256i *) (row + x + 8)),
+                                    _mm256_loadu_si256((const __m256i *) (other + x + 8)));
+        _mm256_storeu_si256((__m256i *) (distances + x),
+                            _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8));
+    }
+    for (; x < count; x++) {
+        distances[x] = (uint16_t) yuvDistance(row[x], other[x]);
+    }
+}
+#endif
+
+static void yuvRow(const tCPU::dword *colors, tCPU::dword *yuv, int count) {
+#ifdef PIXEL_SCALER_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        yuvRowAvx2(colors, yuv, count);
+        return;
+    }
+#endif
+
+    yuvRowSse2(colors, yuv, count);
+}
+
+static void hqCodesRow(const tCPU::dword *above, const tCPU::dword *current, const tCPU::dword *below,
+                       uint32_t *codes, int count) {
+#ifdef PIXEL_SCALER_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        hqCodesRowAvx2(above, current, below, codes, count);
+        return;
+    }
+#endif
+
+    hqCodesRowSse2(above, current, below, codes, count);
+}
+
+static void distanceRow(const tCPU::dword *row, const tCPU::dword *other, uint16_t *distances, int count) {
+#ifdef PIXEL_SCALER_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2) {
+        distanceRowAvx2(row, other, distances, count);
+        return;
+    }
+#endif
+
+    distanceRowSse2(row, other, distances, count);
+}
+
+/**
+ * Repeats the edge pixels of a frame PADDING pixels out, rows are width + 2 * PADDING apart
+ */
+static void padFrame(tCPU::dword *frame, int width, int height) {
+    int stride = width + 2 * PADDING;
+    for (int y = PADDING; y < PADDING + height; y++) {
+        tCPU::dword *row = frame + y * stride;
+        for (int x = 0; x < PADDING; x++) {
+            row[x] = row[PADDING];
+            row[PADDING + width + x] = row[PADDING + width - 1];
+        }
+    }
+    for (int y = 0; y < PADDING; y++) {
+        memcpy(frame + y * stride, frame + PADDING * stride, stride * sizeof(tCPU::dword));
+        memcpy(frame + (PADDING + height + y) * stride, frame + (PADDING + height - 1) * stride,
+               stride * sizeof(tCPU::dword));
+    }
+}
+
+/*
+ * hq2x
+ *
+ * The top left quadrant's rules, with w0-w8 the 3x3 neighbourhood and bit n of pattern set when
+ * neighbour n (skipping the center) differs from it. The other quadrants mirror the neighbourhood.
+ */
+static Hq2xRecipe hq2xRule(int pattern, bool differs15, bool differs73, bool differs31);
+
+// neighbourhood mirrored for the top right, bottom left and bottom right quadrants
+static const int HQ_QUADRANTS[4][9] = {
+        {0, 1, 2, 3, 4, 5, 6, 7, 8},
+        {2, 1, 0, 5, 4, 3, 8, 7, 6},
+        {6, 7, 8, 3, 4, 5, 0, 1, 2},
+        {8, 7, 6, 5, 4, 3, 2, 1, 0}
+};
+
+// bit of an hq2x neighbourhood code: neighbour n differing from the center, or two edge neighbours from each other
+static inline int neighbourBit(int neighbour) {
+    return neighbour > 4 ? neighbour - 1 : neighbour;
+}
+
+static inline int edgePairBit(int a, int b) {
+    int vertical = a == 1 || a == 7 ? a : b, horizontal = vertical == a ? b : a;
+    return 8 + (vertical == 7) * 2 + (horizontal == 5);
+}
+
+/**
+ * The rules looked up for every quadrant and neighbourhood code ahead of time, so scaling a pixel is
+ * four table reads and blends
+ */
+void
+PixelScaler::buildRecipes() {
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        const int *p = HQ_QUADRANTS[quadrant];
+
+        for (int code = 0; code < NUM_CODES; code++) {
+            int pattern = 0;
+            for (int neighbour = 0; neighbour < 9; neighbour++) {
+                if (neighbour != 4 && (code >> neighbourBit(p[neighbour]) & 1)) {
+                    pattern |= 1 << neighbourBit(neighbour);
+                }
+            }
+            bool differs15 = code >> edgePairBit(p[1], p[5]) & 1;
+            bool differs73 = code >> edgePairBit(p[7], p[3]) & 1;
+            bool differs31 = code >> edgePairBit(p[3], p[1]) & 1;
+
+            Hq2xRecipe recipe = hq2xRule(pattern, differs15, differs73, differs31);
+            for (auto &pixel : recipe.pixels) {
+                pixel = (tCPU::byte) p[pixel];
+            }
+            recipes[quadrant * NUM_CODES + code] = recipe;
+        }
+    }
+}
+
+static Hq2xRecipe hq2xRule(int pattern, bool differs15, bool differs73, bool differs31) {
+    auto P = [pattern](int mask, int value) {
+        return (pattern & mask) == value;
+    };
+    auto two = [](int a, int weightA, int b, int weightB, int shift) {
+        return Hq2xRecipe{{(tCPU::byte) a, (tCPU::byte) b, 4},
+                                   {(tCPU::byte) weightA, (tCPU::byte) weightB, 0}, (tCPU::byte) shift};
+    };
+    auto three = [](int a, int weightA, int b, int weightB, int c, int weightC, int shift) {
+        return Hq2xRecipe{{(tCPU::byte) a, (tCPU::byte) b, (tCPU::byte) c},
+                                   {(tCPU::byte) weightA, (tCPU::byte) weightB, (tCPU::byte) weightC},
+                                   (tCPU::byte) shift};
+    };
+
+    if ((P(0xbf, 0x37) || P(0xdb, 0x13)) && differs15) {
+        return two(4, 3, 3, 1, 2);
+    }
+    if ((P(0xdb, 0x49) || P(0xef, 0x6d)) && differs73) {
+        return two(4, 3, 1, 1, 2);
+    }
+    if ((P(0x0b, 0x0b) || P(0xfe, 0x4a) || P(0xfe, 0x1a)) && differs31) {
+        return two(4, 1, 4, 0, 0);
+    }
+    if ((P(0x6f, 0x2a) || P(0x5b, 0x0a) || P(0xbf, 0x3a) || P(0xdf, 0x5a) || P(0x9f, 0x8a) || P(0xcf, 0x8a)
+         || P(0xef, 0x4e) || P(0x3f, 0x0e) || P(0xfb, 0x5a) || P(0xbb, 0x8a) || P(0x7f, 0x5a) || P(0xaf, 0x8a)
+         || P(0xeb, 0x8a)) && differs31) {
+        return two(4, 3, 0, 1, 2);
+    }
+    if (P(0x0b, 0x08)) {
+        return three(4, 2, 0, 1, 1, 1, 2);
+    }
+    if (P(0x0b, 0x02)) {
+        return three(4, 2, 0, 1, 3, 1, 2);
+    }
+    if (P(0x2f, 0x2f)) {
+        return three(4, 14, 3, 1, 1, 1, 4);
+    }
+    if (P(0xbf, 0x37) || P(0xdb, 0x13)) {
+        return three(4, 5, 1, 2, 3, 1, 3);
+    }
+    if (P(0xdb, 0x49) || P(0xef, 0x6d)) {
+        return three(4, 5, 3, 2, 1, 1, 3);
+    }
+    if (P(0x1b, 0x03) || P(0x4f, 0x43) || P(0x8b, 0x83) || P(0x6b, 0x43)) {
+        return two(4, 3, 3, 1, 2);
+    }
+    if (P(0x4b, 0x09) || P(0x8b, 0x89) || P(0x1f, 0x19) || P(0x3b, 0x19)) {
+        return two(4, 3, 1, 1, 2);
+    }
+    if (P(0x7e, 0x2a) || P(0xef, 0xab) || P(0xbf, 0x8f) || P(0x7e, 0x0e)) {
+        return three(4, 2, 3, 3, 1, 3, 3);
+    }
+    if (P(0xfb, 0x6a) || P(0x6f, 0x6e) || P(0x3f, 0x3e) || P(0xfb, 0xfa) || P(0xdf, 0xde) || P(0xdf, 0x1e)) {
+        return two(4, 3, 0, 1, 2);
+    }
+    if (P(0x0a, 0x00) || P(0x4f, 0x4b) || P(0x9f, 0x1b) || P(0x2f, 0x0b) || P(0xbe, 0x0a) || P(0xee, 0x0a)
+        || P(0x7e, 0x0a) || P(0xeb, 0x4b) || P(0x3b, 0x1b)) {
+        return three(4, 2, 3, 1, 1, 1, 2);
+    }
+    return three(4, 6, 3, 1, 1, 1, 3);
+}
+
+/*
+ * xBR
+ *
+ * The bottom right corner's rules on the 5x5 neighbourhood without its corners, E in the middle:
+ *         A1 B1 C1
+ *      A0 A  B  C  C4
+ *      D0 D  E  F  F4
+ *      G0 G  H  I  I4
+ *         G5 H5 I5
+ * The other corners rotate it by 90 degrees at a time.
+ */
+enum XbrPixel {
+    XBR_E, XBR_I, XBR_H, XBR_F, XBR_G, XBR_C, XBR_D, XBR_B, XBR_F4, XBR_I4, XBR_H5, XBR_I5, NUM_XBR_PIXELS
+};
+
+static const int XBR_POSITIONS[NUM_XBR_PIXELS][2] = {
+        {0, 0}, {1, 1}, {0, 1}, {1, 0}, {-1, 1}, {1, -1}, {-1, 0}, {0, -1}, {2, 0}, {2, 1}, {0, 2}, {1, 2}
+};
+
+// the distances the rules read
+enum XbrPair {
+    XBR_EC, XBR_EG, XBR_IH5, XBR_IF4, XBR_HF, XBR_HD, XBR_HI5, XBR_FI4, XBR_FB, XBR_EI, XBR_EF, XBR_EH, XBR_FG,
+    XBR_HC, NUM_XBR_PAIRS
+};
+
+static const int XBR_PAIRS[NUM_XBR_PAIRS][2] = {
+        {XBR_E, XBR_C}, {XBR_E, XBR_G}, {XBR_I, XBR_H5}, {XBR_I, XBR_F4}, {XBR_H, XBR_F}, {XBR_H, XBR_D},
+        {XBR_H, XBR_I5}, {XBR_F, XBR_I4}, {XBR_F, XBR_B}, {XBR_E, XBR_I}, {XBR_E, XBR_F}, {XBR_E, XBR_H},
+        {XBR_F, XBR_G}, {XBR_H, XBR_C}
+};
+
+/**
+ * One rotation of the rules for the current stride: where the named pixels and their distances are
+ * relative to E, and which output pixels are the corner (n3) and its neighbours along H (n2) and F (n1)
+ */
+struct XbrCorner {
+    int pixels[NUM_XBR_PIXELS];
+    int pairs[NUM_XBR_PAIRS];
+    int n1, n2, n3;
+};
+
+static void buildXbrCorners(XbrCorner corners[4], int stride, int planeSize) {
+    for (int rotation = 0; rotation < 4; rotation++) {
+        // (x, y) -> (y, -x) rotation times
+        auto rotate = [rotation](int x, int y, int &outX, int &outY) {
+            for (int turn = 0; turn < rotation; turn++) {
+                int previousX = x;
+                x = y;
+                y = -previousX;
+            }
+            outX = x, outY = y;
+        };
+        auto block = [&](int x, int y) {
+            rotate(x, y, x, y);
+            return (x > 0) + 2 * (y > 0);
+        };
+
+        XbrCorner &corner = corners[rotation];
+        int positions[NUM_XBR_PIXELS][2];
+        for (int pixel = 0; pixel < NUM_XBR_PIXELS; pixel++) {
+            rotate(XBR_POSITIONS[pixel][0], XBR_POSITIONS[pixel][1], positions[pixel][0], positions[pixel][1]);
+            corner.pixels[pixel] = positions[pixel][1] * stride + positions[pixel][0];
+        }
+
+        for (int pair = 0; pair < NUM_XBR_PAIRS; pair++) {
+            const int *from = positions[XBR_PAIRS[pair][0]], *to = positions[XBR_PAIRS[pair][1]];
+            int offsetX = to[0] - from[0], offsetY = to[1] - from[1];
+            if (offsetX < 0 || (offsetX == 0 && offsetY < 0)) {
+                std::swap(from, to);
+                offsetX = -offsetX, offsetY = -offsetY;
+            }
+
+            int plane = 0;
+            while (PLANE_OFFSETS[plane][0] != offsetX || PLANE_OFFSETS[plane][1] != offsetY) {
+                plane++;
+            }
+            corner.pairs[pair] = plane * planeSize + from[1] * stride + from[0];
+        }
+
+        corner.n3 = block(1, 1);
+        corner.n2 = block(-1, 1);
+        corner.n1 = block(1, -1);
+    }
+}
+
+/**
+ * Blends the corner's output pixel towards F or H when the edge through it runs along the F-H diagonal
+ * rather than E-I, more of the neighbouring output pixels for shallow and steep edges
+ */
+static inline void xbrCorner(const tCPU::dword *colors, const uint16_t *distances, int center,
+                             const XbrCorner &corner, tCPU::dword block[4]) {
+    auto pixel = [&](int name) {
+        return colors[center + corner.pixels[name]];
+    };
+    auto distance = [&](int pair) {
+        return (int) distances[center + corner.pairs[pair]];
+    };
+    auto similar = [&](int pair) {
+        return distance(pair) < 155;
+    };
+
+    tCPU::dword E = colors[center], H = pixel(XBR_H), F = pixel(XBR_F);
+    if (E == H || E == F) {
+        return;
+    }
+
+    int e = distance(XBR_EC) + distance(XBR_EG) + distance(XBR_IH5) + distance(XBR_IF4) + (distance(XBR_HF) << 2);
+    int i = distance(XBR_HD) + distance(XBR_HI5) + distance(XBR_FI4) + distance(XBR_FB) + (distance(XBR_EI) << 2);
+    if (e > i) {
+        return;
+    }
+
+    tCPU::dword blended = distance(XBR_EF) <= distance(XBR_EH) ? F : H;
+    tCPU::dword &n1 = block[corner.n1], &n2 = block[corner.n2], &n3 = block[corner.n3];
+
+    if (e < i && ((!similar(XBR_FB) && !similar(XBR_HD))
+                  || (similar(XBR_EI) && !similar(XBR_FI4) && !similar(XBR_HI5))
+                  || similar(XBR_EG) || similar(XBR_EC))) {
+        tCPU::dword G = pixel(XBR_G), C = pixel(XBR_C);
+        int ke = distance(XBR_FG), ki = distance(XBR_HC);
+        bool left = ke << 1 <= ki && E != G && pixel(XBR_D) != G;
+        bool up = ke >= ki << 1 && E != C && pixel(XBR_B) != C;
+
+        if (left && up) {
+            n3 = mix(n3, blended, 0, 1, 7, 0, 3);
+            n2 = mix(n2, blended, 0, 3, 1, 0, 2);
+            n1 = n2;
+        } else if (left) {
+            n3 = mix(n3, blended, 0, 1, 3, 0, 2);
+            n2 = mix(n2, blended, 0, 3, 1, 0, 2);
+        } else if (up) {
+            n3 = mix(n3, blended, 0, 1, 3, 0, 2);
+            n1 = mix(n1, blended, 0, 3, 1, 0, 2);
+        } else {
+            n3 = mix(n3, blended, 0, 1, 1, 0, 1);
+        }
+    } else {
+        n3 = mix(n3, blended, 0, 1, 1, 0, 1);
+    }
+}
+
+PixelScaler::PixelScaler(BandPool *pool) : pool(pool) {
+    colors = new tCPU::dword[MAX_STRIDE * MAX_PADDED_ROWS];
+    yuv = new tCPU::dword[MAX_STRIDE * MAX_PADDED_ROWS];
+    doubled = new tCPU::dword[MAX_STRIDE * MAX_PADDED_ROWS];
+    distances = new uint16_t[NUM_PLANES * MAX_STRIDE * MAX_PADDED_ROWS];
+
+    recipes = new Hq2xRecipe[4 * NUM_CODES];
+    buildRecipes();
+}
+
+PixelScaler::~PixelScaler() {
+    delete[] intermediate;
+    delete[] colors;
+    delete[] yuv;
+    delete[] doubled;
+    delete[] distances;
+    delete[] recipes;
+}
+
+void
+PixelScaler::runRows(int rows, const std::function<void(int, int)> &job) {
+    if (pool == nullptr) {
+        job(0, rows);
+    } else {
+        pool->run(rows, job);
+    }
+}
+
+void
+PixelScaler::scale(ScaleFilter filter, int factor, const tCPU::byte *indices, const tCPU::byte *emphasis,
+                   tCPU::dword *output, int pitch) {
+    if (factor < 2 || factor > 4) {
+        PrintError("Unsupported scale factor %d", factor);
+        return;
+    }
+
+    auto outputRow = [&](int row) {
+        return (tCPU::dword *) ((tCPU::byte *) output + row * pitch);
+    };
+
+    if (filter == SCALE_NEAREST) {
+        runRows(240, [&](int first, int last) {
+            tCPU::dword colors[256];
+            for (int y = first; y < last; y++) {
+                PaletteExpander::expandRow(indices + y * 256, emphasis[y], colors, 256);
+
+                tCPU::dword *row = outputRow(y * factor);
+                for (int x = 0; x < 256; x++) {
+                    for (int copy = 0; copy < factor; copy++) {
+                        row[x * factor + copy] = colors[x];
+                    }
+                }
+
+                // the other copies of the row are the same pixels
+                for (int copy = 1; copy < factor; copy++) {
+                    memcpy(outputRow(y * factor + copy), row, 256 * factor * sizeof(tCPU::dword));
+                }
+            }
+        });
+        return;
+    }
+
+    if (filter == SCALE_HQ2X || filter == SCALE_XBR) {
+        scaleColors(filter, factor, indices, emphasis, output, pitch);
+        return;
+    }
+
+    if (factor == 3) {
+        runRows(240, [&](int first, int last) {
+            tCPU::byte scaled[3][256 * 3];
+            tCPU::byte *rows[3] = {scaled[0], scaled[1], scaled[2]};
+            for (int y = first; y < last; y++) {
+                scale3xRow(indices, 256, 240, y, rows);
+                for (int row = 0; row < 3; row++) {
+                    PaletteExpander::expandRow(scaled[row], emphasis[y], outputRow(y * 3 + row), 256 * 3);
+                }
+            }
+        });
+        return;
+    }
+
+    // 2x straight from the frame; 4x is 2x again from the 512x480 result
+    const tCPU::byte *source = indices;
+    const tCPU::byte *sourceEmphasis = emphasis;
+    int width = 256, height = 240;
+
+    if (factor == 4) {
+        runRows(240, [&](int first, int last) {
+            for (int y = first; y < last; y++) {
+                scale2xRow(indices, 256, 240, y, intermediate + y * 2 * 512, intermediate + (y * 2 + 1) * 512);
+                intermediateEmphasis[y * 2] = intermediateEmphasis[y * 2 + 1] = emphasis[y];
+            }
+        });
+
+        source = intermediate;
+        sourceEmphasis = intermediateEmphasis;
+        width = 512, height = 480;
+    }
+
+    runRows(height, [&](int first, int last) {
+        tCPU::byte top[MAX_WIDTH * 2], bottom[MAX_WIDTH * 2];
+        for (int y = first; y < last; y++) {
+            scale2xRow(source, width, height, y, top, bottom);
+            PaletteExpander::expandRow(top, sourceEmphasis[y], outputRow(y * 2), width * 2);
+            PaletteExpander::expandRow(bottom, sourceEmphasis[y], outputRow(y * 2 + 1), width * 2);
+        }
+    });
+}
+
+/**
+ * hq2x and xBR: the frame expanded into the padded color frame, then doubled once or, at 4x, twice.
+ * The first pass of 4x writes into the second padded frame, which then becomes the source.
+ */
+void
+PixelScaler::scaleColors(ScaleFilter filter, int factor, const tCPU::byte *indices, const tCPU::byte *emphasis,
+                         tCPU::dword *output, int pitch) {
+    if (factor == 3) {
+        PrintError("hq2x and xBR scale 2 or 4 times, not %d", factor);
+        return;
+    }
+
+    const int stride = 256 + 2 * PADDING;
+    runRows(240, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            PaletteExpander::expandRow(indices + y * 256, emphasis[y], colors + (y + PADDING) * stride + PADDING, 256);
+        }
+    });
+
+    if (factor == 2) {
+        doubleColors(filter, 256, 240, output, pitch);
+        return;
+    }
+
+    const int doubledStride = 512 + 2 * PADDING;
+    doubleColors(filter, 256, 240, doubled + PADDING * doubledStride + PADDING, doubledStride * sizeof(tCPU::dword));
+    std::swap(colors, doubled);
+    doubleColors(filter, 512, 480, output, pitch);
+}
+
+/**
+ * One 2x pass over the padded color frame: edges repeated, YUV of every pixel, xBR's distance planes,
+ * then the output rows. Each step reads neighbouring rows of the one before, so each is its own run.
+ */
+void
+PixelScaler::doubleColors(ScaleFilter filter, int width, int height, tCPU::dword *output, int pitch) {
+    const int stride = width + 2 * PADDING;
+    const int paddedRows = height + 2 * PADDING;
+    const int planeSize = stride * paddedRows;
+
+    auto outputRow = [&](int row) {
+        return (tCPU::dword *) ((tCPU::byte *) output + row * pitch);
+    };
+
+    padFrame(colors, width, height);
+
+    runRows(paddedRows, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            yuvRow(colors + y * stride, yuv + y * stride, stride);
+        }
+    });
+
+    if (filter == SCALE_HQ2X) {
+        runRows(height, [&](int first, int last) {
+            uint32_t codes[MAX_WIDTH];
+            for (int y = first; y < last; y++) {
+                int start = (y + PADDING) * stride + PADDING;
+                hqCodesRow(yuv + start - stride, yuv + start, yuv + start + stride, codes, width);
+
+                tCPU::dword *top = outputRow(y * 2), *bottom = outputRow(y * 2 + 1);
+                for (int x = 0; x < width; x++) {
+                    const tCPU::dword *center = colors + start + x;
+                    const tCPU::dword w[9] = {center[-stride - 1], center[-stride], center[-stride + 1],
+                                              center[-1], center[0], center[1],
+                                              center[stride - 1], center[stride], center[stride + 1]};
+
+                    tCPU::dword quadrants[4];
+                    for (int quadrant = 0; quadrant < 4; quadrant++) {
+                        const Hq2xRecipe &recipe = recipes[quadrant * NUM_CODES + codes[x]];
+                        quadrants[quadrant] = mix(w[recipe.pixels[0]], w[recipe.pixels[1]], w[recipe.pixels[2]],
+                                                  recipe.weights[0], recipe.weights[1], recipe.weights[2],
+                                                  recipe.shift);
+                    }
+                    top[x * 2] = quadrants[0], top[x * 2 + 1] = quadrants[1];
+                    bottom[x * 2] = quadrants[2], bottom[x * 2 + 1] = quadrants[3];
+                }
+            }
+        });
+        return;
+    }
+
+    // distances only where both pixels are inside the padded frame, the rules never read the others
+    runRows(paddedRows, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            for (int plane = 0; plane < NUM_PLANES; plane++) {
+                int offsetX = PLANE_OFFSETS[plane][0], offsetY = PLANE_OFFSETS[plane][1];
+                if (y + offsetY >= 0 && y + offsetY < paddedRows) {
+                    distanceRow(yuv + y * stride, yuv + (y + offsetY) * stride + offsetX,
+                                distances + plane * planeSize + y * stride, stride - offsetX);
+                }
+            }
+        }
+    });
+
+    XbrCorner corners[4];
+    buildXbrCorners(corners, stride, planeSize);
+
+    runRows(height, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            tCPU::dword *top = outputRow(y * 2), *bottom = outputRow(y * 2 + 1);
+            for (int x = 0; x < width; x++) {
+                int center = (y + PADDING) * stride + PADDING + x;
+                tCPU::dword block[4] = {colors[center], colors[center], colors[center], colors[center]};
+                for (const auto &corner : corners) {
+                    xbrCorner(colors, distances, center, corner, block);
+                }
+                top[x * 2] = block[0], top[x * 2 + 1] = block[1];
+                bottom[x * 2] = block[2], bottom[x * 2 + 1] = block[3];
+            }
+        }
+    });
+}
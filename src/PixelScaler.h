@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Platform.h"
+#include "BandPool.h"
+#include <cstdint>
+#include <functional>
+
+struct Hq2xRecipe;
+
+enum ScaleFilter {
+    // every pixel repeated factor x factor times
+    SCALE_NEAREST,
+    // EPX edge smoothing: Scale2x at 2x, Scale3x at 3x, Scale2x twice at 4x
+    SCALE_EPX,
+    // hq2x: blends each quadrant from the neighbours that differ in YUV, 2x, or 2x twice at 4x
+    SCALE_HQ2X,
+    // xBR: follows edges by comparing YUV distances along both diagonals, 2x, or 2x twice at 4x
+    SCALE_XBR
+};
+
+/**
+ * Upscales indexed frames on the CPU with SSE2, and AVX2 where the CPU has it.
+ *
+ * Nearest and EPX only test pixels for equality, so they run on the NES color indices before expansion:
+ * 16 (AVX2: 32) pixels per compare instead of 4, and the colors are looked up once per output pixel by
+ * PaletteExpander. hq2x and xBR weigh how far apart colors are and blend them, so they expand the frame
+ * first and measure distances in YUV, 4 (AVX2: 8) pixels at a time. Rows are split across a BandPool
+ * when there is one.
+ */
+class PixelScaler {
+public:
+    PixelScaler(BandPool *pool = nullptr);
+
+    ~PixelScaler();
+
+    /**
+     * 256x240 NES color indices with each scanline's emphasis bits (see Raster) scaled 2, 3 or 4 times into BGRA,
+     * hq2x and xBR scale 2 or 4 times. Output rows are pitch bytes apart, frames can go straight into a locked
+     * texture or a file writer's buffer.
+     */
+    void scale(ScaleFilter filter, int factor, const tCPU::byte *indices, const tCPU::byte *emphasis,
+               tCPU::dword *output, int pitch);
+
+private:
+    BandPool *pool;
+
+    // 4x: the first Scale2x pass, 512x480 indices and the emphasis of each row
+    tCPU::byte *intermediate = new tCPU::byte[512 * 480];
+    tCPU::byte intermediateEmphasis[480];
+
+    // hq2x and xBR: source colors and their YUV with the edge pixels repeated around them,
+    // the first pass of 4x in the same layout, and xBR's distances from each pixel to its neighbours
+    tCPU::dword *colors, *yuv, *doubled;
+    uint16_t *distances;
+
+    // hq2x: how each quadrant of the output mixes the 3x3 neighbourhood, by quadrant and neighbourhood code
+    Hq2xRecipe *recipes;
+
+    void runRows(int rows, const std::function<void(int, int)> &job);
+
+    void buildRecipes();
+
+    void scaleColors(ScaleFilter filter, int factor, const tCPU::byte *indices, const tCPU::byte *emphasis,
+                     tCPU::dword *output, int pitch);
+
+    void doubleColors(ScaleFilter filter, int width, int height, tCPU::dword *output, int pitch);
+};
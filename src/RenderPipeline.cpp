@@ -0,0 +1,295 @@
+#include "RenderPipeline.h"
+#include "Logging.h"
+#include <cstddef>
+
+RenderPipeline::RenderPipeline(Raster *raster, int workers) {
+    if (workers == 0) {
+        ring = new tCPU::byte[CAPACITY];
+        renderers.push_back(new PPU(raster));
+        threads.emplace_back(&RenderPipeline::stream, this);
+        return;
+    }
+
+    for (int band = 0; band < workers; band++) {
+        renderers.push_back(new PPU(raster));
+    }
+    for (int band = 0; band < workers; band++) {
+        threads.emplace_back(&RenderPipeline::rasterizeBand, this, band);
+    }
+}
+
+RenderPipeline::~RenderPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(frameLock);
+        running = false;
+    }
+    frameStarted.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(ringLock);
+    }
+    ringFilled.notify_all();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (auto renderer : renderers) {
+        delete renderer;
+    }
+    delete[] ring;
+}
+
+void
+RenderPipeline::logMemory(tCPU::dword offset, const tCPU::byte *bytes, int length) {
+    // bulk copies (CHR banks, initial sync) go in pieces so a record always fits the replay buffer
+    for (int done = 0; done < length; done += MAX_RECORD) {
+        int chunk = length - done < MAX_RECORD ? length - done : MAX_RECORD;
+        push(RECORD_MEMORY, offset + done, bytes + done, chunk);
+    }
+}
+
+void
+RenderPipeline::logSpriteMemory(tCPU::byte offset, const tCPU::byte *bytes, int length) {
+    push(RECORD_SPRITE_MEMORY, offset, bytes, length);
+}
+
+void
+RenderPipeline::logAddressWindows(const tCPU::word *windows) {
+    push(RECORD_WINDOWS, 0, windows, 16 * sizeof(tCPU::word));
+}
+
+void
+RenderPipeline::logLineEvents(const LineEvents &events) {
+    // only the used part of the event list
+    push(RECORD_LINE_EVENTS, 0, &events, offsetof(LineEvents, events) + events.count * sizeof(LineEvent));
+}
+
+void
+RenderPipeline::logScanline(const ScanlineSnapshot &snapshot) {
+    push(RECORD_SCANLINE, 0, &snapshot, sizeof(snapshot));
+}
+
+void
+RenderPipeline::finish() {
+    if (ring != nullptr) {
+        waitForTail(writeHead);
+        return;
+    }
+
+    if (frameLog.empty()) {
+        return;
+    }
+
+    // hand the frame to every worker and wait for the last band
+    std::unique_lock<std::mutex> lock(frameLock);
+    pendingWorkers = (int) threads.size();
+    frameNumber++;
+    frameStarted.notify_all();
+    frameFinished.wait(lock, [this] { return pendingWorkers == 0; });
+
+    frameLog.clear();
+}
+
+void
+RenderPipeline::push(RecordType type, tCPU::dword offset, const void *payload, tCPU::dword length) {
+    RecordHeader header = {type, offset, length};
+    size_t size = sizeof(header) + length;
+
+    if (ring == nullptr) {
+        // batched, kept until finish()
+        const tCPU::byte *bytes = (const tCPU::byte *) payload;
+        frameLog.insert(frameLog.end(), (const tCPU::byte *) &header, (const tCPU::byte *) &header + sizeof(header));
+        frameLog.insert(frameLog.end(), bytes, bytes + length);
+        return;
+    }
+
+    // renderer fell a whole ring behind, let it catch up
+    if (CAPACITY - (writeHead - tail.load(std::memory_order_acquire)) < size) {
+        waitForTail(writeHead + size - CAPACITY);
+    }
+
+    copyIn(writeHead, &header, sizeof(header));
+    copyIn(writeHead + sizeof(header), payload, length);
+    writeHead += size;
+    head.store(writeHead, std::memory_order_seq_cst);
+
+    if (rendererWaiting.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lock(ringLock);
+        ringFilled.notify_one();
+    }
+}
+
+/**
+ * The flag goes up before the last look at tail, so a renderer storing tail after that look
+ * sees the flag and wakes us under the lock
+ */
+void
+RenderPipeline::waitForTail(size_t position) {
+    auto consumed = [&] { return tail.load(std::memory_order_seq_cst) - position < CAPACITY; };
+    if (consumed()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(ringLock);
+    emulationWaiting.store(true, std::memory_order_seq_cst);
+    ringDrained.wait(lock, consumed);
+    emulationWaiting.store(false, std::memory_order_relaxed);
+}
+
+void
+RenderPipeline::copyIn(size_t position, const void *data, size_t length) {
+    size_t start = position & (CAPACITY - 1);
+    size_t first = length < CAPACITY - start ? length : CAPACITY - start;
+    memcpy(ring + start, data, first);
+    memcpy(ring, (const tCPU::byte *) data + first, length - first);
+}
+
+void
+RenderPipeline::copyOut(size_t position, void *data, size_t length) {
+    size_t start = position & (CAPACITY - 1);
+    size_t first = length < CAPACITY - start ? length : CAPACITY - start;
+    memcpy(data, ring + start, first);
+    memcpy((tCPU::byte *) data + first, ring, length - first);
+}
+
+/**
+ * Streaming renderer thread: replay records as they arrive, sleep when the emulation has nothing queued
+ */
+void
+RenderPipeline::stream() {
+    tCPU::byte payload[MAX_RECORD];
+    size_t readTail = 0;
+
+    while (running) {
+        if (head.load(std::memory_order_seq_cst) == readTail) {
+            std::unique_lock<std::mutex> lock(ringLock);
+            rendererWaiting.store(true, std::memory_order_seq_cst);
+            ringFilled.wait(lock, [&] { return head.load(std::memory_order_seq_cst) != readTail || !running; });
+            rendererWaiting.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        RecordHeader header;
+        copyOut(readTail, &header, sizeof(header));
+        copyOut(readTail + sizeof(header), payload, header.length);
+        replay(*renderers[0], header, payload, 0, 1);
+
+        // raster writes above become visible to finish() with this store
+        readTail += sizeof(header) + header.length;
+        tail.store(readTail, std::memory_order_seq_cst);
+
+        if (emulationWaiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(ringLock);
+            ringDrained.notify_one();
+        }
+    }
+}
+
+/**
+ * Batched worker: replay the whole frame to keep its PPU in sync, draw only its own scanlines
+ */
+void
+RenderPipeline::rasterizeBand(int band) {
+    int stride = (int) renderers.size();
+    int framesSeen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(frameLock);
+            frameStarted.wait(lock, [&] { return frameNumber != framesSeen || !running; });
+            if (!running) {
+                return;
+            }
+            framesSeen = frameNumber;
+        }
+
+        // frameLog is left alone by the emulation thread until every band is done
+        for (size_t position = 0; position < frameLog.size();) {
+            RecordHeader header;
+            memcpy(&header, &frameLog[position], sizeof(header));
+            replay(*renderers[band], header, &frameLog[position + sizeof(header)], band, stride);
+            position += sizeof(header) + header.length;
+        }
+
+        std::lock_guard<std::mutex> lock(frameLock);
+        if (--pendingWorkers == 0) {
+            frameFinished.notify_one();
+        }
+    }
+}
+
+void
+RenderPipeline::replay(PPU &ppu, const RecordHeader &header, const tCPU::byte *payload, int band, int stride) {
+    switch (header.type) {
+        case RECORD_MEMORY: {
+            tCPU::dword start = header.offset, end = header.offset + header.length;
+            memcpy(ppu.PPU_RAM + start, payload, header.length);
+
+            // decoded tiles are keyed by pattern address, find the windows showing these bytes
+            for (int window = 0; window < 8; window++) {
+                tCPU::dword base = ppu.addressWindows[window];
+                tCPU::dword from = start > base ? start : base;
+                tCPU::dword to = end < base + 0x400 ? end : base + 0x400;
+                if (from < to) {
+                    ppu.patternsChanged(window * 0x400 + (from - base), to - from);
+                }
+            }
+            ppu.nametablesChanged(start, end);
+
+            if (start < 0x3F20 && end > 0x3F00) {
+                ppu.refreshPalette();
+            }
+        } break;
+
+        case RECORD_SPRITE_MEMORY: {
+            memcpy(ppu.SPR_RAM + header.offset, payload, header.length);
+            ppu.spriteLinesDirty = true;
+        } break;
+
+        case RECORD_WINDOWS: {
+            if (memcmp(ppu.addressWindows + 8, payload + 8 * sizeof(tCPU::word), 4 * sizeof(tCPU::word)) != 0) {
+                ppu.nametableCache.invalidateAll();
+            }
+            memcpy(ppu.addressWindows, payload, header.length);
+            ppu.patternsChanged(0, 0x2000);
+        } break;
+
+        case RECORD_LINE_EVENTS: {
+            memcpy(&ppu.lineEvents, payload, header.length);
+        } break;
+
+        case RECORD_SCANLINE: {
+            ScanlineSnapshot snapshot;
+            memcpy(&snapshot, payload, sizeof(snapshot));
+
+            const PPU_Settings &settings = snapshot.settings;
+            if (settings.SpriteSize != ppu.settings.SpriteSize
+                || settings.SpritePatternTableAddress != ppu.settings.SpritePatternTableAddress) {
+                ppu.spriteLinesDirty = true;
+            }
+            bool recolor = settings.DisplayTypeMonochrome != ppu.settings.DisplayTypeMonochrome
+                           || settings.ColorEmphasis != ppu.settings.ColorEmphasis;
+
+            ppu.settings = settings;
+            ppu.vramAddress14bit = snapshot.vramAddress;
+            ppu.horizontalScrollOrigin = snapshot.fineX;
+            ppu.limitSpritesPerScanline = snapshot.limitSprites;
+            ppu.reuseScanlines = snapshot.reuseScanlines;
+            if (recolor) {
+                ppu.refreshPalette();
+            }
+
+            if (snapshot.scanline % stride == band) {
+                ppu.renderScanline(snapshot.scanline);
+                if (ppu.reusedScanlines != 0) {
+                    reusedScanlines += ppu.reusedScanlines;
+                    ppu.reusedScanlines = 0;
+                }
+            }
+            ppu.lineEvents.count = 0;
+        } break;
+
+        default:
+            PrintError("Unknown render record type %d", (int) header.type);
+            break;
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Platform.h"
+#include "PPU.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Registers renderScanline reads, captured when the emulation reaches a visible scanline
+ */
+struct ScanlineSnapshot {
+    tCPU::word scanline;
+    tCPU::word vramAddress;
+    tCPU::byte fineX;
+    bool limitSprites;
+    bool reuseScanlines;
+    PPU_Settings settings;
+};
+
+/**
+ * Rasterizes off the emulation thread.
+ *
+ * The emulation PPU logs every change the renderer depends on (PPU memory, OAM, the address windows)
+ * followed by a register snapshot per visible scanline. Renderer threads replay the log into PPUs of
+ * their own, which draw into the shared raster. Sprite-0 hit stays on the emulation side, it is
+ * computed from opacity alone (see PPU::detectSprite0Hit).
+ *
+ * Streaming (no workers): one renderer thread follows the emulation through a lock-free
+ * single-producer single-consumer ring, a few scanlines behind. Either side that runs out of
+ * ring (empty for the renderer, full or draining for the emulation) sleeps on a condition variable.
+ * Batched (N workers): the frame's log is collected and split at vblank; every worker replays all of it
+ * but only draws every Nth scanline, so a frame completes in about 1/N of the raster time. Meant for
+ * offline rendering where frame latency matters more than total CPU.
+ */
+class RenderPipeline {
+public:
+    RenderPipeline(Raster *raster, int workers = 0);
+
+    ~RenderPipeline();
+
+    // emulation thread: PPU_RAM bytes at offset changed
+    void logMemory(tCPU::dword offset, const tCPU::byte *bytes, int length);
+
+    // emulation thread: SPR_RAM bytes at offset changed
+    void logSpriteMemory(tCPU::byte offset, const tCPU::byte *bytes, int length);
+
+    // emulation thread: mirroring or a CHR bank base changed
+    void logAddressWindows(const tCPU::word *windows);
+
+    // emulation thread: register accesses inside the next scanline, it is drawn dot by dot
+    void logLineEvents(const LineEvents &events);
+
+    // emulation thread: draw a visible scanline with these registers
+    void logScanline(const ScanlineSnapshot &snapshot);
+
+    // emulation thread: wait until every logged scanline is in the raster
+    void finish();
+
+    // emulation thread: scanlines the renderers reused since the last call
+    int takeReusedScanlines() {
+        return reusedScanlines.exchange(0);
+    }
+
+private:
+    enum RecordType : tCPU::byte {
+        RECORD_MEMORY, RECORD_SPRITE_MEMORY, RECORD_WINDOWS, RECORD_LINE_EVENTS, RECORD_SCANLINE
+    };
+
+    struct RecordHeader {
+        RecordType type;
+        tCPU::dword offset;
+        tCPU::dword length;
+    };
+
+    // power of two, a frame logs around 20KiB plus whatever CHR banks it copies
+    static const size_t CAPACITY = 1 << 20;
+    static const int MAX_RECORD = 0x1000;
+
+    // one per renderer thread, each draws into the shared raster
+    std::vector<PPU *> renderers;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running{true};
+
+    // summed from the renderer PPUs after each scanline, the emulation PPU reports it per frame
+    std::atomic<int> reusedScanlines{0};
+
+    /*
+     * streaming
+     */
+    tCPU::byte *ring = nullptr;
+
+    // bytes ever written and consumed; head is only stored by the emulation thread, tail by the renderer
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    size_t writeHead = 0;
+
+    // set by a side about to sleep, the other side only takes the lock to wake it
+    std::mutex ringLock;
+    std::condition_variable ringFilled, ringDrained;
+    std::atomic<bool> rendererWaiting{false};
+    std::atomic<bool> emulationWaiting{false};
+
+    /*
+     * batched
+     */
+    std::vector<tCPU::byte> frameLog;
+    std::mutex frameLock;
+    std::condition_variable frameStarted, frameFinished;
+    int frameNumber = 0;
+    int pendingWorkers = 0;
+
+    void push(RecordType type, tCPU::dword offset, const void *payload, tCPU::dword length);
+
+    void copyIn(size_t position, const void *data, size_t length);
+
+    void copyOut(size_t position, void *data, size_t length);
+
+    // emulation thread: sleep until the renderer has consumed up to position
+    void waitForTail(size_t position);
+
+    void stream();
+
+    void rasterizeBand(int band);
+
+    // apply one record, drawing only scanlines where scanline % stride == band
+    void replay(PPU &ppu, const RecordHeader &header, const tCPU::byte *payload, int band, int stride);
+};
@@ -0,0 +1,150 @@
+#include "ScanlineCompositor.h"
+#include <emmintrin.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCANLINE_COMPOSITOR_SHUFFLE
+#include <immintrin.h>
+#endif
+
+void
+ScanlineLayers::clearSprites() {
+    memset(sprite, 0, sizeof(sprite));
+    memset(spriteOpaque, 0, sizeof(spriteOpaque));
+    memset(sprite0Opaque, 0, sizeof(sprite0Opaque));
+}
+
+/**
+ * 2-bit pattern value of each index scaled to the 0/64/128/192 mask debug levels
+ */
+static inline __m128i maskLevels(__m128i indices) {
+    return _mm_and_si128(_mm_slli_epi16(indices, 6), _mm_set1_epi8((char) 0xC0));
+}
+
+static void lookupColorsScalar(const tCPU::byte *palette, tCPU::byte *pixels) {
+    for (int x = 0; x < 256; x++) {
+        pixels[x] = palette[pixels[x]];
+    }
+}
+
+#ifdef SCANLINE_COMPOSITOR_SHUFFLE
+/**
+ * Palette indices to colors 16 at a time: background and sprite halves of the palette are each one pshufb
+ * table, bit 4 picks between them and the clear color goes in where the index is PALETTE_INDEX_CLEARED
+ */
+__attribute__((target("ssse3")))
+static void lookupColorsSsse3(const tCPU::byte *palette, tCPU::byte *pixels) {
+    const __m128i backgroundColors = _mm_loadu_si128((const __m128i *) palette);
+    const __m128i spriteColors = _mm_loadu_si128((const __m128i *) (palette + 16));
+    const __m128i clearColor = _mm_set1_epi8(palette[PALETTE_INDEX_CLEARED]);
+    const __m128i cleared = _mm_set1_epi8(PALETTE_INDEX_CLEARED);
+    const __m128i spriteBit = _mm_set1_epi8(16);
+
+    for (int x = 0; x < 256; x += 16) {
+        __m128i indices = _mm_loadu_si128((const __m128i *) (pixels + x));
+        __m128i isSprite = _mm_cmpeq_epi8(_mm_and_si128(indices, spriteBit), spriteBit);
+        __m128i isCleared = _mm_cmpeq_epi8(indices, cleared);
+
+        // indices stay under 0x80, so pshufb only sees their low 4 bits
+        __m128i colors = _mm_or_si128(_mm_and_si128(isSprite, _mm_shuffle_epi8(spriteColors, indices)),
+                                      _mm_andnot_si128(isSprite, _mm_shuffle_epi8(backgroundColors, indices)));
+        colors = _mm_or_si128(_mm_and_si128(isCleared, clearColor), _mm_andnot_si128(isCleared, colors));
+        _mm_storeu_si128((__m128i *) (pixels + x), colors);
+    }
+}
+
+/**
+ * Same as the SSSE3 lookup, 32 at a time with the tables repeated in both lanes
+ */
+__attribute__((target("avx2")))
+static void lookupColorsAvx2(const tCPU::byte *palette, tCPU::byte *pixels) {
+    const __m256i backgroundColors = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) palette));
+    const __m256i spriteColors = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (palette + 16)));
+    const __m256i clearColor = _mm256_set1_epi8(palette[PALETTE_INDEX_CLEARED]);
+    const __m256i cleared = _mm256_set1_epi8(PALETTE_INDEX_CLEARED);
+    const __m256i spriteBit = _mm256_set1_epi8(16);
+
+    for (int x = 0; x < 256; x += 32) {
+        __m256i indices = _mm256_loadu_si256((const __m256i *) (pixels + x));
+        __m256i isSprite = _mm256_cmpeq_epi8(_mm256_and_si256(indices, spriteBit), spriteBit);
+        __m256i isCleared = _mm256_cmpeq_epi8(indices, cleared);
+
+        __m256i colors = _mm256_blendv_epi8(_mm256_shuffle_epi8(backgroundColors, indices),
+                                            _mm256_shuffle_epi8(spriteColors, indices), isSprite);
+        colors = _mm256_blendv_epi8(colors, clearColor, isCleared);
+        _mm256_storeu_si256((__m256i *) (pixels + x), colors);
+    }
+}
+#endif
+
+static void lookupColors(const tCPU::byte *palette, tCPU::byte *pixels) {
+#ifdef SCANLINE_COMPOSITOR_SHUFFLE
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (avx2) {
+        lookupColorsAvx2(palette, pixels);
+        return;
+    }
+    if (ssse3) {
+        lookupColorsSsse3(palette, pixels);
+        return;
+    }
+#endif
+
+    lookupColorsScalar(palette, pixels);
+}
+
+bool
+ScanlineCompositor::composite(const ScanlineLayers &layers, const tCPU::byte *palette,
+                              tCPU::byte *output, tCPU::byte *backgroundMask, tCPU::byte *spriteMask) {
+    const __m128i cleared = _mm_set1_epi8(PALETTE_INDEX_CLEARED);
+    const __m128i clearedMask = _mm_set1_epi8((char) 128);
+    const __m128i spriteMarker = _mm_set1_epi8((char) 0xF0);
+    const bool backgroundVisible = layers.backgroundVisible;
+    const bool writeMasks = backgroundMask != nullptr;
+
+    int sprite0Hit = 0;
+
+    for (int x = 0; x < 256; x += 16) {
+        __m128i spriteIndex = _mm_load_si128((const __m128i *) (layers.sprite + x));
+        __m128i spriteOpaque = _mm_load_si128((const __m128i *) (layers.spriteOpaque + x));
+
+        __m128i backgroundIndex, backgroundOpaque, backgroundLevels;
+        if (backgroundVisible) {
+            backgroundIndex = _mm_loadu_si128((const __m128i *) (layers.background + layers.fineX + x));
+            backgroundOpaque = _mm_loadu_si128((const __m128i *) (layers.backgroundOpaque + layers.fineX + x));
+
+            // dots drawn before the background came on mid-line are at the clear color
+            __m128i clearedDots = _mm_cmpeq_epi8(backgroundIndex, cleared);
+            backgroundLevels = _mm_or_si128(_mm_and_si128(clearedDots, clearedMask),
+                                            _mm_andnot_si128(clearedDots, maskLevels(backgroundIndex)));
+        } else {
+            backgroundIndex = cleared;
+            backgroundOpaque = _mm_setzero_si128();
+            backgroundLevels = clearedMask;
+        }
+
+        // sprite-0 hit: 16 lanes of (sprite 0 opaque AND background opaque)
+        __m128i sprite0Opaque = _mm_load_si128((const __m128i *) (layers.sprite0Opaque + x));
+        sprite0Hit |= _mm_movemask_epi8(_mm_and_si128(sprite0Opaque, backgroundOpaque));
+
+        // sprite wins wherever it was marked opaque during the sprite pass
+        __m128i final = _mm_or_si128(_mm_and_si128(spriteOpaque, spriteIndex),
+                                     _mm_andnot_si128(spriteOpaque, backgroundIndex));
+        _mm_storeu_si128((__m128i *) (output + x), final);
+
+        // debug masks: background levels bumped where a sprite covers them, sprite levels over the clear value
+        if (writeMasks) {
+            __m128i background = _mm_add_epi8(backgroundLevels, _mm_and_si128(spriteOpaque, spriteMarker));
+            __m128i sprite = _mm_or_si128(_mm_and_si128(spriteOpaque, maskLevels(spriteIndex)),
+                                          _mm_andnot_si128(spriteOpaque, clearedMask));
+            _mm_storeu_si128((__m128i *) (backgroundMask + x), background);
+            _mm_storeu_si128((__m128i *) (spriteMask + x), sprite);
+        }
+    }
+
+    // the indices are all in place, resolve their colors in one go
+    lookupColors(palette, output);
+
+    return sprite0Hit != 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Platform.h"
+
+// palette slot for pixels left at the clear color (background rendering disabled)
+static const int PALETTE_INDEX_CLEARED = 32;
+
+/**
+ * One scanline split into layers before compositing.
+ * Palette indices are 5-bit $3F00-relative addresses: 0-15 background, 16-31 sprites.
+ */
+struct ScanlineLayers {
+    // 33 tiles are decoded, the visible background starts at background[fineX]
+    alignas(16) tCPU::byte background[256 + 16];
+    alignas(16) tCPU::byte backgroundOpaque[256 + 16];
+    int fineX;
+    bool backgroundVisible;
+
+    // sprite pixel that won priority, 0xFF in spriteOpaque where it should be drawn
+    alignas(16) tCPU::byte sprite[256];
+    alignas(16) tCPU::byte spriteOpaque[256];
+
+    // 0xFF where sprite 0 has an opaque pixel, drawn or not
+    alignas(16) tCPU::byte sprite0Opaque[256];
+
+    void clearSprites();
+};
+
+/**
+ * Final pass of scanline rendering: blends background and sprite layers, resolves colors
+ * and writes the mask debug views. Blends 16 pixels at a time, then looks the colors up with
+ * SSSE3 shuffles (AVX2: 32 at a time) where the CPU has them.
+ */
+class ScanlineCompositor {
+public:
+    /**
+     * palette maps the 33 palette indices to NES color indices (see PaletteExpander), the last one
+     * for PALETTE_INDEX_CLEARED; output receives one NES color index per pixel.
+     * The masks are skipped when nullptr (no debugger showing them).
+     * Returns true when sprite 0 and the background are opaque on the same pixel.
+     */
+    static bool composite(const ScanlineLayers &layers, const tCPU::byte *palette,
+                          tCPU::byte *output, tCPU::byte *backgroundMask, tCPU::byte *spriteMask);
+};
@@ -0,0 +1,56 @@
+#include "TileCache.h"
+#include <string.h>
+
+// bit 7-n of a bitplane byte spread into byte n (plain) or byte 7-n (flipped)
+static uint64_t expandPlane[256];
+static uint64_t expandPlaneFlipped[256];
+
+static void buildExpansionTables() {
+    for (int value = 0; value < 256; value++) {
+        uint64_t plain = 0, flipped = 0;
+        for (int column = 0; column < 8; column++) {
+            if (value & (0x80 >> column)) {
+                plain |= (uint64_t) 1 << (column * 8);
+                flipped |= (uint64_t) 1 << ((7 - column) * 8);
+            }
+        }
+        expandPlane[value] = plain;
+        expandPlaneFlipped[value] = flipped;
+    }
+}
+
+TileCache::TileCache() {
+    if (expandPlane[0x80] == 0) {
+        buildExpansionTables();
+    }
+    invalidateAll();
+}
+
+void
+TileCache::decode(int tile, const tCPU::byte *planes) {
+    uint64_t *plain = rows + tile * 8;
+    uint64_t *flipped = flippedRows + tile * 8;
+
+    for (int i = 0; i < 8; i++) {
+        plain[i] = expandPlane[planes[i]] | (expandPlane[planes[i + 8]] << 1);
+        flipped[i] = expandPlaneFlipped[planes[i]] | (expandPlaneFlipped[planes[i + 8]] << 1);
+    }
+
+    valid[tile] = true;
+}
+
+void
+TileCache::invalidate(tCPU::word address, int length) {
+    int first = (address >> 4) & 0x1FF;
+    int last = ((address + length - 1) >> 4) & 0x1FF;
+    generation++;
+    for (int tile = first; tile <= last; tile++) {
+        valid[tile] = false;
+    }
+}
+
+void
+TileCache::invalidateAll() {
+    memset(valid, 0, sizeof(valid));
+    generation++;
+}
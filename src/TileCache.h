@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Platform.h"
+
+/**
+ * Decoded pattern table rows for the 512 tiles visible at PPU $0000-$1FFF.
+ * Each tile row is 8 bytes, one 2-bit palette index per pixel, leftmost pixel first,
+ * stored both plain and horizontally flipped so a renderer fetch is a single 8-byte load.
+ * Tiles are decoded lazily and dropped on CHR-RAM writes and CHR bank switches.
+ */
+class TileCache {
+public:
+    TileCache();
+
+    static const int NUM_TILES = 512;
+
+    bool isValid(int tile) const {
+        return valid[tile];
+    }
+
+    // decode 16 bytes of bitplanes (8 low plane rows, then 8 high plane rows)
+    void decode(int tile, const tCPU::byte *planes);
+
+    // decoded row for a pattern address in $0000-$1FFF (plane 0 byte of the row)
+    uint64_t row(tCPU::word address, bool flipped) const {
+        int index = ((address >> 4) & 0x1FF) * 8 + (address & 7);
+        return flipped ? flippedRows[index] : rows[index];
+    }
+
+    // drop tiles overlapping [address, address + length) of pattern space
+    void invalidate(tCPU::word address, int length = 1);
+
+    void invalidateAll();
+
+    // bumped on every invalidation, lets callers tell whether pattern memory may have changed
+    tCPU::dword getGeneration() const {
+        return generation;
+    }
+
+private:
+    tCPU::dword generation = 0;
+
+    bool valid[NUM_TILES];
+    uint64_t rows[NUM_TILES * 8];
+    uint64_t flippedRows[NUM_TILES * 8];
+};
@@ -0,0 +1,107 @@
+#include "Watchpoints.h"
+#include "Logging.h"
+#include <cstring>
+#include <algorithm>
+
+bool Watchpoints::Armed = false;
+const tCPU::byte Watchpoints::Unwatched[256] = {0};
+
+Watchpoints::Watchpoints() {
+    memset(pages, 0, sizeof(pages));
+}
+
+/**
+ * Watch an inclusive address range for the given access types
+ * Returns an id for remove()
+ */
+int
+Watchpoints::add(WatchBus bus, tCPU::word start, tCPU::word end, tCPU::byte types) {
+    Watchpoint watchpoint;
+    watchpoint.id = nextId++;
+    watchpoint.bus = bus;
+    watchpoint.start = std::min(start, end);
+    watchpoint.end = std::max(start, end);
+    watchpoint.types = types;
+    watchpoints.push_back(watchpoint);
+
+    PrintInfo("Watchpoint #%d on %s $%04X-$%04X (%s%s%s)", watchpoint.id, bus == WATCH_BUS_CPU ? "CPU" : "PPU",
+              watchpoint.start, watchpoint.end,
+              types & WATCH_READ ? "r" : "", types & WATCH_WRITE ? "w" : "", types & WATCH_EXECUTE ? "x" : "");
+
+    rebuildPageTables();
+    return watchpoint.id;
+}
+
+void
+Watchpoints::remove(int id) {
+    watchpoints.erase(std::remove_if(watchpoints.begin(), watchpoints.end(), [id](const Watchpoint &watchpoint) {
+        return watchpoint.id == id;
+    }), watchpoints.end());
+
+    rebuildPageTables();
+}
+
+void
+Watchpoints::clear() {
+    watchpoints.clear();
+    hitPending = false;
+    rebuildPageTables();
+}
+
+bool
+Watchpoints::watches(WatchBus bus, WatchType type) {
+    return std::any_of(watchpoints.begin(), watchpoints.end(), [bus, type](const Watchpoint &watchpoint) {
+        return watchpoint.bus == bus && (watchpoint.types & type);
+    });
+}
+
+/**
+ * Flag every 256-byte page touched by a watchpoint with its access types
+ */
+void
+Watchpoints::rebuildPageTables() {
+    memset(pages, 0, sizeof(pages));
+
+    for (auto &watchpoint : watchpoints) {
+        for (int page = watchpoint.start >> 8; page <= watchpoint.end >> 8; page++) {
+            pages[watchpoint.bus][page] |= watchpoint.types;
+        }
+    }
+
+    Armed = !watchpoints.empty();
+}
+
+/**
+ * Page matched, now test the exact ranges
+ * First hit is kept until pulled so the pause reports the access that stopped us
+ */
+void
+Watchpoints::check(WatchBus bus, WatchType type, tCPU::word address, tCPU::byte value) {
+    if (hitPending) {
+        return;
+    }
+
+    for (auto &watchpoint : watchpoints) {
+        if (watchpoint.bus == bus && (watchpoint.types & type) && address >= watchpoint.start &&
+            address <= watchpoint.end) {
+            lastHit.id = watchpoint.id;
+            lastHit.bus = bus;
+            lastHit.type = type;
+            lastHit.address = address;
+            lastHit.value = value;
+            hitPending = true;
+            return;
+        }
+    }
+}
+
+bool
+Watchpoints::pullHit(WatchpointHit &hit) {
+    if (!hitPending) {
+        return false;
+    }
+
+    hit = lastHit;
+    hitPending = false;
+    return true;
+}
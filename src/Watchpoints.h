@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Platform.h"
+#include <vector>
+
+enum WatchType {
+    WATCH_READ = 1 << 0,
+    WATCH_WRITE = 1 << 1,
+    WATCH_EXECUTE = 1 << 2
+};
+
+enum WatchBus {
+    WATCH_BUS_CPU = 0,
+    WATCH_BUS_PPU = 1
+};
+
+struct Watchpoint {
+    int id;
+    WatchBus bus;
+    // inclusive address range
+    tCPU::word start;
+    tCPU::word end;
+    // combination of WatchType bits
+    tCPU::byte types;
+};
+
+/**
+ * The access that tripped a watchpoint
+ */
+struct WatchpointHit {
+    int id;
+    WatchBus bus;
+    WatchType type;
+    tCPU::word address;
+    tCPU::byte value;
+};
+
+/**
+ * Read/write/execute watchpoints on CPU and PPU address space.
+ * Each bus has a page table with the watch types present on every 256-byte page.
+ * Accesses only take the slow path through check() when their page is flagged,
+ * every other page keeps its direct access path.
+ */
+class Watchpoints {
+public:
+    Watchpoints();
+
+    int add(WatchBus bus, tCPU::word start, tCPU::word end, tCPU::byte types);
+
+    void remove(int id);
+
+    void clear();
+
+    const tCPU::byte *getPageTable(WatchBus bus) {
+        return pages[bus];
+    }
+
+    // true when any watchpoint on the bus watches accesses of this type
+    bool watches(WatchBus bus, WatchType type);
+
+    // slow path, called for accesses on watched pages only
+    void check(WatchBus bus, WatchType type, tCPU::word address, tCPU::byte value);
+
+    // true once after a watchpoint tripped; emulation pauses before the next instruction
+    bool pullHit(WatchpointHit &hit);
+
+    // set while any watchpoint exists, gates the per-instruction execute check
+    static bool Armed;
+
+    // page table for components with no watchpoints attached
+    static const tCPU::byte Unwatched[256];
+
+private:
+    void rebuildPageTables();
+
+    std::vector<Watchpoint> watchpoints;
+    tCPU::byte pages[2][256];
+    int nextId = 1;
+
+    bool hitPending = false;
+    WatchpointHit lastHit;
+};
@@ -7,6 +7,11 @@
 #include "GUI.h"
 #include "Joypad.h"
 #include "Audio.h"
+#include "CodeDataLogger.h"
+#include "MemoryHeatmap.h"
+#include "DMA.h"
+#include "RenderPipeline.h"
+#include "DebugViews.h"
 
 #include <iostream>
 #include <typeinfo>
@@ -25,7 +30,34 @@
 using namespace std::chrono_literals;
 typedef std::chrono::high_resolution_clock clock_type;
 
-void collectInputEvents(Joypad *pJoypad, bool *pBoolean);
+// draw every Nth frame; frames in between still run, without pixel generation (fast-forward, bots)
+#define RENDER_EVERY_NTH_FRAME 1
+
+// rasterize on a second thread while the cpu runs ahead; not with the heatmap or code/data log compiled in,
+// nor with PPU read watchpoints
+#define RENDER_THREAD_ENABLED true
+
+// 0 streams scanlines to the renderer thread as they are emulated; N splits each frame across N threads
+// at vblank instead, for offline rendering where frame latency beats CPU efficiency
+#define RENDER_WORKERS 0
+
+// show the debugger's render view through the CPU NTSC composite filter
+#define NTSC_FILTER_ENABLED false
+
+// window with the frame upscaled on the CPU, 0 keeps it closed; hq2x and xBR scale 2 or 4 times
+#define SCALE_FILTER SCALE_XBR
+#define SCALE_FACTOR 0
+
+// frames between PPU debugger view refreshes, 6 is 10 Hz
+#define DEBUG_VIEW_REFRESH_FRAMES 6
+
+// overclocking: idle scanlines after vblank where only the CPU runs, against slowdown; -/= adjust at runtime
+#define OVERCLOCK_SCANLINES 0
+#define OVERCLOCK_STEP 20
+
+void collectInputEvents(Joypad *pJoypad, bool *pBoolean, bool *paused, PPU *ppu, LagMeter *lagMeter);
+
+void printLagFrames(PPU *ppu, LagMeter *lagMeter);
 
 void printLibVersions();
 
@@ -69,25 +101,66 @@ int main(int argc, char **argv) {
     // cpu memory
     auto memory = new Memory(mmio);
     mmio->setMemory(memory);
+    // oam transfers
+    auto dma = new DMA(memory, ppu);
+    mmio->useDMA(dma);
+    // lag frames, and how many of them overclocking removes
+    auto lagMeter = new LagMeter();
+    mmio->useLagMeter(lagMeter);
+    ppu->setExtraScanlines(OVERCLOCK_SCANLINES);
     // cpu registers
     auto registers = new Registers();
     // cpu stack
     auto stack = new Stack(memory, registers);
     // rendering
     auto gui = new GUI(raster);
+    gui->showNtscFilter = NTSC_FILTER_ENABLED;
+    gui->scaleFilter = SCALE_FILTER;
+    gui->scaleFactor = SCALE_FACTOR;
+    // pattern table, nametable, attribute and palette views, redrawn off-thread when they change
+    auto debugViews = new DebugViews(raster);
+    debugViews->setRefreshInterval(DEBUG_VIEW_REFRESH_FRAMES);
 
     // memory mapper
     auto mmc = new MemoryMapper(ppu->getPpuRam(), memory->getByteArray());
     ppu->useMemoryMapper(mmc);
     memory->useMemoryMapper(mmc);
+    mmc->setPPU(ppu);
+
+    // debugger watchpoints, unwatched pages keep their direct access path
+    auto watchpoints = new Watchpoints();
+    memory->useWatchpoints(watchpoints);
+    ppu->useWatchpoints(watchpoints);
+//    watchpoints->add(WATCH_BUS_CPU, 0x0700, 0x07FF, WATCH_WRITE);
+//    watchpoints->add(WATCH_BUS_CPU, 0x8057, 0x8057, WATCH_EXECUTE);
+//    watchpoints->add(WATCH_BUS_PPU, 0x3F00, 0x3F1F, WATCH_WRITE);
 
     // cpu
     auto cpu = new CPU(registers, memory, stack);
+    cpu->useDMA(dma);
     cpu->load(rom);
 
     // load rom into memory mapper last, as it may override PRG ROM
     mmc->loadRom(rom);
 
+    // code/data log, compiled in with CDL_ENABLED
+    if (CodeDataLog::IsEnabled) {
+        CodeDataLogger::attach(mmc, rom);
+    }
+
+    // cheats patch PRG ROM banks as they are mapped in
+//    mmc->addCheat(Cheats::decode("SXIOPO")); // super mario bros: infinite lives
+//    mmc->addCheat(Cheats::decode("90A5:00:03"));
+
+    // renderer thread, started once the mapper has laid out PPU memory. Background and sprite fetches happen
+    // on the renderer's own PPU, which has no watchpoints, so watched PPU reads keep rendering inline.
+    RenderPipeline *pipeline = nullptr;
+    bool ppuReadsWatched = watchpoints->watches(WATCH_BUS_PPU, WATCH_READ);
+    if (RENDER_THREAD_ENABLED && !Heatmap::IsEnabled && !CodeDataLog::IsEnabled && !ppuReadsWatched) {
+        pipeline = new RenderPipeline(raster, RENDER_WORKERS);
+        ppu->usePipeline(pipeline);
+    }
+
     // read PC from RESET vector
     cpu->reset();
 
@@ -96,22 +169,6 @@ int main(int argc, char **argv) {
 
     PrintDbg("Reset program-counter to 0x%X", registers->PC);
 
-    // https://www.pagetable.com/?p=410
-    auto doVblankNMI = [&]() {
-        // clear break flag
-        registers->P.B = 0;
-        stack->pushStackWord(registers->PC);
-        stack->pushStackByte(registers->P.asByte());
-
-        // disable irq
-        registers->P.I = 1;
-        tCPU::word address = memory->readWord(0xFFFA);
-
-        registers->PC = address;
-
-        cpu->addCycles(7);
-    };
-
     PrintInfo("registers->PC = 0x%X", registers->PC);
 
 //    Loggy::Enabled = Loggy::DEBUG;
@@ -173,7 +230,36 @@ int main(int argc, char **argv) {
 #endif
 
     bool alive = true;
+    bool paused = false;
+    // resuming from an execute watchpoint must not trip it again
+    bool skipExecuteWatch = false;
+    uint64_t frameCount = 0;
     while (alive) {
+        if (Watchpoints::Armed) {
+            if (!skipExecuteWatch && watchpoints->getPageTable(WATCH_BUS_CPU)[registers->PC >> 8] & WATCH_EXECUTE) {
+                watchpoints->check(WATCH_BUS_CPU, WATCH_EXECUTE, registers->PC, memory->readByteDirectly(registers->PC));
+            }
+            skipExecuteWatch = false;
+
+            // reads and writes trip during the previous instruction, execute before the next one
+            WatchpointHit hit;
+            if (watchpoints->pullHit(hit)) {
+                const char *types[] = {"", "read", "write", "", "execute"};
+                PrintInfo("Watchpoint #%d hit: %s %s $%04X = 0x%02X at PC $%04X (press P to resume)", hit.id,
+                          hit.bus == WATCH_BUS_CPU ? "CPU" : "PPU", types[hit.type], hit.address, hit.value,
+                          hit.type == WATCH_EXECUTE ? registers->PC : registers->LastPC);
+                paused = true;
+                skipExecuteWatch = hit.type == WATCH_EXECUTE;
+            }
+        }
+
+        // hold at the current instruction, keep the window responsive
+        while (paused && alive) {
+            gui->render();
+            collectInputEvents(joypad, &alive, &paused, ppu, lagMeter);
+            std::this_thread::sleep_for(16ms);
+        }
+
         // grab next instruction
         tCPU::byte opCode = memory->readByteDirectly(registers->PC);
 
@@ -183,12 +269,15 @@ int main(int argc, char **argv) {
         // step ppu in sync with cpu
         ppu->execute(cpuCycles * 3);
 
-        // step apu in sync with cpu
-        audio->execute(cpuCycles);
+        // step apu in sync with cpu, it stands still with the ppu during overclock scanlines
+        if (!ppu->isOverclocking()) {
+            audio->execute(cpuCycles);
+        }
 
         // super mario brothers will spin in a `jmp $8057` loop until vblank
-        if (ppu->pullNMI()) {
-            doVblankNMI();
+        // nmi and mapper irq share a single check, so games without irqs pay nothing extra
+        if (InterruptLines::Asserted) {
+            cpu->serviceInterrupts();
         }
 
 //        if(cpu->getCycleRuntime() > 100) {
@@ -196,12 +285,27 @@ int main(int argc, char **argv) {
 //        }
 
         if (ppu->enteredVBlank()) {
-            if(gui->showDebuggerPPU) {
-                ppu->renderDebug();
+            lagMeter->endFrame();
+            if (ppu->isFrameRendered()) {
+                if (pipeline != nullptr) {
+                    // last few scanlines of the frame may still be in flight
+                    pipeline->finish();
+                }
+                if(gui->showDebuggerPPU) {
+                    debugViews->update(ppu);
+                    if (Heatmap::IsEnabled) {
+                        MemoryHeatmap::decay();
+                        MemoryHeatmap::rasterize(raster->heatmap);
+                        raster->changedViews |= VIEW_HEATMAP;
+                    }
+                }
+                gui->render();
             }
-            gui->render();
-            ppu->clear();
-            collectInputEvents(joypad, &alive);
+            collectInputEvents(joypad, &alive, &paused, ppu, lagMeter);
+
+            // applies from the next frame's pre-render line
+            frameCount++;
+            ppu->setFrameRendering(frameCount % RENDER_EVERY_NTH_FRAME == 0);
 
             // throttle execution after every screen render
             auto now = std::chrono::high_resolution_clock::now();
@@ -224,13 +328,27 @@ int main(int argc, char **argv) {
 
 //    ProfilerStop();
 
+    if (CodeDataLog::IsEnabled) {
+        CodeDataLogger::save("nes.cdl");
+    }
+
     auto stop = clock_type::now();
     auto span = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
     auto freq = cpu->getCycleRuntime() / (span / 1e3);
     printf("Executed %lld cycles in %1.f seconds; %.1f microseconds per op; %.3f mhz (real 1.789 mhz)\n",
            cpu->getCycleRuntime(), span / 1e9,
            span / 1e3 / cpu->getCycleRuntime(), freq);
+    printLagFrames(ppu, lagMeter);
+
+    ScanlinePaths paths = ppu->getScanlinePaths();
+    uint64_t scanlines = paths.fast + paths.dot;
+    if (scanlines > 0) {
+        printf("Drew %llu scanlines; %.2f%% per scanline, %.2f%% dot by dot (mid-line register writes)\n",
+               (unsigned long long) scanlines, 100.0 * paths.fast / scanlines, 100.0 * paths.dot / scanlines);
+    }
 
+    delete pipeline;
+    delete debugViews;
     delete gui;
 
     audio->close();
@@ -283,6 +401,12 @@ Cartridge loadCartridge() {
 //    Cartridge rom = loader.loadCartridge("../roms/all-roms/USA/Bump'n'Jump (U).nes"); // doesn't boot
 //    Cartridge rom = loader.loadCartridge("../roms/mapper_3_no_bus_conflict_test.nes"); // doesn't work.
 
+    /////////////////////////////////////////////////
+// mapper=4 aka MMC3
+// 8KiB PRG and 1KiB CHR banks, scanline irq for status bars
+//    Cartridge rom = loader.loadCartridge("../roms/all-roms/USA/Super Mario Bros. 3 (U) (PRG1) [!].nes");
+//    Cartridge rom = loader.loadCartridge("../roms/all-roms/USA/Mega Man 3 (U) [!].nes");
+
 
     return rom;
 }
@@ -299,7 +423,19 @@ void printLibVersions() {
 
 // pump the event loop to ensure window visibility
 // collect keyboard events and send them in as joypad events
-void collectInputEvents(Joypad *joypad, bool *alive) {
+void printLagFrames(PPU *ppu, LagMeter *lagMeter) {
+    uint64_t frames = lagMeter->getFrames();
+    if (frames == 0) {
+        return;
+    }
+
+    printf("Lag frames: %llu of %llu (%.1f%%); %llu eliminated by %d extra scanlines\n",
+           (unsigned long long) lagMeter->getLagFrames(), (unsigned long long) frames,
+           100.0 * lagMeter->getLagFrames() / frames,
+           (unsigned long long) lagMeter->getEliminatedLagFrames(), ppu->getExtraScanlines());
+}
+
+void collectInputEvents(Joypad *joypad, bool *alive, bool *paused, PPU *ppu, LagMeter *lagMeter) {
     SDL_Event e;
     while (SDL_PollEvent(&e)) {
         switch (e.type) {
@@ -332,6 +468,28 @@ void collectInputEvents(Joypad *joypad, bool *alive) {
                     case SDLK_q:
                         *alive = false;
                         break;
+                    case SDLK_h:
+                        MemoryHeatmap::Counting = !MemoryHeatmap::Counting;
+                        printf("Heatmap counting %s\n", MemoryHeatmap::Counting ? "enabled" : "disabled");
+                        break;
+                    case SDLK_j:
+                        MemoryHeatmap::ViewBus = MemoryHeatmap::ViewBus == HEATMAP_BUS_CPU ? HEATMAP_BUS_PPU : HEATMAP_BUS_CPU;
+                        break;
+                    case SDLK_MINUS:
+                    case SDLK_EQUALS: {
+                        // report what the old setting did, then measure the new one from scratch
+                        printLagFrames(ppu, lagMeter);
+                        lagMeter->reset();
+
+                        int step = e.key.keysym.sym == SDLK_EQUALS ? OVERCLOCK_STEP : -OVERCLOCK_STEP;
+                        ppu->setExtraScanlines(ppu->getExtraScanlines() + step);
+                        printf("Overclocking with %d extra scanlines\n", ppu->getExtraScanlines());
+                    }
+                        break;
+                    case SDLK_p:
+                        *paused = !*paused;
+                        printf("Emulation %s\n", *paused ? "paused" : "resumed");
+                        break;
                     case SDLK_d:
                         if (Loggy::Enabled == Loggy::INFO) {
                             printf("Debug output enabled\n");
@@ -0,0 +1,176 @@
+#include "Logging.h"
+#include "Audio.h"
+#include "BandLimitedBuffer.h"
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+const int NUM_FRAMES = 600;
+const int CYCLES_PER_FRAME = 29781;
+const int CYCLES_PER_SCANLINE = 114;
+
+const double CPU_FREQUENCY = 1789773;
+const int SAMPLE_RATE = 44100;
+const int AUDIO_FRAME_CYCLES = 17898;
+const int SPECTRUM_SIZE = 16384;
+
+/**
+ * Frames of audio with a music engine's worth of register writes each, the cycles handed over a
+ * scanline at a time so the loop itself stays out of the measurement
+ */
+void measure(Audio &audio, const char *name) {
+    auto start = clock_type::now();
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        audio.setSquare1Envelope(0xB0 | (15 - frame % 8));
+        audio.setSquare2NoteLow(0x80 + frame % 16);
+        audio.setNoiseEnvelope(0x30 | (frame % 16));
+
+        for (int cycles = 0; cycles < CYCLES_PER_FRAME; cycles += CYCLES_PER_SCANLINE) {
+            audio.execute(CYCLES_PER_SCANLINE);
+        }
+    }
+    auto stop = clock_type::now();
+
+    long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    PrintInfo("%-28s %6.2f us per frame", name, (double) elapsed / NUM_FRAMES);
+}
+
+/**
+ * In-place radix-2 FFT, size a power of two
+ */
+void fft(std::vector<std::complex<double>> &x) {
+    int size = (int) x.size();
+    for (int i = 1, j = 0; i < size; i++) {
+        int bit = size >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            std::swap(x[i], x[j]);
+        }
+    }
+
+    for (int length = 2; length <= size; length <<= 1) {
+        std::complex<double> rotation = std::polar(1.0, -2 * M_PI / length);
+        for (int start = 0; start < size; start += length) {
+            std::complex<double> twiddle = 1;
+            for (int k = 0; k < length / 2; k++, twiddle *= rotation) {
+                std::complex<double> even = x[start + k], odd = x[start + k + length / 2] * twiddle;
+                x[start + k] = even + odd;
+                x[start + k + length / 2] = even - odd;
+            }
+        }
+    }
+}
+
+/**
+ * 50% duty square wave of a square channel's period, 0.6 s at the output rate. Band-limited it goes through
+ * BandLimitedBuffer as Audio does, otherwise the sequencer is read at each output sample like the old mixer.
+ */
+std::vector<float> synthesizeSquare(int period, bool bandLimited) {
+    const tCPU::dword halfWave = 8 * (period + 1);
+    const float amplitude = 0.25f;
+    std::vector<float> output;
+
+    if (!bandLimited) {
+        for (int i = 0; i < SAMPLE_RATE * 6 / 10; i++) {
+            auto cycle = (tCPU::dword) (i * CPU_FREQUENCY / SAMPLE_RATE);
+            output.push_back((cycle / halfWave) % 2 ? -amplitude : amplitude);
+        }
+        return output;
+    }
+
+    BandLimitedBuffer buffer(CPU_FREQUENCY, SAMPLE_RATE, 2048);
+    int16_t samples[2048];
+    float level = 0;
+    tCPU::dword time = 0;
+    for (int frame = 0; frame < 60; frame++) {
+        for (; time < AUDIO_FRAME_CYCLES; time += halfWave) {
+            float next = level == amplitude ? -amplitude : amplitude;
+            buffer.addDelta(time, next - level);
+            level = next;
+        }
+        time -= AUDIO_FRAME_CYCLES;
+        buffer.endFrame(AUDIO_FRAME_CYCLES);
+
+        int count = buffer.readSamples(samples, 2048);
+        for (int i = 0; i < count; i++) {
+            output.push_back(samples[i] / 32768.0f);
+        }
+    }
+    return output;
+}
+
+/**
+ * How far the energy off a square's harmonics sits below the energy on them, in dB. The last
+ * SPECTRUM_SIZE samples under a Hann window, bins within 4 of a harmonic count as the harmonic,
+ * everything else up to 20 kHz is aliasing.
+ */
+double inharmonicRatio(const std::vector<float> &signal, double fundamental) {
+    std::vector<std::complex<double>> spectrum(SPECTRUM_SIZE);
+    size_t first = signal.size() - SPECTRUM_SIZE;
+    for (int i = 0; i < SPECTRUM_SIZE; i++) {
+        spectrum[i] = signal[first + i] * (0.5 - 0.5 * cos(2 * M_PI * i / SPECTRUM_SIZE));
+    }
+    fft(spectrum);
+
+    const double binWidth = (double) SAMPLE_RATE / SPECTRUM_SIZE;
+    double harmonic = 0, inharmonic = 0;
+    for (int bin = 1; bin * binWidth <= 20000; bin++) {
+        double harmonics = bin * binWidth / fundamental;
+        double distance = fabs(harmonics - round(harmonics)) * fundamental / binWidth;
+        (distance <= 4 ? harmonic : inharmonic) += std::norm(spectrum[bin]);
+    }
+    return 10 * log10(harmonic / inharmonic);
+}
+
+/**
+ * Aliasing of squares from 440 Hz to 5.3 kHz, band-limited against point-sampled
+ */
+void measureAliasing() {
+    for (int period : {253, 100, 40, 20}) {
+        double fundamental = CPU_FREQUENCY / (16 * (period + 1));
+        PrintInfo("square %5.0f Hz: inharmonic energy %4.1f dB below the harmonics, point-sampled %4.1f dB",
+                  fundamental, inharmonicRatio(synthesizeSquare(period, true), fundamental),
+                  inharmonicRatio(synthesizeSquare(period, false), fundamental));
+    }
+}
+
+/**
+ * Cost of band-limited synthesis per video frame as channels join in, and how much it aliases
+ * g++ -std=c++17 -O1 -I .. AudioSynthesis.cpp ../Audio.cpp ../BandLimitedBuffer.cpp ../Logging.cpp
+ *     -lSDL2 -lfftw3
+ */
+int main() {
+    Raster raster;
+    Audio audio(&raster);
+    audio.setChannelStatus(0x0F);
+
+    measure(audio, "silent");
+
+    audio.setSquare1NoteLow(0xFD);
+    audio.setSquare1NoteHigh(0xF8);
+    measure(audio, "square 1 (440 Hz)");
+
+    audio.setSquare2Envelope(0x7A);
+    audio.setSquare2NoteHigh(0xF9);
+    measure(audio, "+ square 2");
+
+    audio.setTriangleDuration(0xFF);
+    audio.setTrianglePeriodLow(0x40);
+    audio.setTrianglePeriodHigh(0xF9);
+    measure(audio, "+ triangle");
+
+    audio.setNoisePeriod(0x04);
+    audio.setNoiseLength(0xF8);
+    measure(audio, "+ noise (period 64)");
+
+    audio.close();
+
+    measureAliasing();
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include "Logging.h"
+#include "ScanlineCompositor.h"
+#include "PaletteExpander.h"
+#include <chrono>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+const int NUM_SCANLINES = 240;
+const int NUM_FRAMES = 200;
+
+const int SPRITES_PER_LINE = 8;
+
+/**
+ * One sprite's row on a scanline as the sprite pass sees it
+ */
+struct SpriteRow {
+    int x;
+    bool oamSprite0;
+    bool behindBackground;
+    tCPU::byte upperBits;
+    tCPU::byte pixels[8];
+};
+
+/**
+ * Scanline inputs: decoded background with its opacity, as pass 1 leaves them, and the sprites
+ * on the line in OAM order
+ */
+struct Scanline {
+    tCPU::byte background[256 + 16];
+    tCPU::byte backgroundOpaque[256 + 16];
+    int fineX;
+    bool backgroundVisible;
+    SpriteRow sprites[SPRITES_PER_LINE];
+};
+
+Scanline scanlines[NUM_SCANLINES];
+ScanlineLayers layers;
+tCPU::byte palette[PALETTE_INDEX_CLEARED + 1];
+
+tCPU::byte screen[NUM_SCANLINES * 256], referenceScreen[NUM_SCANLINES * 256];
+tCPU::byte backgroundMask[NUM_SCANLINES * 256], referenceBackgroundMask[NUM_SCANLINES * 256];
+tCPU::byte spriteMask[NUM_SCANLINES * 256], referenceSpriteMask[NUM_SCANLINES * 256];
+bool hits[NUM_SCANLINES], referenceHits[NUM_SCANLINES];
+
+tCPU::byte emphasis[NUM_SCANLINES];
+tCPU::dword expanded[NUM_SCANLINES * 256], referenceExpanded[NUM_SCANLINES * 256];
+
+/**
+ * Random backgrounds with a handful of sprites per line, a few lines with background rendering off,
+ * sprite 0 on every fourth line and some sprites behind the background
+ */
+void initializeScanlines() {
+    srand(2015);
+
+    for (auto &color : palette) {
+        color = rand() & 0x3F;
+    }
+    palette[PALETTE_INDEX_CLEARED] = COLOR_INDEX_CLEARED;
+
+    for (int y = 0; y < NUM_SCANLINES; y++) {
+        Scanline &line = scanlines[y];
+        line.backgroundVisible = (y % 16) != 0;
+        emphasis[y] = y / 32;
+        line.fineX = rand() % 8;
+
+        for (int x = 0; x < 256 + 16; x++) {
+            int lowerBits = rand() & 3;
+            line.background[x] = lowerBits ? ((rand() & 3) << 2 | lowerBits) : 0;
+            line.backgroundOpaque[x] = lowerBits ? 0xFF : 0;
+        }
+
+        for (int n = 0; n < SPRITES_PER_LINE; n++) {
+            SpriteRow &sprite = line.sprites[n];
+            sprite.x = rand() % 249;
+            sprite.oamSprite0 = n == 0 && (y % 4) == 0;
+            sprite.behindBackground = (rand() % 3) == 0;
+            sprite.upperBits = rand() & 3;
+            for (auto &pixel : sprite.pixels) {
+                pixel = rand() & 3;
+            }
+        }
+    }
+}
+
+/**
+ * Passes 1 and 2 of PPU::renderScanline on decoded rows, then the compositor
+ */
+bool composite(const Scanline &line, tCPU::byte *output, tCPU::byte *background, tCPU::byte *sprite) {
+    memcpy(layers.background, line.background, sizeof(layers.background));
+    memcpy(layers.backgroundOpaque, line.backgroundOpaque, sizeof(layers.backgroundOpaque));
+    layers.fineX = line.fineX;
+    layers.backgroundVisible = line.backgroundVisible;
+
+    layers.clearSprites();
+    for (const SpriteRow &row : line.sprites) {
+        for (int column = 0; column < 8; column++) {
+            tCPU::byte colorLowerBits = row.pixels[column];
+            if (!colorLowerBits) {
+                continue;
+            }
+
+            auto screenX = row.x + column;
+            if (row.oamSprite0) {
+                layers.sprite0Opaque[screenX] = 0xFF;
+            }
+
+            bool hidden = row.behindBackground && (!layers.backgroundVisible
+                                                   || layers.backgroundOpaque[layers.fineX + screenX]
+                                                   || layers.spriteOpaque[screenX]);
+            if (!hidden) {
+                layers.sprite[screenX] = 0x10 | row.upperBits << 2 | colorLowerBits;
+                layers.spriteOpaque[screenX] = 0xFF;
+            }
+        }
+    }
+
+    return ScanlineCompositor::composite(layers, palette, output, background, sprite);
+}
+
+/**
+ * Baseline renderScanline's per-pixel blend: background written first, then every sprite in OAM
+ * order against the background mask, sprite 0 tested right after drawing its pixel
+ */
+bool compositeReference(const Scanline &line, tCPU::byte *output, tCPU::byte *background, tCPU::byte *sprite) {
+    bool sprite0Hit = false;
+
+    for (int x = 0; x < 256; x++) {
+        output[x] = palette[PALETTE_INDEX_CLEARED];
+        background[x] = 128;
+        sprite[x] = 128;
+    }
+
+    if (line.backgroundVisible) {
+        for (int x = 0; x < 256; x++) {
+            tCPU::byte index = line.background[line.fineX + x];
+            output[x] = palette[index];
+            background[x] = (index & 3) * 64;
+        }
+    }
+
+    for (const SpriteRow &row : line.sprites) {
+        for (int column = 0; column < 8; column++) {
+            tCPU::byte colorLowerBits = row.pixels[column];
+            auto screenX = row.x + column;
+
+            if ((!row.behindBackground || background[screenX] == 0) && colorLowerBits) {
+                output[screenX] = palette[0x10 | row.upperBits << 2 | colorLowerBits];
+                sprite[screenX] = colorLowerBits * 64;
+                background[screenX] += 0xf0;
+            }
+
+            if (row.oamSprite0 && background[screenX] != 0 && colorLowerBits != 0) {
+                sprite0Hit = true;
+            }
+        }
+    }
+
+    return sprite0Hit;
+}
+
+long measure(bool reference) {
+    clock_type::time_point start, stop;
+    clock_type::now();
+    clock_type::now();
+
+    start = clock_type::now();
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        for (int y = 0; y < NUM_SCANLINES; y++) {
+            if (reference) {
+                referenceHits[y] = compositeReference(scanlines[y], referenceScreen + y * 256,
+                                                      referenceBackgroundMask + y * 256,
+                                                      referenceSpriteMask + y * 256);
+            } else {
+                hits[y] = composite(scanlines[y], screen + y * 256, backgroundMask + y * 256, spriteMask + y * 256);
+            }
+        }
+    }
+    stop = clock_type::now();
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+}
+
+/**
+ * Indexed frame to BGRA, one table lookup per pixel vs PaletteExpander
+ */
+long measureExpansion(bool reference) {
+    clock_type::time_point start, stop;
+    clock_type::now();
+    clock_type::now();
+
+    start = clock_type::now();
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        if (reference) {
+            for (int y = 0; y < NUM_SCANLINES; y++) {
+                for (int x = 0; x < 256; x++) {
+                    referenceExpanded[y * 256 + x] = PaletteExpander::color(emphasis[y], screen[y * 256 + x]);
+                }
+            }
+        } else {
+            PaletteExpander::expand(screen, emphasis, expanded, NUM_SCANLINES);
+        }
+    }
+    stop = clock_type::now();
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+}
+
+/**
+ * Per-scanline cost of the layered sprite pass and SIMD composite vs the baseline per-pixel blend,
+ * then expanding the indexed frame. Pixels and masks have to match the baseline exactly,
+ * sprite-0 hits are counted where they differ.
+ * g++ -std=c++17 -O2 -I .. Compositor.cpp ../ScanlineCompositor.cpp ../PaletteExpander.cpp ../Logging.cpp
+ */
+int main() {
+    initializeScanlines();
+
+    long simd = measure(false);
+    long scalar = measure(true);
+
+    assert(memcmp(screen, referenceScreen, sizeof(screen)) == 0);
+    assert(memcmp(spriteMask, referenceSpriteMask, sizeof(spriteMask)) == 0);
+
+    long expansion = measureExpansion(false);
+    long expansionReference = measureExpansion(true);
+    assert(memcmp(expanded, referenceExpanded, sizeof(expanded)) == 0);
+
+    int hitDifferences = 0, referenceHitCount = 0;
+    for (int y = 0; y < NUM_SCANLINES; y++) {
+        hitDifferences += hits[y] != referenceHits[y];
+        referenceHitCount += referenceHits[y];
+    }
+
+    // the background mask view marks sprite coverage once, the baseline added 0xF0 per overlapping sprite
+    int maskDifferences = 0;
+    for (int i = 0; i < NUM_SCANLINES * 256; i++) {
+        maskDifferences += backgroundMask[i] != referenceBackgroundMask[i];
+    }
+
+    const long numScanlines = NUM_FRAMES * NUM_SCANLINES;
+    PrintInfo("Background mask view: %d pixels differ", maskDifferences);
+    PrintInfo("Sprite-0 hits: %d lines in the baseline, %d lines differ", referenceHitCount, hitDifferences);
+    PrintInfo("Baseline per-pixel blend: %ld ns per scanline", scalar / numScanlines);
+    PrintInfo("Sprite layers + SIMD composite: %ld ns per scanline", simd / numScanlines);
+    PrintInfo("Per-pixel expansion: %ld us per frame", expansionReference / NUM_FRAMES / 1000);
+    PrintInfo("PaletteExpander: %ld us per frame", expansion / NUM_FRAMES / 1000);
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "Logging.h"
+#include "PPU.h"
+#include "DebugViews.h"
+#include "Interrupts.h"
+#include <cstdlib>
+#include <ctime>
+
+// normally provided by CPU.cpp
+tCPU::byte InterruptLines::Asserted = 0;
+
+const int NUM_FRAMES = 600;
+
+void writeVRam(PPU *ppu, tCPU::word address, tCPU::byte value) {
+    ppu->setVRamAddressRegister2(address >> 8);
+    ppu->setVRamAddressRegister2(address & 0xFF);
+    ppu->writeToVRam(value);
+}
+
+/**
+ * Random patterns, nametables and palette, 64 sprites spread over the screen
+ */
+void initializeMemory(PPU *ppu) {
+    srand(2015);
+
+    for (tCPU::word address = 0; address < 0x3000; address++) {
+        writeVRam(ppu, address, rand() & 0xFF);
+    }
+    for (tCPU::word address = 0x3F00; address < 0x3F20; address++) {
+        writeVRam(ppu, address, rand() & 0x3F);
+    }
+
+    tCPU::byte oam[256];
+    for (auto &value : oam) {
+        value = rand() & 0xFF;
+    }
+    ppu->StartSpriteXferDMA(oam);
+
+    // background and sprites on, left column shown
+    ppu->setControlRegister2(0x1E);
+}
+
+/**
+ * One frame with a scroll split, plus a nametable write in vblank so every view refresh has a
+ * changed nametable to redraw
+ */
+void emulateFrame(PPU *ppu, int frame) {
+    for (int scanline = 0; scanline < 262; scanline++) {
+        if (scanline == 32) {
+            ppu->setVRamAddressRegister1(frame & 0xFF);
+            ppu->setVRamAddressRegister1(0);
+        }
+        if (scanline == 250) {
+            writeVRam(ppu, 0x2000 + rand() % 0x3C0, rand() & 0xFF);
+            ppu->setVRamAddressRegister1(0);
+            ppu->setVRamAddressRegister1(0);
+        }
+        ppu->execute(341);
+    }
+}
+
+// CPU time of the calling thread, the debug view worker's drawing is not part of it
+long threadTime() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * Emulation thread CPU time per frame with scanlines drawn inline, debugger off (refreshInterval 0)
+ * or updating the debug views at vblank every refreshInterval frames
+ */
+long measure(int refreshInterval) {
+    auto raster = new Raster();
+    raster->createPpuDebugSurfaces();
+    auto ppu = new PPU(raster);
+    initializeMemory(ppu);
+
+    DebugViews *debugViews = nullptr;
+    if (refreshInterval) {
+        debugViews = new DebugViews(raster);
+        debugViews->setRefreshInterval(refreshInterval);
+    }
+
+    long start = threadTime();
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        emulateFrame(ppu, frame);
+        if (debugViews != nullptr) {
+            debugViews->update(ppu);
+        }
+    }
+    long total = threadTime() - start;
+
+    delete debugViews;
+    delete ppu;
+    delete raster;
+    return total / NUM_FRAMES;
+}
+
+/**
+ * What the PPU debugger costs the emulation thread, at 10 Hz and at every frame. Counts thread CPU time,
+ * so the worker's drawing stays out of it even on a single core. Texture uploads in the GUI are not included.
+ * g++ -std=c++17 -O2 -pthread -I .. DebugViewCost.cpp ../DebugViews.cpp ../PPU.cpp ../RenderPipeline.cpp
+ *     ../TileCache.cpp ../NametableCache.cpp ../ScanlineCompositor.cpp ../PaletteExpander.cpp
+ *     ../MemoryMapper.cpp ../Watchpoints.cpp ../Logging.cpp
+ */
+int main() {
+    long off = measure(0);
+    long tenHertz = measure(6);
+    long everyFrame = measure(1);
+
+    PrintInfo("debugger off:          %6ld us per frame", off / 1000);
+    PrintInfo("debugger at 10 Hz:     %6ld us per frame, %+.1f%%", tenHertz / 1000, (tenHertz - off) * 100.0 / off);
+    PrintInfo("debugger every frame:  %6ld us per frame, %+.1f%%", everyFrame / 1000,
+              (everyFrame - off) * 100.0 / off);
+    return 0;
+}
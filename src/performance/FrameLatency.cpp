@@ -0,0 +1,145 @@
+#include "Logging.h"
+#include "PPU.h"
+#include "RenderPipeline.h"
+#include "Interrupts.h"
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+// normally provided by CPU.cpp
+tCPU::byte InterruptLines::Asserted = 0;
+
+const int NUM_FRAMES = 300;
+const int VBLANK_SCANLINE = 241;
+
+void writeVRam(PPU *ppu, tCPU::word address, tCPU::byte value) {
+    ppu->setVRamAddressRegister2(address >> 8);
+    ppu->setVRamAddressRegister2(address & 0xFF);
+    ppu->writeToVRam(value);
+}
+
+/**
+ * Random patterns, nametables and palette, 64 sprites spread over the screen
+ */
+void initializeMemory(PPU *ppu) {
+    srand(2015);
+
+    for (tCPU::word address = 0; address < 0x3000; address++) {
+        writeVRam(ppu, address, rand() & 0xFF);
+    }
+    for (tCPU::word address = 0x3F00; address < 0x3F20; address++) {
+        writeVRam(ppu, address, rand() & 0x3F);
+    }
+
+    tCPU::byte oam[256];
+    for (auto &value : oam) {
+        value = rand() & 0xFF;
+    }
+    ppu->StartSpriteXferDMA(oam);
+
+    // background and sprites on, left column shown
+    ppu->setControlRegister2(0x1E);
+}
+
+/**
+ * Scanlines [from, to) of a frame with a scroll split and a nametable write, so frames differ and
+ * only the lines above the split can be reused
+ */
+void emulateScanlines(PPU *ppu, int frame, int from, int to) {
+    for (int scanline = from; scanline < to; scanline++) {
+        if (scanline == 32) {
+            ppu->setVRamAddressRegister1(frame & 0xFF);
+            ppu->setVRamAddressRegister1(0);
+        }
+        if (scanline == 250) {
+            writeVRam(ppu, 0x2000 + rand() % 0x3C0, rand() & 0xFF);
+            ppu->setVRamAddressRegister1(0);
+            ppu->setVRamAddressRegister1(0);
+        }
+        ppu->execute(341);
+    }
+}
+
+/**
+ * Average time per frame spent emulating and, when batched, waiting for the workers at vblank.
+ * Returns the emulation part in ns per frame.
+ */
+long measure(int workers, bool pipelined, bool rendering, bool nametableCache = true, bool reuse = false) {
+    auto raster = new Raster();
+    auto ppu = new PPU(raster);
+    ppu->setScanlineReuse(reuse);
+    ppu->setNametableCache(nametableCache);
+    initializeMemory(ppu);
+
+    RenderPipeline *pipeline = nullptr;
+    if (pipelined) {
+        pipeline = new RenderPipeline(raster, workers);
+        ppu->usePipeline(pipeline);
+    }
+
+    long emulation = 0, completion = 0;
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        ppu->setFrameRendering(rendering);
+
+        // the emulator finishes the raster where vblank starts, after the line holding dot 241:1
+        auto start = clock_type::now();
+        emulateScanlines(ppu, frame, 0, VBLANK_SCANLINE + 1);
+        auto vblank = clock_type::now();
+        if (pipeline != nullptr) {
+            pipeline->finish();
+        }
+        auto stop = clock_type::now();
+        emulateScanlines(ppu, frame, VBLANK_SCANLINE + 1, 262);
+        auto end = clock_type::now();
+
+        emulation += std::chrono::duration_cast<std::chrono::nanoseconds>((vblank - start) + (end - stop)).count();
+        completion += std::chrono::duration_cast<std::chrono::nanoseconds>(stop - vblank).count();
+    }
+
+    if (reuse) {
+        PrintInfo("%-24s emulation %6ld us per frame, %3d scanlines reused in the last frame",
+                  pipelined ? "streaming, reuse:" : "inline, reuse:", emulation / NUM_FRAMES / 1000,
+                  ppu->getReusedScanlines());
+    } else if (!pipelined) {
+        PrintInfo("%-24s emulation %6ld us per frame",
+                  !rendering ? "render-less:" : nametableCache ? "inline:" : "inline, tile fetches:",
+                  emulation / NUM_FRAMES / 1000);
+    } else if (workers == 0) {
+        PrintInfo("streaming:               emulation %6ld us, vblank to frame complete %6ld us",
+                  emulation / NUM_FRAMES / 1000, completion / NUM_FRAMES / 1000);
+    } else {
+        PrintInfo("batched, %2d workers:     emulation %6ld us, vblank to frame complete %6ld us",
+                  workers, emulation / NUM_FRAMES / 1000, completion / NUM_FRAMES / 1000);
+    }
+
+    delete pipeline;
+    delete ppu;
+    delete raster;
+    return emulation / NUM_FRAMES;
+}
+
+/**
+ * Frame completion latency against renderer thread count
+ * g++ -std=c++17 -O2 -pthread -I .. FrameLatency.cpp ../PPU.cpp ../RenderPipeline.cpp ../TileCache.cpp
+ *     ../NametableCache.cpp ../ScanlineCompositor.cpp ../PaletteExpander.cpp ../MemoryMapper.cpp
+ *     ../Watchpoints.cpp ../Logging.cpp
+ */
+int main() {
+    measure(0, false, false);
+    measure(0, false, true, false);
+    long inlined = measure(0, false, true);
+    long streamed = measure(0, true, true);
+    PrintInfo("streaming emulation thread time: %ld%% of inline", streamed * 100 / inlined);
+
+    // reuse happens on the renderer side, the emulation PPU has to report the same count
+    measure(0, false, true, true, true);
+    measure(0, true, true, true, true);
+
+    int cores = std::thread::hardware_concurrency();
+    for (int workers = 1; workers <= cores; workers *= 2) {
+        measure(workers, true, true);
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "Logging.h"
+#include "NtscFilter.h"
+#include "PaletteExpander.h"
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+const int NUM_FRAMES = 300;
+
+tCPU::byte indices[256 * 240];
+tCPU::byte emphasis[240];
+tCPU::dword output[NtscFilter::OUTPUT_WIDTH * 240];
+
+/**
+ * Runs of random colors, like tiles and sprites, a band of emphasized scanlines and a cleared one
+ */
+void initializeFrame() {
+    srand(2015);
+
+    for (int y = 0; y < 240; y++) {
+        tCPU::byte color = 0;
+        for (int x = 0; x < 256; x++) {
+            if (x % 8 == 0 || rand() % 16 == 0) {
+                color = rand() & 0x3F;
+            }
+            indices[y * 256 + x] = color;
+        }
+        emphasis[y] = y >= 200 && y < 216 ? (y / 2) & 7 : 0;
+    }
+
+    for (int x = 0; x < 256; x++) {
+        indices[100 * 256 + x] = COLOR_INDEX_CLEARED;
+    }
+}
+
+void measure(int threads) {
+    BandPool pool(threads);
+    NtscFilter filter(&pool);
+
+    auto start = clock_type::now();
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        filter.filter(indices, emphasis, output, frame % 3);
+    }
+    auto stop = clock_type::now();
+
+    long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    PrintInfo("NTSC filter, %2d threads: %4ld us per frame", threads + 1, elapsed / NUM_FRAMES);
+}
+
+/**
+ * NTSC filter cost per 602x240 frame against thread count
+ * g++ -std=c++17 -O2 -pthread -I .. NtscFilter.cpp ../NtscFilter.cpp ../BandPool.cpp ../PaletteExpander.cpp ../Logging.cpp
+ */
+int main() {
+    initializeFrame();
+
+    int cores = std::thread::hardware_concurrency();
+    for (int threads = 1; threads <= cores; threads *= 2) {
+        measure(threads - 1);
+    }
+    return 0;
+}
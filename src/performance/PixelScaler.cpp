@@ -0,0 +1,310 @@
+#include "Logging.h"
+#include "PixelScaler.h"
+#include "PaletteExpander.h"
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+const int NUM_FRAMES = 200;
+
+tCPU::byte indices[256 * 240];
+tCPU::byte emphasis[240];
+tCPU::dword output[1024 * 960];
+tCPU::dword reference[1024 * 960];
+
+/**
+ * 8x8 tiles of two colors with diagonal edges, so the EPX rules have something to smooth
+ */
+void initializeFrame() {
+    srand(2015);
+
+    for (int tileY = 0; tileY < 30; tileY++) {
+        for (int tileX = 0; tileX < 32; tileX++) {
+            tCPU::byte background = rand() & 0x3F, foreground = rand() & 0x3F;
+            int slope = rand() % 3 - 1;
+
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    bool inside = x > 3 + slope * (y - 4);
+                    indices[(tileY * 8 + y) * 256 + tileX * 8 + x] = inside ? foreground : background;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Reference hq2x and xBR, one pixel and one distance at a time straight from the colors,
+ * out-of-frame neighbours clamped to the edge
+ */
+struct Frame {
+    const tCPU::dword *pixels;
+    int width, height;
+
+    tCPU::dword at(int x, int y) const {
+        x = x < 0 ? 0 : x >= width ? width - 1 : x;
+        y = y < 0 ? 0 : y >= height ? height - 1 : y;
+        return pixels[y * width + x];
+    }
+};
+
+tCPU::dword toYuv(tCPU::dword color) {
+    int blue = color & 0xFF, green = color >> 8 & 0xFF, red = color >> 16 & 0xFF;
+    int y = (29 * blue + 77 * red + 150 * green) >> 8;
+    int u = ((128 * blue - 43 * red - 85 * green) >> 8) + 128;
+    int v = ((-21 * blue + 128 * red - 107 * green) >> 8) + 128;
+    return (tCPU::dword) (y << 16 | u << 8 | v);
+}
+
+int channel(tCPU::dword yuv, int shift) {
+    return yuv >> shift & 0xFF;
+}
+
+bool differs(tCPU::dword a, tCPU::dword b) {
+    a = toYuv(a), b = toYuv(b);
+    return abs(channel(a, 16) - channel(b, 16)) > 48 || abs(channel(a, 8) - channel(b, 8)) > 7
+           || abs(channel(a, 0) - channel(b, 0)) > 6;
+}
+
+int distance(tCPU::dword a, tCPU::dword b) {
+    a = toYuv(a), b = toYuv(b);
+    return abs(channel(a, 16) - channel(b, 16)) + abs(channel(a, 8) - channel(b, 8))
+           + abs(channel(a, 0) - channel(b, 0));
+}
+
+tCPU::dword mix(const tCPU::dword *colors, const int *weights, int count, int shift) {
+    tCPU::dword result = 0;
+    for (int shiftChannel = 0; shiftChannel < 32; shiftChannel += 8) {
+        int sum = 0;
+        for (int i = 0; i < count; i++) {
+            sum += (int) (colors[i] >> shiftChannel & 0xFF) * weights[i];
+        }
+        result |= (tCPU::dword) (sum >> shift) << shiftChannel;
+    }
+    return result;
+}
+
+tCPU::dword mix2(tCPU::dword a, int weightA, tCPU::dword b, int weightB, int shift) {
+    const tCPU::dword colors[2] = {a, b};
+    const int weights[2] = {weightA, weightB};
+    return mix(colors, weights, 2, shift);
+}
+
+tCPU::dword mix3(tCPU::dword a, int weightA, tCPU::dword b, int weightB, tCPU::dword c, int weightC, int shift) {
+    const tCPU::dword colors[3] = {a, b, c};
+    const int weights[3] = {weightA, weightB, weightC};
+    return mix(colors, weights, 3, shift);
+}
+
+// hq2x's top left quadrant on a mirrored 3x3 neighbourhood w
+tCPU::dword hq2xQuadrant(const tCPU::dword *w) {
+    int pattern = 0;
+    for (int neighbour = 0, bit = 0; neighbour < 9; neighbour++) {
+        if (neighbour != 4) {
+            pattern |= differs(w[4], w[neighbour]) << bit++;
+        }
+    }
+    auto P = [pattern](int mask, int value) {
+        return (pattern & mask) == value;
+    };
+
+    if ((P(0xbf, 0x37) || P(0xdb, 0x13)) && differs(w[1], w[5])) return mix2(w[4], 3, w[3], 1, 2);
+    if ((P(0xdb, 0x49) || P(0xef, 0x6d)) && differs(w[7], w[3])) return mix2(w[4], 3, w[1], 1, 2);
+    if ((P(0x0b, 0x0b) || P(0xfe, 0x4a) || P(0xfe, 0x1a)) && differs(w[3], w[1])) return w[4];
+    if ((P(0x6f, 0x2a) || P(0x5b, 0x0a) || P(0xbf, 0x3a) || P(0xdf, 0x5a) || P(0x9f, 0x8a) || P(0xcf, 0x8a)
+         || P(0xef, 0x4e) || P(0x3f, 0x0e) || P(0xfb, 0x5a) || P(0xbb, 0x8a) || P(0x7f, 0x5a) || P(0xaf, 0x8a)
+         || P(0xeb, 0x8a)) && differs(w[3], w[1])) return mix2(w[4], 3, w[0], 1, 2);
+    if (P(0x0b, 0x08)) return mix3(w[4], 2, w[0], 1, w[1], 1, 2);
+    if (P(0x0b, 0x02)) return mix3(w[4], 2, w[0], 1, w[3], 1, 2);
+    if (P(0x2f, 0x2f)) return mix3(w[4], 14, w[3], 1, w[1], 1, 4);
+    if (P(0xbf, 0x37) || P(0xdb, 0x13)) return mix3(w[4], 5, w[1], 2, w[3], 1, 3);
+    if (P(0xdb, 0x49) || P(0xef, 0x6d)) return mix3(w[4], 5, w[3], 2, w[1], 1, 3);
+    if (P(0x1b, 0x03) || P(0x4f, 0x43) || P(0x8b, 0x83) || P(0x6b, 0x43)) return mix2(w[4], 3, w[3], 1, 2);
+    if (P(0x4b, 0x09) || P(0x8b, 0x89) || P(0x1f, 0x19) || P(0x3b, 0x19)) return mix2(w[4], 3, w[1], 1, 2);
+    if (P(0x7e, 0x2a) || P(0xef, 0xab) || P(0xbf, 0x8f) || P(0x7e, 0x0e)) return mix3(w[4], 2, w[3], 3, w[1], 3, 3);
+    if (P(0xfb, 0x6a) || P(0x6f, 0x6e) || P(0x3f, 0x3e) || P(0xfb, 0xfa) || P(0xdf, 0xde) || P(0xdf, 0x1e))
+        return mix2(w[4], 3, w[0], 1, 2);
+    if (P(0x0a, 0x00) || P(0x4f, 0x4b) || P(0x9f, 0x1b) || P(0x2f, 0x0b) || P(0xbe, 0x0a) || P(0xee, 0x0a)
+        || P(0x7e, 0x0a) || P(0xeb, 0x4b) || P(0x3b, 0x1b)) return mix3(w[4], 2, w[3], 1, w[1], 1, 2);
+    return mix3(w[4], 6, w[3], 1, w[1], 1, 3);
+}
+
+void hq2xReference(const Frame &source, tCPU::dword *scaled) {
+    for (int y = 0; y < source.height; y++) {
+        for (int x = 0; x < source.width; x++) {
+            for (int quadrant = 0; quadrant < 4; quadrant++) {
+                // the neighbourhood mirrored so the quadrant is the top left one
+                int flipX = quadrant & 1 ? -1 : 1, flipY = quadrant & 2 ? -1 : 1;
+                tCPU::dword w[9];
+                for (int i = 0; i < 9; i++) {
+                    w[i] = source.at(x + (i % 3 - 1) * flipX, y + (i / 3 - 1) * flipY);
+                }
+                scaled[(y * 2 + quadrant / 2) * source.width * 2 + x * 2 + quadrant % 2] = hq2xQuadrant(w);
+            }
+        }
+    }
+}
+
+// xBR's bottom right corner of block, (dx, dy) rotated to the corner being worked on
+void xbrCorner(const Frame &source, int x, int y, int rotation, tCPU::dword block[4]) {
+    auto rotate = [rotation](int &dx, int &dy) {
+        for (int turn = 0; turn < rotation; turn++) {
+            int previous = dx;
+            dx = dy;
+            dy = -previous;
+        }
+    };
+    auto pixel = [&](int dx, int dy) {
+        rotate(dx, dy);
+        return source.at(x + dx, y + dy);
+    };
+    auto cell = [&](int dx, int dy) -> tCPU::dword & {
+        rotate(dx, dy);
+        return block[(dx > 0) + 2 * (dy > 0)];
+    };
+    auto eq = [](tCPU::dword a, tCPU::dword b) {
+        return distance(a, b) < 155;
+    };
+
+    tCPU::dword E = pixel(0, 0), I = pixel(1, 1), H = pixel(0, 1), F = pixel(1, 0), G = pixel(-1, 1);
+    tCPU::dword C = pixel(1, -1), D = pixel(-1, 0), B = pixel(0, -1);
+    tCPU::dword F4 = pixel(2, 0), I4 = pixel(2, 1), H5 = pixel(0, 2), I5 = pixel(1, 2);
+
+    if (E == H || E == F) {
+        return;
+    }
+    int e = distance(E, C) + distance(E, G) + distance(I, H5) + distance(I, F4) + 4 * distance(H, F);
+    int i = distance(H, D) + distance(H, I5) + distance(F, I4) + distance(F, B) + 4 * distance(E, I);
+    if (e > i) {
+        return;
+    }
+
+    tCPU::dword px = distance(E, F) <= distance(E, H) ? F : H;
+    tCPU::dword &n3 = cell(1, 1), &n2 = cell(-1, 1), &n1 = cell(1, -1);
+    if (e < i && ((!eq(F, B) && !eq(H, D)) || (eq(E, I) && !eq(F, I4) && !eq(H, I5)) || eq(E, G) || eq(E, C))) {
+        int ke = distance(F, G), ki = distance(H, C);
+        bool left = 2 * ke <= ki && E != G && D != G;
+        bool up = ke >= 2 * ki && E != C && B != C;
+
+        if (left && up) {
+            n3 = mix2(n3, 1, px, 7, 3);
+            n2 = mix2(n2, 3, px, 1, 2);
+            n1 = n2;
+        } else if (left) {
+            n3 = mix2(n3, 1, px, 3, 2);
+            n2 = mix2(n2, 3, px, 1, 2);
+        } else if (up) {
+            n3 = mix2(n3, 1, px, 3, 2);
+            n1 = mix2(n1, 3, px, 1, 2);
+        } else {
+            n3 = mix2(n3, 1, px, 1, 1);
+        }
+    } else {
+        n3 = mix2(n3, 1, px, 1, 1);
+    }
+}
+
+void xbrReference(const Frame &source, tCPU::dword *scaled) {
+    for (int y = 0; y < source.height; y++) {
+        for (int x = 0; x < source.width; x++) {
+            tCPU::dword E = source.at(x, y);
+            tCPU::dword block[4] = {E, E, E, E};
+            for (int rotation = 0; rotation < 4; rotation++) {
+                xbrCorner(source, x, y, rotation, block);
+            }
+            for (int cell = 0; cell < 4; cell++) {
+                scaled[(y * 2 + cell / 2) * source.width * 2 + x * 2 + cell % 2] = block[cell];
+            }
+        }
+    }
+}
+
+/**
+ * The scaler's hq2x and xBR at 2x and 4x against the references, pixel for pixel
+ */
+void verify(PixelScaler &scaler, ScaleFilter filter, const char *name) {
+    static tCPU::dword colors[256 * 240], doubled[512 * 480];
+    auto referenceFilter = filter == SCALE_HQ2X ? hq2xReference : xbrReference;
+
+    PaletteExpander::expand(indices, emphasis, colors, 240);
+    referenceFilter(Frame{colors, 256, 240}, doubled);
+
+    scaler.scale(filter, 2, indices, emphasis, output, 512 * sizeof(tCPU::dword));
+    for (int i = 0; i < 512 * 480; i++) {
+        assert(output[i] == doubled[i]);
+    }
+
+    referenceFilter(Frame{doubled, 512, 480}, reference);
+    scaler.scale(filter, 4, indices, emphasis, output, 1024 * sizeof(tCPU::dword));
+    for (int i = 0; i < 1024 * 960; i++) {
+        assert(output[i] == reference[i]);
+    }
+
+    int blended = 0;
+    for (int i = 0; i < 512 * 480; i++) {
+        blended += doubled[i] != colors[(i / 512 / 2) * 256 + (i % 512) / 2];
+    }
+    PrintInfo("%-8s matches the reference at 2x and 4x, %d of %d pixels at 2x differ from nearest", name, blended,
+              512 * 480);
+}
+
+const char *filterName(ScaleFilter filter) {
+    switch (filter) {
+        case SCALE_NEAREST:
+            return "nearest";
+        case SCALE_EPX:
+            return "EPX";
+        case SCALE_HQ2X:
+            return "hq2x";
+        case SCALE_XBR:
+            return "xBR";
+    }
+    return "";
+}
+
+void measure(PixelScaler &scaler, ScaleFilter filter, int factor, int threads) {
+    auto start = clock_type::now();
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        scaler.scale(filter, factor, indices, emphasis, output, 256 * factor * sizeof(tCPU::dword));
+    }
+    auto stop = clock_type::now();
+
+    long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    PrintInfo("%-8s %dx, %2d threads: %5ld us per frame", filterName(filter), factor, threads, elapsed / NUM_FRAMES);
+}
+
+/**
+ * hq2x and xBR checked against plain per-pixel versions, then the cost of each scaler at each factor
+ * against thread count
+ * g++ -std=c++17 -O2 -pthread -I .. PixelScaler.cpp ../PixelScaler.cpp ../BandPool.cpp ../PaletteExpander.cpp
+ *     ../Logging.cpp
+ */
+int main() {
+    initializeFrame();
+
+    {
+        BandPool pool(2);
+        PixelScaler scaler(&pool);
+        verify(scaler, SCALE_HQ2X, "hq2x");
+        verify(scaler, SCALE_XBR, "xBR");
+    }
+
+    int cores = std::thread::hardware_concurrency();
+    for (int threads = 1; threads <= cores; threads *= 2) {
+        BandPool pool(threads - 1);
+        PixelScaler scaler(&pool);
+
+        for (int factor = 2; factor <= 4; factor++) {
+            measure(scaler, SCALE_NEAREST, factor, threads);
+            measure(scaler, SCALE_EPX, factor, threads);
+            if (factor != 3) {
+                measure(scaler, SCALE_HQ2X, factor, threads);
+                measure(scaler, SCALE_XBR, factor, threads);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "Logging.h"
+#include "PPU.h"
+#include "Interrupts.h"
+#include <cassert>
+#include <chrono>
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+// normally provided by CPU.cpp
+tCPU::byte InterruptLines::Asserted = 0;
+
+const int NUM_FRAMES = 600;
+const int SPRITE_TOP = 50;
+
+void writeVRam(PPU *ppu, tCPU::word address, tCPU::byte value) {
+    ppu->setVRamAddressRegister2(address >> 8);
+    ppu->setVRamAddressRegister2(address & 0xFF);
+    ppu->writeToVRam(value);
+}
+
+/**
+ * Opaque background everywhere, sprite 0 as an 8x16 sprite of tile pair $40/$41 in the table tile selects.
+ * The pair has a single opaque row: opaqueRow 0-7 in the top tile, 8-15 in the bottom one. Every other
+ * tile around it and the same tiles in the other table are solid, so reading the wrong tile or table
+ * shows up as a hit on the sprite's first line.
+ */
+void initializeMemory(PPU *ppu, tCPU::byte tile, bool verticalFlip, int opaqueRow) {
+    for (tCPU::word address = 0; address < 0x2000; address++) {
+        int tileIdx = (address & 0xFFF) / 16;
+        bool solid = tileIdx == 0x80 || (tileIdx >= 0x3E && tileIdx <= 0x43);
+        writeVRam(ppu, address, solid && (address & 8) == 0 ? 0xFF : 0);
+    }
+
+    tCPU::word patternTable = (tile & 1) * 0x1000;
+    for (tCPU::word address = patternTable + 0x400; address < patternTable + 0x420; address++) {
+        int row = (address - patternTable - 0x400) / 16 * 8 + address % 8;
+        writeVRam(ppu, address, (address & 8) == 0 && row == opaqueRow ? 0xFF : 0);
+    }
+
+    for (tCPU::word address = 0x2000; address < 0x3000; address++) {
+        writeVRam(ppu, address, (address & 0x3FF) < 0x3C0 ? 0x80 : 0);
+    }
+    for (tCPU::word address = 0x3F00; address < 0x3F20; address++) {
+        writeVRam(ppu, address, address & 0x3F);
+    }
+
+    tCPU::byte oam[256];
+    for (auto &value : oam) {
+        value = 0xF8;
+    }
+    oam[0] = SPRITE_TOP - 1;
+    oam[1] = tile;
+    oam[2] = verticalFlip ? 0x80 : 0;
+    oam[3] = 100;
+    ppu->StartSpriteXferDMA(oam);
+
+    // 8x16 sprites, background from $0000, background and sprites on with the left column shown
+    ppu->setControlRegister1(0x20);
+    ppu->setControlRegister2(0x1E);
+}
+
+/**
+ * Scanline of the frame's first sprite-0 hit, polled after every line like a game waiting on $2002
+ */
+int emulateFrame(PPU *ppu) {
+    int hitScanline = -1;
+    for (int scanline = 0; scanline < 262; scanline++) {
+        ppu->execute(341);
+        if (hitScanline < 0 && (ppu->getStatusRegister() & 0x40)) {
+            hitScanline = scanline;
+        }
+    }
+    return hitScanline;
+}
+
+/**
+ * Sprite row the frame's first hit lands on, and time per frame polling it
+ */
+int measure(bool rendering, tCPU::byte tile, bool verticalFlip, int opaqueRow, long &elapsed) {
+    auto raster = new Raster();
+    auto ppu = new PPU(raster);
+    initializeMemory(ppu, tile, verticalFlip, opaqueRow);
+
+    // the first frame lines the scanline loop up with the PPU's own
+    ppu->setFrameRendering(rendering);
+    int row = emulateFrame(ppu) - SPRITE_TOP;
+
+    auto start = clock_type::now();
+    for (int frame = 0; frame < NUM_FRAMES; frame++) {
+        ppu->setFrameRendering(rendering);
+        emulateFrame(ppu);
+    }
+    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count() / NUM_FRAMES;
+
+    delete ppu;
+    delete raster;
+    return row;
+}
+
+/**
+ * Sprite-0 hits of 8x16 sprites, even and odd tiles, flipped and not, on rendered and render-less frames.
+ * The hit has to land on the opaque row: its own row unflipped, 15 - row flipped.
+ * g++ -std=c++17 -O2 -I .. SpriteZeroHit.cpp ../PPU.cpp ../TileCache.cpp ../NametableCache.cpp
+ *     ../ScanlineCompositor.cpp ../PaletteExpander.cpp ../MemoryMapper.cpp ../Watchpoints.cpp ../Logging.cpp
+ */
+int main() {
+    for (bool rendering : {true, false}) {
+        long total = 0;
+        for (tCPU::byte tile : {0x40, 0x41}) {
+            for (bool verticalFlip : {false, true}) {
+                for (int opaqueRow : {1, 13}) {
+                    long elapsed;
+                    int row = measure(rendering, tile, verticalFlip, opaqueRow, elapsed);
+                    int expected = verticalFlip ? 15 - opaqueRow : opaqueRow;
+                    if (row != expected) {
+                        PrintError("tile $%02X%s, pattern row %d: hit on sprite row %d instead of %d",
+                                   tile, verticalFlip ? " flipped" : "", opaqueRow, row, expected);
+                    }
+                    assert(row == expected);
+                    total += elapsed;
+                }
+            }
+        }
+        PrintInfo("%-12s %6ld us per frame polling sprite 0", rendering ? "rendered:" : "render-less:",
+                  total / 8 / 1000);
+    }
+    return 0;
+}
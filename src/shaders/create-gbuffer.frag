@@ -3,7 +3,10 @@
 layout(location = 0) in vec3 inColor;
 layout(location = 1) in vec2 inTexCoord;
 
-uniform sampler2D texSampler;
+// NES color index per pixel, emphasis bits per scanline, and the 65x8 color table they select from
+uniform usampler2D indexSampler;
+uniform usampler2D emphasisSampler;
+uniform sampler2D colorTableSampler;
 
 layout(location = 0) out vec3 outColor;
 layout(location = 1) out vec3 outHighlights;
@@ -13,7 +16,10 @@ void main()
     vec2 texCoord = inTexCoord;
     texCoord.y = 1 - texCoord.y;
 
-    vec3 color = texture(texSampler, texCoord).rgb;
+    ivec2 pixel = min(ivec2(texCoord * vec2(256, 240)), ivec2(255, 239));
+    uint index = texelFetch(indexSampler, pixel, 0).r;
+    uint emphasis = texelFetch(emphasisSampler, ivec2(pixel.y, 0), 0).r;
+    vec3 color = texelFetch(colorTableSampler, ivec2(index, emphasis), 0).rgb;
 
     // this log is inverse of the tone-mapping exponential function used during composition
     // it preseves the gamma of the original albedo color